@@ -0,0 +1,131 @@
+#include "SheetGenerator.h"
+
+SheetGenerator::SheetGenerator(unsigned seed) : random(seed) {}
+
+std::string SheetGenerator::columnName(size_t column) {
+    std::string name;
+    while (column > 0) {
+        name.insert(name.begin(), static_cast<char>('A' + (column - 1) % 26));
+        column = (column - 1) / 26;
+    }
+    return name;
+}
+
+std::string SheetGenerator::randomText() {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz";
+    std::uniform_int_distribution<size_t> length(3, 24), letter(0, 25), special(0, 19);
+    std::string text;
+    for (size_t i = 0, n = length(random); i < n; ++i) {
+        size_t kind = special(random);
+        text += kind == 0 ? '"' : kind == 1 ? ' ' : alphabet[letter(random)];
+    }
+    return text;
+}
+
+Workload SheetGenerator::deepChain(size_t length) {
+    Workload workload{"deep-chain"};
+    std::uniform_real_distribution<double> value(-100, 100);
+    workload.cells.emplace_back(CPos(1, 1), std::to_string(value(random)));
+    for (size_t row = 2; row <= length; ++row) {
+        workload.cells.emplace_back(CPos(1, row), "=A" + std::to_string(row - 1) + "*0.5+" + std::to_string(row));
+    }
+    workload.probes.emplace_back(1, length);
+    workload.probes.emplace_back(1, length / 2);
+    workload.copySource = CPos(1, 1);
+    workload.copyWidth = 1;
+    workload.copyHeight = static_cast<int>(std::min<size_t>(length, 1000));
+    return workload;
+}
+
+Workload SheetGenerator::wideFanIn(size_t inputs, size_t width) {
+    Workload workload{"wide-fan-in"};
+    std::uniform_real_distribution<double> value(0, 1000);
+    std::uniform_int_distribution<size_t> pick(1, inputs);
+    for (size_t row = 1; row <= inputs; ++row) {
+        workload.cells.emplace_back(CPos(1, row), std::to_string(value(random)));
+    }
+    for (size_t row = 1; row <= inputs / width + 1; ++row) {
+        std::string formula = "=";
+        for (size_t i = 0; i < width; ++i) {
+            formula += (i ? "+A" : "A") + std::to_string(pick(random));
+        }
+        workload.cells.emplace_back(CPos(2, row), formula);
+        workload.probes.emplace_back(2, row);
+    }
+    workload.copySource = CPos(2, 1);
+    workload.copyWidth = 1;
+    workload.copyHeight = static_cast<int>(inputs / width + 1);
+    return workload;
+}
+
+Workload SheetGenerator::filledColumn(size_t rows) {
+    Workload workload{"filled-column"};
+    std::uniform_real_distribution<double> value(-1000, 1000);
+    for (size_t row = 1; row <= rows; ++row) {
+        for (size_t column = 1; column <= 3; ++column) {
+            workload.cells.emplace_back(CPos(column, row), std::to_string(value(random)));
+        }
+        std::string r = std::to_string(row);
+        workload.cells.emplace_back(CPos(4, row), "=A" + r + "*B" + r + "+C" + r + "/$E$1");
+        workload.probes.emplace_back(4, row);
+    }
+    workload.cells.emplace_back(CPos(5, 1), "4");
+    workload.copySource = CPos(1, 1);
+    workload.copyWidth = 4;
+    workload.copyHeight = static_cast<int>(rows);
+    return workload;
+}
+
+Workload SheetGenerator::rangeAggregates(size_t rows, size_t formulas) {
+    Workload workload{"range-aggregates"};
+    static const char *functions[] = {"sum", "min", "max", "count"};
+    std::uniform_int_distribution<int> value(0, 50);
+    std::uniform_int_distribution<size_t> pick(1, rows);
+    for (size_t row = 1; row <= rows; ++row) {
+        workload.cells.emplace_back(CPos(1, row), std::to_string(value(random)));
+        workload.cells.emplace_back(CPos(2, row), std::to_string(value(random)));
+    }
+    for (size_t i = 0; i < formulas; ++i) {
+        size_t a = pick(random), b = pick(random);
+        std::string range = "A";
+        range += std::to_string(std::min(a, b));
+        range += ":B";
+        range += std::to_string(std::max(a, b));
+        std::string formula = "=";
+        if (i % 5 == 4) {
+            formula += "countval(";
+            formula += std::to_string(value(random));
+            formula += ", ";
+        } else {
+            formula += functions[i % 4];
+            formula += "(";
+        }
+        formula += range;
+        formula += ")";
+        workload.cells.emplace_back(CPos(3, i + 1), formula);
+        workload.probes.emplace_back(3, i + 1);
+    }
+    workload.copySource = CPos(1, 1);
+    workload.copyWidth = 2;
+    workload.copyHeight = static_cast<int>(rows);
+    return workload;
+}
+
+Workload SheetGenerator::stringTable(size_t rows, size_t columns) {
+    Workload workload{"string-table"};
+    for (size_t row = 1; row <= rows; ++row) {
+        for (size_t column = 1; column <= columns; ++column) {
+            workload.cells.emplace_back(CPos(column, row), randomText());
+        }
+        std::string r = std::to_string(row);
+        workload.cells.emplace_back(CPos(columns + 1, row),
+                                    "=A" + r + "+\" \"\"and\"\" \"+" + columnName(columns) + r);
+        workload.cells.emplace_back(CPos(columns + 2, row), "=A" + r + "<" + columnName(columns) + r);
+        workload.probes.emplace_back(columns + 1, row);
+        workload.probes.emplace_back(columns + 2, row);
+    }
+    workload.copySource = CPos(1, 1);
+    workload.copyWidth = static_cast<int>(columns + 2);
+    workload.copyHeight = static_cast<int>(rows);
+    return workload;
+}
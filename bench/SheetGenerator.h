@@ -0,0 +1,91 @@
+#ifndef SHEET_GENERATOR_H
+#define SHEET_GENERATOR_H
+
+#include "main.h"
+#include "CPos.h"
+#include <random>
+
+/**
+ * @struct Workload
+ * @brief A synthetic spreadsheet together with the cells worth reading back.
+ */
+struct Workload {
+    std::string name;                                  ///< Short name used in reports.
+    std::vector<std::pair<CPos, std::string>> cells{}; ///< Cell contents in insertion order.
+    std::vector<CPos> probes{};                        ///< Cells read by the getValue benchmark.
+    CPos copySource{1, 1};                             ///< Top-left corner of the block used by the copyRect benchmark.
+    int copyWidth = 1, copyHeight = 1;                 ///< Size of the block used by the copyRect benchmark.
+};
+
+/**
+ * @class SheetGenerator
+ * @brief Generates realistic synthetic sheets for benchmarking CSpreadsheet.
+ *
+ * All workloads are deterministic for a given seed, so results of different builds
+ * and engine modes can be compared with each other.
+ */
+class SheetGenerator {
+public:
+    /**
+     * @brief Constructs a generator using the given random seed.
+     *
+     * @param seed The seed of the pseudo-random number generator.
+     */
+    explicit SheetGenerator(unsigned seed);
+
+    /**
+     * @brief Converts a column number to its letter form (1 -> "A", 27 -> "AA").
+     *
+     * @param column The column number, starting from 1.
+     * @return std::string The column letters.
+     */
+    static std::string columnName(size_t column);
+
+    /**
+     * @brief A chain of formulas where each cell depends on the previous one.
+     *
+     * @param length The number of formulas in the chain.
+     */
+    Workload deepChain(size_t length);
+
+    /**
+     * @brief Formulas that each add up many independent input cells.
+     *
+     * @param inputs The number of input cells.
+     * @param width The number of inputs referenced by each formula.
+     */
+    Workload wideFanIn(size_t inputs, size_t width);
+
+    /**
+     * @brief A formula filled down a column next to three numeric input columns.
+     *
+     * @param rows The number of rows.
+     */
+    Workload filledColumn(size_t rows);
+
+    /**
+     * @brief Aggregate functions (sum, min, max, count, countval) over large ranges.
+     *
+     * @param rows The number of numeric input rows.
+     * @param formulas The number of aggregate formulas.
+     */
+    Workload rangeAggregates(size_t rows, size_t formulas);
+
+    /**
+     * @brief A table of text cells with string concatenation and comparison formulas.
+     *
+     * @param rows The number of rows.
+     * @param columns The number of text columns.
+     */
+    Workload stringTable(size_t rows, size_t columns);
+
+private:
+    /**
+     * @brief Produces a random word, occasionally containing quotes and commas.
+     */
+    std::string randomText();
+
+    std::mt19937 random; ///< Source of pseudo-random numbers.
+};
+
+#endif // SHEET_GENERATOR_H
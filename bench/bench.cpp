@@ -0,0 +1,254 @@
+#include "main.h"
+#include "CSpreadsheet.h"
+#include "SheetGenerator.h"
+#include <chrono>
+#include <numeric>
+#include <sys/resource.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Latencies of individual operations of one benchmark, in nanoseconds.
+    struct Samples {
+        std::vector<double> latencies;
+        size_t bytes = 0; ///< Bytes processed, for benchmarks that stream data.
+
+        template<typename Fn>
+        void measure(Fn &&fn) {
+            auto start = Clock::now();
+            fn();
+            latencies.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        }
+    };
+
+    // Returns the peak resident set size of the process in megabytes.
+    double peakRssMb() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+        return usage.ru_maxrss / 1024.0;
+#endif
+    }
+
+    double percentile(const std::vector<double> &sorted, double p) {
+        if (sorted.empty()) return 0;
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())))];
+    }
+
+    void report(const std::string &workload, const std::string &operation, Samples samples) {
+        std::sort(samples.latencies.begin(), samples.latencies.end());
+        double total = std::accumulate(samples.latencies.begin(), samples.latencies.end(), 0.0);
+        double opsPerSecond = total > 0 ? static_cast<double>(samples.latencies.size()) * 1e9 / total : 0;
+        std::cout << std::left << std::setw(18) << workload << std::setw(16) << operation << std::right
+                  << std::setw(10) << samples.latencies.size()
+                  << std::setw(14) << std::fixed << std::setprecision(0) << opsPerSecond
+                  << std::setw(12) << std::setprecision(2) << percentile(samples.latencies, 0.50) / 1000
+                  << std::setw(12) << percentile(samples.latencies, 0.90) / 1000
+                  << std::setw(12) << percentile(samples.latencies, 0.99) / 1000
+                  << std::setw(12) << (samples.latencies.empty() ? 0 : samples.latencies.back() / 1000);
+        if (samples.bytes) {
+            std::cout << std::setw(10) << static_cast<double>(samples.bytes) * 1e3 / total << " MB/s";
+        }
+        std::cout << std::endl;
+    }
+
+    // Runs all benchmarks on one workload.
+    void run(const Workload &workload, size_t repetitions, unsigned threads, bool printStats, bool profile) {
+        CSpreadsheet sheet;
+        if (profile) {
+            sheet.profiler().enable();
+        }
+        Samples set, bulk, get, save, load, lazyLoad, copy;
+
+        for (const auto &[pos, contents]: workload.cells) {
+            set.measure([&] { sheet.setCell(pos, contents); });
+        }
+        report(workload.name, "setCell", std::move(set));
+
+        for (size_t r = 0; r < repetitions; ++r) {
+            CSpreadsheet imported;
+            imported.setIngestThreads(threads);
+            bulk.measure([&] { imported.setCells(workload.cells); });
+        }
+        report(workload.name, "setCells", std::move(bulk));
+
+        for (size_t r = 0; r < repetitions; ++r) {
+            for (const auto &pos: workload.probes) {
+                get.measure([&] { sheet.getValue(pos); });
+            }
+        }
+        report(workload.name, "getValue", std::move(get));
+
+        if (workload.probes.size() > 1) {
+            // Columnar mode over the same probes, when they form a single column.
+            const CPos &top = workload.probes.front();
+            bool column = std::all_of(workload.probes.begin(), workload.probes.end(), [&](const CPos &pos) {
+                return pos.getColumn() == top.getColumn();
+            });
+            if (column) {
+                Samples columnar;
+                for (size_t r = 0; r < repetitions; ++r) {
+                    columnar.measure([&] { sheet.getColumnValues(top, workload.probes.size()); });
+                }
+                report(workload.name, "getColumnVals", std::move(columnar));
+            }
+        }
+
+        std::string data;
+        for (size_t r = 0; r < repetitions; ++r) {
+            std::ostringstream os;
+            save.measure([&] { sheet.save(os); });
+            data = os.str();
+            save.bytes += data.size();
+        }
+        report(workload.name, "save", std::move(save));
+
+        for (size_t r = 0; r < repetitions; ++r) {
+            CSpreadsheet loaded;
+            loaded.setIngestThreads(threads);
+            std::istringstream is(data);
+            load.measure([&] {
+                if (!loaded.load(is)) throw std::runtime_error("load failed for " + workload.name);
+            });
+            load.bytes += data.size();
+        }
+        report(workload.name, "load", std::move(load));
+
+        // Lazy loading defers compiling the formulas to their first evaluation.
+        for (size_t r = 0; r < repetitions; ++r) {
+            CSpreadsheet loaded;
+            loaded.setIngestThreads(threads);
+            loaded.setLazyLoading(true);
+            std::istringstream is(data);
+            lazyLoad.measure([&] {
+                if (!loaded.load(is)) throw std::runtime_error("lazy load failed for " + workload.name);
+            });
+            lazyLoad.bytes += data.size();
+        }
+        report(workload.name, "loadLazy", std::move(lazyLoad));
+
+        // The same sheet in the compressed columnar format.
+        Samples columnarSave, columnarLoad;
+        std::string columnarData;
+        sheet.setSaveFormat(SaveFormat::Columnar);
+        for (size_t r = 0; r < repetitions; ++r) {
+            std::ostringstream os;
+            columnarSave.measure([&] { sheet.save(os); });
+            columnarData = os.str();
+            columnarSave.bytes += columnarData.size();
+        }
+        sheet.setSaveFormat(SaveFormat::Checksum);
+        report(workload.name, "saveColumnar", std::move(columnarSave));
+
+        for (size_t r = 0; r < repetitions; ++r) {
+            CSpreadsheet loaded;
+            loaded.setIngestThreads(threads);
+            std::istringstream is(columnarData);
+            columnarLoad.measure([&] {
+                if (!loaded.load(is)) throw std::runtime_error("columnar load failed for " + workload.name);
+            });
+            columnarLoad.bytes += columnarData.size();
+        }
+        report(workload.name, "loadColumnar", std::move(columnarLoad));
+
+        // One probed cell and what it depends on, from the columnar file.
+        Samples regionLoad;
+        for (size_t r = 0; r < repetitions; ++r) {
+            CSpreadsheet loaded;
+            loaded.setIngestThreads(threads);
+            std::istringstream is(columnarData);
+            regionLoad.measure([&] {
+                if (!loaded.loadRegion(is, workload.probes.front(), 1, 1)) {
+                    throw std::runtime_error("region load failed for " + workload.name);
+                }
+            });
+        }
+        report(workload.name, "loadRegion", std::move(regionLoad));
+
+        // The values of the bounding rectangle of the cells as CSV, when it is not too sparse.
+        size_t left = SIZE_MAX, top = SIZE_MAX, right = 0, bottom = 0;
+        for (const auto &[pos, contents]: workload.cells) {
+            left = std::min(left, pos.getColumn());
+            top = std::min(top, pos.getRow());
+            right = std::max(right, pos.getColumn());
+            bottom = std::max(bottom, pos.getRow());
+        }
+        if (!workload.cells.empty() && (right - left + 1) * (bottom - top + 1) <= 4 * workload.cells.size()) {
+            Samples csvExport, csvImport;
+            std::string csv;
+            for (size_t r = 0; r < repetitions; ++r) {
+                std::ostringstream os;
+                csvExport.measure([&] { sheet.exportCSV(os, CPos(left, top), right - left + 1, bottom - top + 1); });
+                csv = os.str();
+                csvExport.bytes += csv.size();
+            }
+            report(workload.name, "exportCSV", std::move(csvExport));
+            for (size_t r = 0; r < repetitions; ++r) {
+                CSpreadsheet imported;
+                imported.setIngestThreads(threads);
+                std::istringstream is(csv);
+                csvImport.measure([&] {
+                    if (!imported.importCSV(is, CPos(left, top))) throw std::runtime_error("CSV import failed for " + workload.name);
+                });
+                csvImport.bytes += csv.size();
+            }
+            report(workload.name, "importCSV", std::move(csvImport));
+        }
+
+        CPos destination(workload.copySource.getColumn() + 100, workload.copySource.getRow());
+        for (size_t r = 0; r < repetitions; ++r) {
+            copy.measure([&] {
+                sheet.copyRect(destination, workload.copySource, workload.copyWidth, workload.copyHeight);
+            });
+        }
+        report(workload.name, "copyRect", std::move(copy));
+
+        if (printStats) {
+            sheet.stats().print(std::cout);
+        }
+        if (profile) {
+            sheet.profiler().report(std::cout, 10);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t scale = 1, repetitions = 5;
+    std::string only;
+    unsigned threads = 0;
+    bool printStats = false, profile = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--scale" && i + 1 < argc) scale = std::stoul(argv[++i]);
+        else if (arg == "--repetitions" && i + 1 < argc) repetitions = std::stoul(argv[++i]);
+        else if (arg == "--only" && i + 1 < argc) only = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc) threads = std::stoul(argv[++i]);
+        else if (arg == "--stats") printStats = true;
+        else if (arg == "--profile") profile = true;
+        else {
+            std::cerr << "usage: " << argv[0] << " [--scale N] [--repetitions N] [--only WORKLOAD] [--threads N] [--stats] [--profile]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    SheetGenerator generator(2024);
+    std::vector<Workload> workloads;
+    workloads.push_back(generator.deepChain(1000 * scale));
+    workloads.push_back(generator.wideFanIn(10000 * scale, 50));
+    workloads.push_back(generator.filledColumn(20000 * scale));
+    workloads.push_back(generator.rangeAggregates(2000 * scale, 100));
+    workloads.push_back(generator.stringTable(5000 * scale, 4));
+
+    std::cout << std::left << std::setw(18) << "workload" << std::setw(16) << "operation" << std::right
+              << std::setw(10) << "ops" << std::setw(14) << "ops/s" << std::setw(12) << "p50 us"
+              << std::setw(12) << "p90 us" << std::setw(12) << "p99 us" << std::setw(12) << "max us"
+              << std::setw(16) << "throughput" << std::endl;
+    for (const auto &workload: workloads) {
+        if (!only.empty() && workload.name != only) continue;
+        run(workload, repetitions, threads, printStats, profile);
+    }
+    std::cout << "peak RSS: " << std::setprecision(1) << peakRssMb() << " MB" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+#include "BlockFormat.h"
+#include "ByteScan.h"
+#include "CPos.h"
+
+void BlockFormat::write(std::ostream &os, std::string_view data, size_t blockBytes) {
+    std::vector<Block> blocks;
+    for (size_t begin = 0; begin < data.size();) {
+        size_t end = ByteScan::find(data, '\n', begin);
+        end = end == std::string_view::npos ? data.size() : end + 1;
+
+        // Every line starts with the unique identifier of its cell.
+        size_t key = 0;
+        std::from_chars(data.data() + begin, data.data() + end, key);
+        CPos pos = CPos::fromUniqueId(key);
+        if (blocks.empty() || blocks.back().length >= blockBytes) {
+            blocks.push_back({begin, 0, 0, 0, pos.getColumn(), pos.getRow(), pos.getColumn(), pos.getRow()});
+        }
+        Block &block = blocks.back();
+        block.length += end - begin;
+        ++block.cells;
+        block.left = std::min(block.left, pos.getColumn());
+        block.top = std::min(block.top, pos.getRow());
+        block.right = std::max(block.right, pos.getColumn());
+        block.bottom = std::max(block.bottom, pos.getRow());
+        begin = end;
+    }
+
+    std::ostringstream index;
+    for (auto &block : blocks) {
+        block.crc = ByteScan::crc32c(data.substr(block.offset, block.length));
+        index << block.length << ' ' << block.crc << ' ' << block.cells << ' ' << block.left << ' ' << block.top
+              << ' ' << block.right << ' ' << block.bottom << '\n';
+    }
+    std::string indexText = index.str();
+    os << "BLOCKS " << blocks.size() << ' ' << ByteScan::crc32c(indexText) << '\n' << indexText << data;
+}
+
+bool BlockFormat::readIndex(const std::string &header, std::istream &is, std::vector<Block> &blocks) {
+    std::istringstream headerStream(header);
+    std::string label;
+    size_t count;
+    uint32_t indexCrc;
+    if (!(headerStream >> label >> count >> indexCrc) || label != "BLOCKS") {
+        return false;
+    }
+
+    blocks.clear();
+    uint32_t crc = 0;
+    size_t offset = 0;
+    std::string line;
+    for (size_t i = 0; i < count; ++i) {
+        if (!getline(is, line)) {
+            return false;
+        }
+        crc = ByteScan::crc32c(line + '\n', crc);
+        Block block{};
+        block.offset = offset;
+        std::istringstream lineStream(line);
+        if (!(lineStream >> block.length >> block.crc >> block.cells >> block.left >> block.top >> block.right
+                         >> block.bottom)) {
+            return false;
+        }
+        offset += block.length;
+        blocks.push_back(block);
+    }
+    return crc == indexCrc;
+}
+
+bool BlockFormat::verify(std::string_view data, const Block &block, size_t base) {
+    if (block.offset < base || block.offset - base + block.length > data.size()) {
+        return false;
+    }
+    return ByteScan::crc32c(data.substr(block.offset - base, block.length)) == block.crc;
+}
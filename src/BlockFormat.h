@@ -0,0 +1,75 @@
+#ifndef BLOCK_FORMAT_H
+#define BLOCK_FORMAT_H
+
+#include "main.h"
+
+/**
+ * @brief The file formats save can write. load accepts all of them.
+ */
+enum class SaveFormat {
+    Checksum, ///< A CHECKSUM line with the byte sum of all cell lines, then the lines.
+    Blocks,   ///< A BLOCKS line and an index of CRC32C-checked blocks of cell lines, then the lines.
+    Columnar  ///< A COLUMNAR line and an index of compressed, CRC32C-checked column sections (see ColumnarFormat).
+};
+
+/**
+ * @class BlockFormat
+ * @brief Writes and reads the block index of the SaveFormat::Blocks file format.
+ *
+ * The cell lines are the same as in the CHECKSUM format, but are cut into blocks of whole
+ * lines of about a given size. The file starts with the line "BLOCKS <count> <crc>",
+ * followed by one index line per block:
+ *
+ *     <length> <crc> <cells> <left> <top> <right> <bottom>
+ *
+ * giving the length of the block in bytes, its CRC32C, the number of cells in it and the
+ * columns and rows bounding them. The crc in the first line covers the index lines. The
+ * blocks follow the index back to back, so the position of every block is known before
+ * any of them is read: the blocks can be verified independently, in parallel, and a reader
+ * interested in some cells can skip the blocks whose bounds do not contain them.
+ */
+class BlockFormat {
+public:
+    static constexpr size_t DEFAULT_BLOCK_BYTES = 1 << 20; ///< The default block size.
+
+    /**
+     * @brief One entry of the block index.
+     */
+    struct Block {
+        size_t offset;                   ///< The position of the block, counted from the end of the index.
+        size_t length;                   ///< The length of the block in bytes.
+        uint32_t crc;                    ///< The CRC32C of the block.
+        size_t cells;                    ///< The number of cell lines in the block.
+        size_t left, top, right, bottom; ///< The columns and rows bounding the cells, inclusive.
+    };
+
+    /**
+     * @brief Writes cell lines in the block format.
+     *
+     * @param os The stream to write to.
+     * @param data The cell lines, each terminated by '\n'.
+     * @param blockBytes The size at which a block is cut; a block ends with the line that reaches it.
+     */
+    static void write(std::ostream &os, std::string_view data, size_t blockBytes);
+
+    /**
+     * @brief Reads and verifies the block index.
+     *
+     * @param header The first line of the file, already read.
+     * @param is The stream, positioned after the first line; left positioned at the first block.
+     * @param blocks Receives the index.
+     * @return bool False if the header or the index is malformed or fails its checksum.
+     */
+    static bool readIndex(const std::string &header, std::istream &is, std::vector<Block> &blocks);
+
+    /**
+     * @brief Returns true if the bytes of a block match its checksum.
+     *
+     * @param data Bytes read from the blocks, containing the block.
+     * @param block The block.
+     * @param base The offset (see Block::offset) of the first byte of data.
+     */
+    static bool verify(std::string_view data, const Block &block, size_t base = 0);
+};
+
+#endif // BLOCK_FORMAT_H
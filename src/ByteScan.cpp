@@ -0,0 +1,187 @@
+#include "ByteScan.h"
+#include <atomic>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BYTE_SCAN_X86 1
+#endif
+
+namespace {
+
+uint64_t sumScalar(const unsigned char *bytes, size_t size) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < size; ++i) {
+        total += bytes[i];
+    }
+    return total;
+}
+
+size_t findScalar(const unsigned char *bytes, size_t size, unsigned char byte) {
+    const void *found = std::memchr(bytes, byte, size);
+    return found ? static_cast<const unsigned char *>(found) - bytes : std::string_view::npos;
+}
+
+// The table of the reflected CRC32C polynomial, one entry per byte value.
+constexpr std::array<uint32_t, 256> CRC32C_TABLE = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78u : 0);
+        }
+        table[byte] = crc;
+    }
+    return table;
+}();
+
+uint32_t crc32cScalar(const unsigned char *bytes, size_t size, uint32_t crc) {
+    for (size_t i = 0; i < size; ++i) {
+        crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ bytes[i]) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef BYTE_SCAN_X86
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(const unsigned char *bytes, size_t size, uint32_t crc) {
+    uint64_t wide = crc;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+    }
+    auto narrow = static_cast<uint32_t>(wide);
+    for (; i < size; ++i) {
+        narrow = _mm_crc32_u8(narrow, bytes[i]);
+    }
+    return narrow;
+}
+
+__attribute__((target("avx2")))
+uint64_t sumAvx2(const unsigned char *bytes, size_t size) {
+    // _mm256_sad_epu8 against zero adds each group of 8 bytes into a 64-bit lane.
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i totals = zero;
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i + 96));
+        totals = _mm256_add_epi64(totals, _mm256_add_epi64(_mm256_sad_epu8(a, zero), _mm256_sad_epu8(b, zero)));
+        totals = _mm256_add_epi64(totals, _mm256_add_epi64(_mm256_sad_epu8(c, zero), _mm256_sad_epu8(d, zero)));
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+        totals = _mm256_add_epi64(totals, _mm256_sad_epu8(a, zero));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), totals);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumScalar(bytes + i, size - i);
+}
+
+__attribute__((target("avx2")))
+size_t findAvx2(const unsigned char *bytes, size_t size, unsigned char byte) {
+    const __m256i needle = _mm256_set1_epi8(static_cast<char>(byte));
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i + 32));
+        auto low = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, needle)));
+        auto high = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, needle)));
+        uint64_t mask = low | static_cast<uint64_t>(high) << 32;
+        if (mask) {
+            return i + __builtin_ctzll(mask);
+        }
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, needle)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    size_t rest = findScalar(bytes + i, size - i, byte);
+    return rest == std::string_view::npos ? rest : i + rest;
+}
+
+bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+bool hasSse42() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+
+#endif
+
+std::atomic<bool> simdEnabled = true; // Cleared by ByteScan::useSimd(false).
+
+bool useAvx2() {
+#ifdef BYTE_SCAN_X86
+    return simdEnabled.load(std::memory_order_relaxed) && hasAvx2();
+#else
+    return false;
+#endif
+}
+
+bool useSse42() {
+#ifdef BYTE_SCAN_X86
+    return simdEnabled.load(std::memory_order_relaxed) && hasSse42();
+#else
+    return false;
+#endif
+}
+
+} // namespace
+
+uint64_t ByteScan::sum(std::string_view bytes) {
+    auto data = reinterpret_cast<const unsigned char *>(bytes.data());
+#ifdef BYTE_SCAN_X86
+    if (useAvx2()) {
+        return sumAvx2(data, bytes.size());
+    }
+#endif
+    return sumScalar(data, bytes.size());
+}
+
+size_t ByteScan::find(std::string_view bytes, char byte, size_t from) {
+    if (from >= bytes.size()) {
+        return std::string_view::npos;
+    }
+    auto data = reinterpret_cast<const unsigned char *>(bytes.data()) + from;
+    size_t size = bytes.size() - from;
+    size_t found;
+#ifdef BYTE_SCAN_X86
+    if (useAvx2()) {
+        found = findAvx2(data, size, static_cast<unsigned char>(byte));
+    } else
+#endif
+    {
+        found = findScalar(data, size, static_cast<unsigned char>(byte));
+    }
+    return found == std::string_view::npos ? found : from + found;
+}
+
+uint32_t ByteScan::crc32c(std::string_view bytes, uint32_t crc) {
+    auto data = reinterpret_cast<const unsigned char *>(bytes.data());
+    crc = ~crc;
+#ifdef BYTE_SCAN_X86
+    if (useSse42()) {
+        return ~crc32cSse42(data, bytes.size(), crc);
+    }
+#endif
+    return ~crc32cScalar(data, bytes.size(), crc);
+}
+
+void ByteScan::useSimd(bool enabled) {
+    simdEnabled = enabled;
+}
+
+const char *ByteScan::implementation() {
+    return useAvx2() ? "avx2" : "scalar";
+}
@@ -0,0 +1,59 @@
+#ifndef BYTE_SCAN_H
+#define BYTE_SCAN_H
+
+#include "main.h"
+
+/**
+ * @class ByteScan
+ * @brief Vectorized loops over the bytes of the text file format.
+ *
+ * The sum behind the CHECKSUM line, the block checksums and the search for line and field
+ * delimiters run over every byte of a saved sheet. On x86-64 processors with AVX2 the sum
+ * and the search process 32 bytes per step, and with SSE4.2 the CRC32C instruction handles
+ * 8 bytes per step; the implementation is chosen once, at the first call, from the processor
+ * the program runs on, so the binary needs no special compiler flags. Elsewhere scalar
+ * implementations give the same results.
+ */
+class ByteScan {
+public:
+    /**
+     * @brief Returns the sum of the bytes, each read as unsigned char.
+     */
+    static uint64_t sum(std::string_view bytes);
+
+    /**
+     * @brief Returns the position of the first occurrence of a byte at or after from.
+     *
+     * @param bytes The bytes to search.
+     * @param byte The byte to find, such as '\n' or a field delimiter.
+     * @param from The position to start at.
+     * @return size_t The position, or std::string_view::npos if the byte does not occur.
+     */
+    static size_t find(std::string_view bytes, char byte, size_t from = 0);
+
+    /**
+     * @brief Returns the CRC32C (Castagnoli) checksum of the bytes.
+     *
+     * Unlike the byte sum, it detects reordered bytes. A checksum can be extended over more
+     * bytes by passing the checksum of the preceding ones.
+     *
+     * @param bytes The bytes to checksum.
+     * @param crc The checksum of the bytes before them; 0 to start a new checksum.
+     * @return uint32_t The checksum.
+     */
+    static uint32_t crc32c(std::string_view bytes, uint32_t crc = 0);
+
+    /**
+     * @brief Chooses between the vectorized and the scalar implementation, for tests and benchmarks.
+     *
+     * @param enabled False to always use the scalar loops; true to use AVX2 and SSE4.2 where the processor has them.
+     */
+    static void useSimd(bool enabled);
+
+    /**
+     * @brief Returns the name of the implementation in use: "avx2" or "scalar".
+     */
+    static const char *implementation();
+};
+
+#endif // BYTE_SCAN_H
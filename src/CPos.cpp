@@ -1,13 +1,37 @@
 #include "CPos.h"
+#include "CellReference.h"
+
+namespace {
+    // Spreads the lower 32 bits of a value to the even bit positions.
+    uint64_t spreadBits(uint64_t value) {
+        value &= 0xFFFFFFFFull;
+        value = (value | (value << 16)) & 0x0000FFFF0000FFFFull;
+        value = (value | (value << 8)) & 0x00FF00FF00FF00FFull;
+        value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        value = (value | (value << 2)) & 0x3333333333333333ull;
+        value = (value | (value << 1)) & 0x5555555555555555ull;
+        return value;
+    }
+
+    // Collects the even bit positions of a value into its lower 32 bits.
+    uint64_t compactBits(uint64_t value) {
+        value &= 0x5555555555555555ull;
+        value = (value | (value >> 1)) & 0x3333333333333333ull;
+        value = (value | (value >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+        value = (value | (value >> 4)) & 0x00FF00FF00FF00FFull;
+        value = (value | (value >> 8)) & 0x0000FFFF0000FFFFull;
+        value = (value | (value >> 16)) & 0x00000000FFFFFFFFull;
+        return value;
+    }
+}
 
 /**
  * Constructs a CPos object from a string cell reference.
  *
  * @param str A string representing the cell reference.
  */
-CPos::CPos(std::string_view str) {
+CPos::CPos(std::string_view str) : packed(0) {
     parseCellRef(str);
-    updateUniqueId();  // Compute unique ID based on column and row.
 }
 
 /**
@@ -16,9 +40,7 @@ CPos::CPos(std::string_view str) {
  * @param col The column number.
  * @param row The row number.
  */
-CPos::CPos(size_t col, size_t row) : column(col), row(row) {
-    updateUniqueId();  // Compute unique ID based on column and row.
-}
+CPos::CPos(size_t col, size_t row) : packed(pack(col, row)) {}
 
 /**
  * Calculates the offset between two positions.
@@ -27,7 +49,7 @@ CPos::CPos(size_t col, size_t row) : column(col), row(row) {
  * @return CPos The resulting offset position.
  */
 CPos CPos::operator-(const CPos &other) const {
-    return CPos(column - other.column, row - other.row);
+    return CPos(getColumn() - other.getColumn(), getRow() - other.getRow());
 }
 
 /**
@@ -38,7 +60,7 @@ CPos CPos::operator-(const CPos &other) const {
  * @return CPos The new position after shifting.
  */
 CPos CPos::shift(int dx, int dy) const {
-    return CPos(column + dx, row + dy);
+    return CPos(getColumn() + dx, getRow() + dy);
 }
 
 /**
@@ -47,7 +69,7 @@ CPos CPos::shift(int dx, int dy) const {
  * @return size_t The unique identifier.
  */
 size_t CPos::getUniqueId() const {
-    return uniqueId;
+    return packed;
 }
 
 /**
@@ -55,22 +77,67 @@ size_t CPos::getUniqueId() const {
  *
  * @return size_t The column number.
  */
-size_t CPos::getColumn() const { return column; }
+size_t CPos::getColumn() const { return packed >> ROW_BITS; }
 
 /**
  * Gets the row number.
  *
  * @return size_t The row number.
  */
-size_t CPos::getRow() const { return row; }
+size_t CPos::getRow() const { return packed & ROW_MASK; }
+
+/**
+ * Gets the Z-order (Morton) key of the position.
+ *
+ * The column occupies the odd and the row the even bits of the key.
+ *
+ * @return uint64_t The Morton key.
+ */
+uint64_t CPos::getMortonKey() const {
+    return (spreadBits(getColumn()) << 1) | spreadBits(getRow());
+}
+
+/**
+ * Reconstructs a position from its Morton key.
+ *
+ * @param key The Morton key.
+ * @return CPos The position.
+ */
+CPos CPos::fromMortonKey(uint64_t key) {
+    return CPos(compactBits(key >> 1), compactBits(key));
+}
+
+/**
+ * Gets the key of the position for the given enumeration order.
+ *
+ * @param order The order to get the key for.
+ * @return uint64_t The key.
+ */
+uint64_t CPos::getOrderKey(CellOrder order) const {
+    return order == CellOrder::Morton ? getMortonKey() : packed;
+}
+
+/**
+ * Returns the cell reference in Excel-like form.
+ *
+ * @return std::string The cell reference.
+ */
+std::string CPos::toString() const {
+    std::string columnPart;
+    for (size_t tempColumn = getColumn(); tempColumn > 0; tempColumn = (tempColumn - 1) / 26) {
+        columnPart.insert(columnPart.begin(), static_cast<char>('A' + (tempColumn - 1) % 26));
+    }
+    return columnPart + std::to_string(getRow());
+}
 
 /**
- * Updates the unique identifier for the position.
+ * Reconstructs a position from its unique identifier.
  *
- * Combines column and row into a unique identifier.
+ * @param uniqueId The unique identifier.
+ * @return CPos The position.
  */
-void CPos::updateUniqueId() {
-    uniqueId = (column << (sizeof(size_t) * 4)) + row;
+CPos CPos::fromUniqueId(size_t uniqueId) {
+    return CPos(uniqueId >> ROW_BITS, uniqueId & ROW_MASK);
 }
 
 /**
@@ -81,19 +148,9 @@ void CPos::updateUniqueId() {
  * @param cellRef A string representing the cell reference.
  */
 void CPos::parseCellRef(std::string_view cellRef) {
-    size_t i = 0;
-    column = 0;
-
-    // Process column characters (base-26 conversion).
-    while (i < cellRef.size() && std::isalpha(cellRef[i])) {
-        column = column * 26 + (toupper(cellRef[i]) - 'A' + 1);
-        ++i;
-    }
-
-    // Ensure row numbers are after the column letters.
-    if (i < cellRef.size()) {
-        row = std::stoull(std::string(cellRef.substr(i)));
-    } else {
+    CellReference reference;
+    if (!parseCellReference(cellRef, reference) || reference.absoluteColumn || reference.absoluteRow) {
         throw std::invalid_argument("Invalid cell reference format");
     }
-}
\ No newline at end of file
+    packed = pack(reference.column, reference.row);
+}
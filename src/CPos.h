@@ -3,12 +3,24 @@
 
 #include "main.h"
 
+/**
+ * @brief Orders in which cell positions can be enumerated.
+ */
+enum class CellOrder {
+    Storage,  ///< The order of the underlying hash map (no sorting).
+    RowMajor, ///< By column, then by row (the order of unique identifiers).
+    Morton    ///< Z-order: cells that are close in 2D are close in the order.
+};
+
 /**
  * @class CPos
  * @brief Represents a position in a spreadsheet using column and row identifiers.
  *
  * The CPos class provides methods for handling spreadsheet cell references,
  * including converting from string references, calculating offsets, and more.
+ * The column and row are packed into a single 64-bit word (column in the upper
+ * and row in the lower 32 bits), which is also the unique identifier of the cell.
+ * Arithmetic on coordinates wraps modulo 2^32, so offsets may be negative.
  */
 class CPos {
 public:
@@ -80,17 +92,59 @@ public:
      */
     size_t getRow() const;
 
-private:
-    size_t column, row;  ///< The column and row indices for the position.
-    size_t uniqueId;     ///< A unique identifier for the position.
+    /**
+     * @brief Gets the Z-order (Morton) key of the position.
+     *
+     * The key interleaves the bits of the column and the row, so positions that are
+     * near each other in both directions are also near each other in key order.
+     *
+     * @return uint64_t The Morton key.
+     */
+    uint64_t getMortonKey() const;
+
+    /**
+     * @brief Reconstructs a position from its Morton key.
+     *
+     * @param key A key previously returned by getMortonKey.
+     * @return CPos The position with the given key.
+     */
+    static CPos fromMortonKey(uint64_t key);
+
+    /**
+     * @brief Gets the key of the position for the given enumeration order.
+     *
+     * @param order The order to get the key for.
+     * @return uint64_t The key; comparing keys compares positions in the given order.
+     */
+    uint64_t getOrderKey(CellOrder order) const;
+
+    /**
+     * @brief Returns the cell reference in Excel-like form (e.g., "B12").
+     *
+     * @return std::string The cell reference.
+     */
+    std::string toString() const;
 
     /**
-     * @brief Updates the unique identifier for the position.
+     * @brief Reconstructs a position from its unique identifier.
      *
-     * This method calculates and updates the uniqueId member variable based on
-     * the current column and row indices.
+     * @param uniqueId An identifier previously returned by getUniqueId.
+     * @return CPos The position with the given identifier.
      */
-    void updateUniqueId();
+    static CPos fromUniqueId(size_t uniqueId);
+
+private:
+    static constexpr unsigned ROW_BITS = 32; ///< Bits of the packed word holding the row.
+    static constexpr uint64_t ROW_MASK = (uint64_t(1) << ROW_BITS) - 1;
+
+    uint64_t packed; ///< Column in the upper and row in the lower 32 bits; also the unique identifier.
+
+    /**
+     * @brief Packs a column and a row, wrapping each modulo 2^32.
+     */
+    static constexpr uint64_t pack(uint64_t col, uint64_t row) {
+        return ((col & ROW_MASK) << ROW_BITS) | (row & ROW_MASK);
+    }
 
     /**
      * @brief Parses a string cell reference and sets the column and row.
@@ -103,4 +157,6 @@ private:
     void parseCellRef(std::string_view cellRef);
 };
 
+static_assert(sizeof(CPos) == sizeof(uint64_t), "CPos must stay a single packed word");
+
 #endif // CPOS_H
\ No newline at end of file
@@ -1,37 +1,148 @@
 #include "CSpreadsheet.h"
+#include <typeinfo>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "ExprElement.h"
-#include "CustomExpressionBuilder.h"
+#include "ExpressionParser.h"
+#include "ExprOptimizer.h"
+#include "ParallelIngest.h"
+#include "MemoryUsage.h"
+#include "ByteScan.h"
+#include "BlockFormat.h"
+#include "ColumnarFormat.h"
+#include "CsvFormat.h"
 
 // Evaluates an expression stack and returns the resulting value.
-static CValue evaluateExpression(const std::stack<std::shared_ptr<ExprElement>> &exprStack,
-                                 const std::unordered_map<size_t, CustomCValue> &sheet,
-                                 std::unordered_set<size_t> &evaluationPath) {
-    std::stack<std::shared_ptr<ExprElement>> copyExprStack;
-    auto tempStack = exprStack;
+static CValue evaluateExpression(const ExprStack &exprStack,
+                                 const CellStore &sheet,
+                                 EvaluationContext &context) {
+    context.checkCancelled();
+    // The elements are stored in evaluation order.
+    std::stack<CValue> evalStack;
+    for (const auto &element : exprElements(exprStack)) {
+        element->evaluate(evalStack, sheet, context);
+        if (context.error != CellError::None) break;
+    }
+    if (context.error == CellError::None && evalStack.size() != 1) {
+        context.error = CellError::Name;
+    }
+    if (context.error != CellError::None) {
+        // Return default value on error; the code stays available to getError.
+        EXCEL_STATS(++excelStats->errors[static_cast<size_t>(context.error)]);
+        context.failure = context.error;
+        context.error = CellError::None;
+        return CValue();
+    }
+    return evalStack.top();
+}
 
-    // Reverse the stack for correct evaluation order.
-    while (!tempStack.empty()) {
-        copyExprStack.push(tempStack.top());
-        tempStack.pop();
+// Reads a number the way std::stod does (leading spaces, a sign, decimal, hexadecimal,
+// inf and nan), but with std::from_chars, so text is told apart without an exception.
+// Unlike std::stod, it accepts subnormal numbers. Returns false unless the whole string
+// is the number.
+static bool readNumber(std::string_view text, double &number) {
+    size_t start = 0;
+    while (start < text.size() && std::isspace(static_cast<unsigned char>(text[start]))) {
+        ++start;
+    }
+    text.remove_prefix(start);
+    bool negative = !text.empty() && text[0] == '-';
+    if (!text.empty() && (text[0] == '-' || text[0] == '+')) {
+        text.remove_prefix(1);
+    }
+    auto format = std::chars_format::general;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        text.remove_prefix(2);
+        format = std::chars_format::hex;
+    }
+    // The sign is already read: from_chars must not accept another one.
+    if (text.empty() || text[0] == '-' || text[0] == '+') {
+        return false;
+    }
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number, format);
+    if (error != std::errc() || end != text.data() + text.size()) {
+        return false;
     }
+    if (negative) {
+        number = -number;
+    }
+    return true;
+}
 
-    std::stack<CValue> evalStack;
-    while (!copyExprStack.empty()) {
-        auto element = copyExprStack.top();
-        copyExprStack.pop();
-        try {
-            element->evaluate(evalStack, sheet, evaluationPath);
-        } catch (const std::exception &e) {
-            // Return default value on error.
-            return CValue();
-        }
+// Reads everything left in a stream.
+static std::string readRemaining(std::istream &is) {
+    std::ostringstream contentStream;
+    contentStream << is.rdbuf();
+    return contentStream.str();
+}
+
+// Resets a range index when it goes out of scope. Bulk insertions end with one, as a single
+// rebuild on the next query is cheaper than an update per cell, and the index must not be
+// left stale when a parse error stops them halfway.
+class RangeIndexReset {
+public:
+    explicit RangeIndexReset(RangeIndex &index) : index(index) {}
+    ~RangeIndexReset() { index.reset(); }
+    RangeIndexReset(const RangeIndexReset &) = delete;
+    RangeIndexReset &operator=(const RangeIndexReset &) = delete;
+
+private:
+    RangeIndex &index;
+};
+
+// Checks that the data holds exactly the indexed sections of a file and that they match
+// their checksums, verifying the sections in parallel.
+template<typename Section, typename Verify>
+static bool verifySections(const std::string &content, const std::vector<Section> &sections, unsigned threads,
+                           Verify verify) {
+    if (content.size() != (sections.empty() ? 0 : sections.back().offset + sections.back().length)) {
+        return false;
     }
+    bool valid = true;
+    ParallelIngest::run<bool>(
+            sections.size(), threads,
+            [&content, &sections, verify](size_t section) { return verify(content, sections[section], 0); },
+            [&valid](bool sectionValid) { valid = valid && sectionValid; });
+    return valid;
+}
 
-    if (evalStack.size() != 1) {
-        throw std::runtime_error("Invalid expression: more than one value remains after evaluation");
+// Returns the ranges a cell reads as a whole; none unless it holds a formula.
+static std::vector<RangeIndex::Area> rangeOperands(const CustomCValue &contents) {
+    std::vector<RangeIndex::Area> areas;
+    if (!std::holds_alternative<ExprStack>(contents)) {
+        return areas;
+    }
+    try {
+        for (const auto &element : exprElements(LazyFormula::expand(std::get<ExprStack>(contents)))) {
+            const Range *range = element->rangeOperand();
+            if (range && range->isValid()) {
+                areas.emplace_back(range->getStart(), range->getEnd());
+            }
+        }
+    } catch (const std::exception &) {
+        // A saved formula that does not compile reads nothing.
     }
+    return areas;
+}
 
-    return evalStack.top();
+// Returns the cells a cell reads: its ranges and, as single cells, its references.
+static std::vector<RangeIndex::Area> operandAreas(const CustomCValue &contents) {
+    std::vector<RangeIndex::Area> areas = rangeOperands(contents);
+    if (!std::holds_alternative<ExprStack>(contents)) {
+        return areas;
+    }
+    try {
+        for (const auto &element : exprElements(LazyFormula::expand(std::get<ExprStack>(contents)))) {
+            if (const Reference *reference = element->referenceOperand()) {
+                CPos cell(reference->getColumn(), reference->getRow());
+                areas.emplace_back(cell, cell);
+            }
+        }
+    } catch (const std::exception &) {
+        // A saved formula that does not compile reads nothing.
+    }
+    return areas;
 }
 
 unsigned CSpreadsheet::capabilities() {
@@ -41,142 +152,335 @@ unsigned CSpreadsheet::capabilities() {
 CSpreadsheet::CSpreadsheet() = default;
 
 bool CSpreadsheet::load(std::istream &is) {
+    StatsScope statsScope(statistics, &EvaluationStats::load);
+    auto paused = scheduler.pause();
     std::string line;
-    unsigned long calculatedChecksum = 0;
-    unsigned long readChecksum;
+    if (!getline(is, line)) return false;
+    std::string content;
+
+    if (line.starts_with("COLUMNAR")) {
+        std::vector<ColumnarFormat::Section> sections;
+        if (!ColumnarFormat::readIndex(line, is, sections)) return false;
+        content = readRemaining(is);
+        if (!verifySections(content, sections, ingestThreads, &ColumnarFormat::verify)) return false;
+
+        // Decode the sections straight into the column bands of the store.
+        using ParsedCells = std::vector<std::pair<size_t, CustomCValue>>;
+        ColumnarFormat::FormulaParser formulaParser = [lazy = lazyLoading](std::string saved) {
+            CustomCValue cell;
+            parseSavedFormula(std::move(saved), lazy, cell);
+            return cell;
+        };
+        RangeIndexReset resetIndex(rangeIndex);
+        ParallelIngest::run<ParsedCells>(
+                sections.size(), ingestThreads,
+                [&content, &sections, &formulaParser](size_t section) {
+                    return ColumnarFormat::decode(content, sections[section], formulaParser);
+                },
+                [this](ParsedCells &&cells) { sheet.setMany(cells); });
+        return true;
+    } else if (line.starts_with("BLOCKS")) {
+        std::vector<BlockFormat::Block> blocks;
+        if (!BlockFormat::readIndex(line, is, blocks)) return false;
+        content = readRemaining(is);
+        if (!verifySections(content, blocks, ingestThreads, &BlockFormat::verify)) return false;
+    } else {
+        unsigned long readChecksum;
+        std::istringstream checksumStream(line);
+        std::string checksumLabel;
+        checksumStream >> checksumLabel >> readChecksum;
+        if (checksumLabel != "CHECKSUM") return false;
+
+        // The checksum counts every line as ending in '\n'.
+        content = readRemaining(is);
+        if (!content.empty() && content.back() != '\n') {
+            content += '\n';
+        }
+        if (readChecksum != ByteScan::sum(content)) {
+            return false;
+        }
+    }
+
+    // Split the data into chunks of whole lines, parsed in parallel and inserted in file order.
+    constexpr size_t CHUNK_BYTES = 64 * 1024;
+    std::vector<std::pair<size_t, size_t>> chunks;
+    for (size_t begin = 0; begin < content.size();) {
+        size_t end = ByteScan::find(content, '\n', std::min(begin + CHUNK_BYTES, content.size() - 1));
+        end = end == std::string::npos ? content.size() : end + 1;
+        chunks.emplace_back(begin, end);
+        begin = end;
+    }
+
+    using ParsedCells = std::vector<std::pair<size_t, CustomCValue>>;
+    RangeIndexReset resetIndex(rangeIndex);
+    ParallelIngest::run<ParsedCells>(
+            chunks.size(), ingestThreads,
+            [&content, &chunks, lazy = lazyLoading](size_t chunk) {
+                std::string_view lines(content);
+                return parseSavedLines(lines.substr(chunks[chunk].first, chunks[chunk].second - chunks[chunk].first),
+                                       lazy);
+            },
+            [this](ParsedCells &&cells) {
+                for (auto &[key, cell] : cells) {
+                    sheet.set(key, std::move(cell));
+                }
+            });
+    return true;
+}
+
+bool CSpreadsheet::loadRegion(std::istream &is, const CPos &topLeft, size_t w, size_t h) {
+    std::vector<RangeIndex::Area> areas;
+    if (w > 0 && h > 0) {
+        // Clamped to the sheet before adding, so that huge sizes do not wrap around.
+        areas.emplace_back(topLeft, CPos(topLeft.getColumn() + std::min<size_t>(w - 1, UINT32_MAX - topLeft.getColumn()),
+                                          topLeft.getRow() + std::min<size_t>(h - 1, UINT32_MAX - topLeft.getRow())));
+    }
+    return loadAreas(is, std::move(areas));
+}
+
+bool CSpreadsheet::loadColumns(std::istream &is, const std::vector<size_t> &columns) {
+    std::vector<RangeIndex::Area> areas;
+    for (size_t column : columns) {
+        areas.emplace_back(CPos(column, 0), CPos(column, UINT32_MAX));
+    }
+    return loadAreas(is, std::move(areas));
+}
 
+bool CSpreadsheet::loadAreas(std::istream &is, std::vector<RangeIndex::Area> areas) {
+    StatsScope statsScope(statistics, &EvaluationStats::load);
+    auto paused = scheduler.pause();
+    std::string line;
     if (!getline(is, line)) return false;
-    std::istringstream checksumStream(line);
-    std::string checksumLabel;
-    checksumStream >> checksumLabel >> readChecksum;
-    if (checksumLabel != "CHECKSUM") return false;
 
-    std::ostringstream contentStream;
+    // The parts of the file that can be read on their own: blocks, column sections, or
+    // the whole data of a file without an index.
+    using ParsedCells = std::vector<std::pair<size_t, CustomCValue>>;
+    struct Part {
+        size_t left, top, right, bottom; // The columns and rows bounding the cells of the part.
+        size_t offset, length;           // The position of the part, counted from the end of the index.
+        bool empty;
+
+        bool overlaps(const RangeIndex::Area &area) const {
+            return !empty && left <= area.second.getColumn() && area.first.getColumn() <= right
+                   && top <= area.second.getRow() && area.first.getRow() <= bottom;
+        }
+    };
+    std::vector<Part> parts;
+    std::vector<BlockFormat::Block> blocks;
+    std::vector<ColumnarFormat::Section> sections;
+    std::function<std::optional<ParsedCells>(size_t, std::string_view)> parsePart;
+    std::optional<std::string> content; // All the data, if it cannot be read part by part.
+    bool lazy = lazyLoading;
+
+    if (line.starts_with("COLUMNAR")) {
+        if (!ColumnarFormat::readIndex(line, is, sections)) return false;
+        for (const auto &section : sections) {
+            parts.push_back({section.column, section.top, section.column, section.bottom, section.offset,
+                             section.length, section.cells == 0});
+        }
+        ColumnarFormat::FormulaParser formulaParser = [lazy](std::string saved) {
+            CustomCValue cell;
+            parseSavedFormula(std::move(saved), lazy, cell);
+            return cell;
+        };
+        parsePart = [&sections, formulaParser](size_t part, std::string_view bytes) -> std::optional<ParsedCells> {
+            const auto &section = sections[part];
+            if (!ColumnarFormat::verify(bytes, section, section.offset)) return std::nullopt;
+            return ColumnarFormat::decode(bytes, section, formulaParser, section.offset);
+        };
+    } else if (line.starts_with("BLOCKS")) {
+        if (!BlockFormat::readIndex(line, is, blocks)) return false;
+        for (const auto &block : blocks) {
+            parts.push_back({block.left, block.top, block.right, block.bottom, block.offset, block.length,
+                             block.cells == 0});
+        }
+        parsePart = [&blocks, lazy](size_t part, std::string_view bytes) -> std::optional<ParsedCells> {
+            if (!BlockFormat::verify(bytes, blocks[part], blocks[part].offset)) return std::nullopt;
+            return parseSavedLines(bytes, lazy);
+        };
+    } else {
+        // Without an index, the whole file is read and verified as load does.
+        unsigned long readChecksum;
+        std::istringstream checksumStream(line);
+        std::string checksumLabel;
+        checksumStream >> checksumLabel >> readChecksum;
+        if (checksumLabel != "CHECKSUM") return false;
+        content = readRemaining(is);
+        if (!content->empty() && content->back() != '\n') {
+            *content += '\n';
+        }
+        if (readChecksum != ByteScan::sum(*content)) return false;
+        parts.push_back({0, 0, SIZE_MAX, SIZE_MAX, 0, content->size(), content->empty()});
+        parsePart = [lazy](size_t, std::string_view bytes) -> std::optional<ParsedCells> {
+            return parseSavedLines(bytes, lazy);
+        };
+    }
 
-    // Process content and calculate checksum.
-    while (getline(is, line)) {
-        contentStream << line << '\n';
-        for (char c : line) {
-            calculatedChecksum += static_cast<unsigned char>(c);
+    std::streampos base = is.tellg();
+    if (!content && base == std::streampos(-1)) {
+        content = readRemaining(is);
+    }
+    auto readPart = [&is, &content, base](const Part &part, std::string &bytes) {
+        if (content) {
+            if (part.offset + part.length > content->size()) return false;
+            bytes.assign(*content, part.offset, part.length);
+            return true;
+        }
+        bytes.resize(part.length);
+        is.clear();
+        is.seekg(base + static_cast<std::streamoff>(part.offset));
+        return static_cast<bool>(is.read(bytes.data(), static_cast<std::streamsize>(part.length)));
+    };
+
+    // Read the parts holding cells of the areas, then the parts holding the cells their
+    // formulas read, until no new cells are needed.
+    CellStore staging; // The cells of the parts read so far.
+    std::vector<bool> partRead(parts.size());
+    auto partsLeft = static_cast<size_t>(std::count_if(parts.begin(), parts.end(), [](const Part &part) {
+        return !part.empty;
+    }));
+    std::unordered_set<size_t> kept;
+    std::vector<std::pair<size_t, CustomCValue>> loaded;
+    while (!areas.empty()) {
+        std::vector<size_t> toRead;
+        for (size_t part = 0; part < parts.size() && partsLeft > 0; ++part) {
+            const Part &p = parts[part];
+            if (partRead[part] || p.empty) continue;
+            bool needed = std::any_of(areas.begin(), areas.end(), [&p](const RangeIndex::Area &area) {
+                return p.overlaps(area);
+            });
+            if (needed) {
+                partRead[part] = true;
+                --partsLeft;
+                toRead.push_back(part);
+            }
+        }
+        if (!toRead.empty()) {
+            std::vector<std::string> bytes(toRead.size());
+            for (size_t i = 0; i < toRead.size(); ++i) {
+                if (!readPart(parts[toRead[i]], bytes[i])) return false;
+            }
+            bool valid = true;
+            ParallelIngest::run<std::optional<ParsedCells>>(
+                    toRead.size(), ingestThreads,
+                    [&toRead, &bytes, &parsePart](size_t i) { return parsePart(toRead[i], bytes[i]); },
+                    [&valid, &staging](std::optional<ParsedCells> &&cells) {
+                        if (!cells) {
+                            valid = false;
+                        } else if (valid) {
+                            staging.setMany(*cells);
+                        }
+                    });
+            if (!valid) return false;
         }
-        calculatedChecksum += '\n';
+
+        std::vector<RangeIndex::Area> next;
+        for (const auto &[start, end] : areas) {
+            if (start.getColumn() > end.getColumn() || start.getRow() > end.getRow()) continue;
+            staging.forEachInRect(start, end.getColumn() - start.getColumn() + 1, end.getRow() - start.getRow() + 1,
+                                  [&](size_t key, const CustomCValue &contents) {
+                                      if (kept.insert(key).second) {
+                                          loaded.emplace_back(key, contents);
+                                          std::vector<RangeIndex::Area> read = operandAreas(contents);
+                                          next.insert(next.end(), read.begin(), read.end());
+                                      }
+                                  });
+        }
+        areas = std::move(next);
     }
 
-    if (readChecksum != calculatedChecksum) {
-        return false;
+    sheet.setMany(loaded);
+    rangeIndex.reset();
+    return true;
+}
+
+std::vector<std::pair<size_t, CustomCValue>> CSpreadsheet::parseSavedLines(std::string_view lines, bool lazy) {
+    std::vector<std::pair<size_t, CustomCValue>> cells;
+    std::string line;
+    for (size_t begin = 0; begin < lines.size();) {
+        size_t end = std::min(ByteScan::find(lines, '\n', begin), lines.size());
+        line.assign(lines.substr(begin, end - begin));
+        auto &[key, cell] = cells.emplace_back();
+        parseSavedCell(line, lazy, key, cell);
+        begin = end + 1;
     }
+    return cells;
+}
 
-    std::istringstream dataStream(contentStream.str());
-    while (getline(dataStream, line)) {
-        std::stringstream ss(line);
-        size_t key;
-        char delim;
-        ss >> key >> delim;
-        ss.get();
-
-        if (ss.peek() == '[') {
-            // Process expression stack.
-            ss.get();
-            std::stack<std::shared_ptr<ExprElement>> exprStack;
-            std::string element;
-
-            while (getline(ss, element, ',')) {
-                element.erase(0, element.find_first_not_of(" "));
-                if (element.back() == ']') {
-                    element.pop_back();
-                }
+void CSpreadsheet::parseSavedCell(const std::string &line, bool lazy, size_t &key, CustomCValue &cell) {
+    std::stringstream ss(line);
+    char delim;
+    ss >> key >> delim;
+    ss.get();
 
-                std::stringstream elemStream(element);
-                std::string type;
-                elemStream >> type >> std::ws;
-
-                if (type == "Reference") {
-                    std::string value;
-                    elemStream >> value;
-                    exprStack.push(std::make_shared<Reference>(value));
-                } else if (type == "Constant") {
-                    double value;
-                    elemStream >> value;
-                    exprStack.push(std::make_shared<Constant>(value));
-                } else if (type == "UnaryOperation") {
-                    std::string op;
-                    elemStream >> op;
-                    exprStack.push(std::make_shared<UnaryOperation>(op));
-                } else if (type == "BinaryOperation") {
-                    std::string op;
-                    elemStream >> op;
-                    exprStack.push(std::make_shared<BinaryOperation>(op));
-                } else if (type == "String") {
-                    std::string content;
-                    std::getline(elemStream, content, '"');
-                    std::getline(elemStream, content, '"');
-                    size_t pos = 0;
-                    while ((pos = content.find("\"\"", pos)) != std::string::npos) {
-                        content.replace(pos, 2, "\"");
-                        pos += 1;
-                    }
-                    exprStack.push(std::make_shared<StringVariable>(content));
-                } else if (type == "Range") {
-                    std::string range;
-                    elemStream >> range;
-                    exprStack.push(std::make_shared<Range>(range));
-                } else if (type == "Function") {
-                    std::string functionName;
-                    double paramCount;
-                    elemStream >> functionName >> paramCount;
-                    exprStack.push(std::make_shared<FunctionCall>(functionName, paramCount));
-                }
+    if (ss.peek() == '[') {
+        parseSavedFormula(line.substr(static_cast<size_t>(ss.tellg())), lazy, cell);
+    } else {
+        // Process single values.
+        if (ss.peek() == '"') {
+            std::string strValue;
+            getline(ss, strValue, '"');
+            getline(ss, strValue, '"');
+            size_t pos = 0;
+            while ((pos = strValue.find("\"\"", pos)) != std::string::npos) {
+                strValue.replace(pos, 2, "\"");
+                pos += 1;
             }
-            sheet[key] = exprStack;
+            cell = strValue;
+        } else if (ss.peek() != 'u') {
+            double numValue;
+            ss >> numValue;
+            cell = numValue;
         } else {
-            // Process single values.
-            if (ss.peek() == '"') {
-                std::string strValue;
-                getline(ss, strValue, '"');
-                getline(ss, strValue, '"');
-                size_t pos = 0;
-                while ((pos = strValue.find("\"\"", pos)) != std::string::npos) {
-                    strValue.replace(pos, 2, "\"");
-                    pos += 1;
-                }
-                sheet[key] = strValue;
-            } else if (ss.peek() != 'u') {
-                double numValue;
-                ss >> numValue;
-                sheet[key] = numValue;
-            } else {
-                sheet[key] = std::monostate();
-            }
+            cell = std::monostate();
         }
     }
-    return true;
+}
+
+void CSpreadsheet::parseSavedFormula(std::string saved, bool lazy, CustomCValue &cell) {
+    // Compile the expression stack, or keep its saved form until it is used.
+    std::string source = saved.substr(1);
+    if (lazy) {
+        if (!source.empty() && source.back() == ']') {
+            source.pop_back();
+        }
+        cell = ExprStack({std::make_shared<LazyFormula>(std::move(source))});
+    } else {
+        cell = LazyFormula::compile(source);
+    }
 }
 
 bool CSpreadsheet::save(std::ostream &os) const {
+    StatsScope statsScope(statistics, &EvaluationStats::save);
     std::ostringstream contentStream;
-    unsigned long checksum = 0;
 
-    for (const auto &[key, val] : sheet) {
+    std::vector<std::pair<size_t, const CustomCValue *>> cells;
+    cells.reserve(sheet.size());
+    sheet.forEach([&cells](size_t key, const CustomCValue &value) {
+        cells.emplace_back(key, &value);
+    });
+    // The columnar format needs the cells grouped by column.
+    CellOrder order = saveFormat == SaveFormat::Columnar ? CellOrder::RowMajor : saveOrder;
+    if (order != CellOrder::Storage) {
+        std::sort(cells.begin(), cells.end(), [order](const auto &a, const auto &b) {
+            return CPos::fromUniqueId(a.first).getOrderKey(order) < CPos::fromUniqueId(b.first).getOrderKey(order);
+        });
+    }
+    if (saveFormat == SaveFormat::Columnar) {
+        ColumnarFormat::write(os, cells);
+        return true;
+    }
+
+    for (const auto &[key, cell] : cells) {
+        const auto &val = *cell;
         contentStream << key << ", ";
-        if (std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(val)) {
-            std::stack<std::shared_ptr<ExprElement>> tempStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(val);
-            std::vector<std::shared_ptr<ExprElement>> elements;
-            while (!tempStack.empty()) {
-                elements.push_back(tempStack.top());
-                tempStack.pop();
-            }
-            std::reverse(elements.begin(), elements.end());
-            contentStream << "[";
-            for (size_t i = 0; i < elements.size(); ++i) {
-                if (i > 0) contentStream << ", ";
-                contentStream << elements[i]->save();
-            }
-            contentStream << "]";
+        if (std::holds_alternative<ExprStack>(val)) {
+            contentStream << savedFormula(std::get<ExprStack>(val));
         } else if (std::holds_alternative<double>(val)) {
             contentStream << std::to_string(std::get<double>(val));
-        } else if (std::holds_alternative<std::string>(val)) {
+        } else if (std::holds_alternative<InlineString>(val)) {
             std::string escapedString;
-            for (char ch : std::get<std::string>(val)) {
+            for (char ch : std::get<InlineString>(val).view()) {
                 if (ch == '"') {
                     escapedString += "\"\"";
                 } else {
@@ -191,126 +495,522 @@ bool CSpreadsheet::save(std::ostream &os) const {
     }
 
     std::string data = contentStream.str();
-    for (char c : data) {
-        checksum += static_cast<unsigned char>(c);
+    if (saveFormat == SaveFormat::Blocks) {
+        BlockFormat::write(os, data, saveBlockBytes);
+        return true;
     }
+    unsigned long checksum = ByteScan::sum(data);
 
     os << "CHECKSUM " << checksum << std::endl;
     os << data;
     return true;
 }
 
+void CSpreadsheet::setSaveOrder(CellOrder order) {
+    saveOrder = order;
+}
+
 bool CSpreadsheet::setCell(const CPos &pos, const std::string &contents) {
+    StatsScope statsScope(statistics, &EvaluationStats::setCell);
+    auto paused = scheduler.pause();
     if (!contents.empty() && contents[0] == '=') {
-        CustomExpressionBuilder exprBuilder;
-        parseExpression(contents, exprBuilder);
-        CustomCValue expression = exprBuilder.getExpression();
-        sheet[pos.getUniqueId()] = expression;
+        ExprStack parsed;
+        {
+            StatsScope parseScope(statistics, &EvaluationStats::parse);
+            parsed = ExpressionParser::compile(contents);
+        }
+        CustomCValue formula = ExprOptimizer::optimize(parsed);
+        if (rangeIndex.isActive()) {
+            rangeIndex.assign(pos.getUniqueId(), rangeOperands(formula));
+        }
+        sheet.set(pos.getUniqueId(), std::move(formula));
     } else {
-        CustomCValue value = DetermineValue(contents);
-        sheet[pos.getUniqueId()] = value;
+        rangeIndex.assign(pos.getUniqueId(), {});
+        sheet.set(pos.getUniqueId(), DetermineValue(contents));
     }
     return true;
 }
 
+bool CSpreadsheet::setCells(const std::vector<std::pair<CPos, std::string>> &cells) {
+    StatsScope statsScope(statistics, &EvaluationStats::setCells);
+    auto paused = scheduler.pause();
+
+    // A chunk holds the cells parsed before its first parse error, if any.
+    struct ParsedChunk {
+        std::vector<std::pair<size_t, CustomCValue>> cells;
+        std::exception_ptr error;
+    };
+    constexpr size_t CHUNK_CELLS = 1024;
+    RangeIndexReset resetIndex(rangeIndex);
+    ParallelIngest::run<ParsedChunk>(
+            (cells.size() + CHUNK_CELLS - 1) / CHUNK_CELLS, ingestThreads,
+            [&cells](size_t chunk) {
+                ParsedChunk parsed;
+                size_t end = std::min(cells.size(), (chunk + 1) * CHUNK_CELLS);
+                parsed.cells.reserve(end - chunk * CHUNK_CELLS);
+                try {
+                    for (size_t i = chunk * CHUNK_CELLS; i < end; ++i) {
+                        const auto &[pos, contents] = cells[i];
+                        parsed.cells.emplace_back(pos.getUniqueId(), !contents.empty() && contents[0] == '='
+                                                                      ? CustomCValue(ExprOptimizer::optimize(ExpressionParser::compile(contents)))
+                                                                      : DetermineValue(contents));
+                    }
+                } catch (...) {
+                    parsed.error = std::current_exception();
+                }
+                return parsed;
+            },
+            [this](ParsedChunk &&parsed) {
+                for (auto &[key, cell] : parsed.cells) {
+                    sheet.set(key, std::move(cell));
+                }
+                if (parsed.error) {
+                    std::rethrow_exception(parsed.error);
+                }
+            });
+    return true;
+}
+
+bool CSpreadsheet::importCSV(std::istream &is, const CPos &topLeft, char delimiter) {
+    StatsScope statsScope(statistics, &EvaluationStats::importCSV);
+    auto paused = scheduler.pause();
+    CsvFormat::FormulaParser formulaParser = [](std::string contents) {
+        return CustomCValue(ExprOptimizer::optimize(ExpressionParser::compile(contents)));
+    };
+    std::vector<CsvFormat::ColumnType> types;
+    // Chunks of whole records, parsed together once enough are read to keep the threads busy.
+    std::vector<std::string> batch;
+    const size_t batchChunks = 4 * static_cast<size_t>(ParallelIngest::threadCount(ingestThreads));
+    std::vector<std::pair<size_t, CustomCValue>> cells;
+    size_t row = topLeft.getRow();
+    bool malformed = false;
+    auto parseBatch = [&] {
+        ParallelIngest::run<CsvFormat::Parsed>(
+                batch.size(), ingestThreads,
+                [&](size_t chunk) { return CsvFormat::parse(batch[chunk], delimiter, types, formulaParser); },
+                [&](CsvFormat::Parsed &&parsed) {
+                    malformed = malformed || parsed.malformed;
+                    if (malformed) return;
+                    cells.clear();
+                    cells.reserve(parsed.fields.size());
+                    for (auto &field: parsed.fields) {
+                        cells.emplace_back(CPos(topLeft.getColumn() + field.column, row + field.row).getUniqueId(),
+                                           std::move(field.value));
+                    }
+                    sheet.setMany(cells);
+                    row += parsed.records;
+                });
+        batch.clear();
+    };
+
+    RangeIndexReset resetIndex(rangeIndex);
+    std::string pending;
+    bool end = false;
+    while (!end && !malformed) {
+        size_t size = pending.size();
+        pending.resize(size + CsvFormat::CHUNK_BYTES);
+        is.read(pending.data() + size, static_cast<std::streamsize>(CsvFormat::CHUNK_BYTES));
+        pending.resize(size + static_cast<size_t>(is.gcount()));
+        end = !is;
+        // A record cut by the end of the chunk waits for the next one.
+        size_t complete = end ? pending.size() : CsvFormat::completeRecords(pending, delimiter);
+        if (complete && complete == pending.size()) {
+            batch.push_back(std::move(pending));
+            pending.clear();
+        } else if (complete) {
+            batch.emplace_back(pending, 0, complete);
+            pending.erase(0, complete);
+        }
+        if (types.empty() && !batch.empty()) {
+            types = CsvFormat::inferTypes(batch.front(), delimiter);
+        }
+        // A record that does not end, as after an unclosed quote, would hold the rest of the input.
+        bool overlong = pending.size() > CsvFormat::MAX_RECORD_BYTES;
+        if (batch.size() >= batchChunks || end || overlong) {
+            parseBatch();
+        }
+        if (overlong) {
+            return false;
+        }
+    }
+    return !malformed;
+}
+
+void CSpreadsheet::setSaveFormat(SaveFormat format, size_t blockBytes) {
+    saveFormat = format;
+    saveBlockBytes = blockBytes;
+}
+
+void CSpreadsheet::setIngestThreads(unsigned threads) {
+    ingestThreads = threads;
+}
+
+void CSpreadsheet::setLazyLoading(bool lazy) {
+    lazyLoading = lazy;
+}
+
 CValue CSpreadsheet::getValue(const CPos &pos) const {
-    auto it = sheet.find(pos.getUniqueId());
+    // Each call evaluates in its own context, so concurrent reads do not interfere.
+    EvaluationContext context;
+    return evaluateCell(pos, context);
+}
+
+CellError CSpreadsheet::getError(const CPos &pos) const {
+    EvaluationContext context;
+    CValue value = evaluateCell(pos, context);
+    // The formulas on a cycle evaluate to undefined values without failing themselves.
+    if (context.failure == CellError::None && context.cycleDetected && std::holds_alternative<std::monostate>(value)) {
+        return CellError::Cycle;
+    }
+    return context.failure;
+}
+
+CValue CSpreadsheet::evaluateCell(const CPos &pos, EvaluationContext &context) const {
+    context.failure = CellError::None;
+    StatsScope statsScope(statistics, &EvaluationStats::getValue);
+    EvaluationProfiler::Activation profiling(evaluationProfiler);
+    auto cell = sheet.find(pos.getUniqueId());
     size_t uniqueId = pos.getUniqueId();
 
-    if (it != sheet.end()) {
-        if (!std::holds_alternative<std::monostate>(it->second)) {
-            if (std::holds_alternative<double>(it->second)) {
-                return std::get<double>(it->second);
-            } else if (std::holds_alternative<std::string>(it->second)) {
-                return std::get<std::string>(it->second);
-            } else if (std::holds_alternative<int>(it->second)) {
-                return static_cast<double>(std::get<int>(it->second));
-            } else if (std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(it->second)) {
-                if (!evaluationPath.insert(uniqueId).second) {
-                    evaluationPath.clear();
-                    throw std::runtime_error("Cyclic dependency detected!");
-                }
+    if (cell) {
+        if (!std::holds_alternative<std::monostate>(*cell)) {
+            if (std::holds_alternative<double>(*cell)) {
+                return std::get<double>(*cell);
+            } else if (std::holds_alternative<InlineString>(*cell)) {
+                return std::get<InlineString>(*cell).str();
+            } else if (std::holds_alternative<int>(*cell)) {
+                return static_cast<double>(std::get<int>(*cell));
+            } else if (std::holds_alternative<ExprStack>(*cell)) {
+                context.evaluationPath.clear();
+                context.evaluationPath.insert(uniqueId);
                 try {
-                    const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(it->second);
-                    CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
-                    evaluationPath.clear();
-                    return result;
+                    EvaluationProfiler::Frame profileFrame(uniqueId);
+                    const auto &exprStack = std::get<ExprStack>(*cell);
+                    return evaluateExpression(exprStack, sheet, context);
                 } catch (const std::exception &e) {
-                    evaluationPath.clear();
                     return CValue();
                 }
             }
         }
     }
-    evaluationPath.clear();
     return CValue();
 }
 
-void CSpreadsheet::copyRect(CPos dst, CPos src, int w, int h) {
-    std::vector<std::pair<size_t, CustomCValue>> tempStorage;
-    tempStorage.reserve(w * h);
+std::future<CValue> CSpreadsheet::getValueAsync(const CPos &pos) const {
+    auto promise = std::make_shared<std::promise<CValue>>();
+    std::future<CValue> value = promise->get_future();
+    scheduler.submit([this, pos, promise](std::stop_token interrupted) {
+        EvaluationContext context;
+        context.stopToken = interrupted;
+        CValue result = evaluateCell(pos, context);
+        if (interrupted.stop_requested()) {
+            return false;
+        }
+        promise->set_value(std::move(result));
+        return true;
+    });
+    return value;
+}
 
-    auto offset = dst - src;
+RecalculationHandle CSpreadsheet::recalculateAsync() const {
+    auto promise = std::make_shared<std::promise<RecalculationHandle::Result>>();
+    std::stop_source cancel;
+    RecalculationHandle handle(promise->get_future(), cancel);
+    scheduler.submit([this, promise, cancelled = cancel.get_token()](std::stop_token interrupted) {
+        // Stop evaluating on either an edit of the sheet or a cancellation by the caller.
+        std::stop_source stop;
+        std::stop_callback onInterrupt(interrupted, [&stop] { stop.request_stop(); });
+        std::stop_callback onCancel(cancelled, [&stop] { stop.request_stop(); });
+
+        std::vector<CPos> formulas = formulaCells();
+        RecalculationHandle::Result values;
+        values.reserve(formulas.size());
+        EvaluationContext context;
+        context.stopToken = stop.get_token();
+        for (const auto &pos: formulas) {
+            if (stop.stop_requested()) break;
+            values.emplace_back(pos, evaluateCell(pos, context));
+        }
+        if (cancelled.stop_requested()) {
+            promise->set_exception(std::make_exception_ptr(RecalculationCancelled()));
+            return true;
+        }
+        if (interrupted.stop_requested()) {
+            return false;
+        }
+        promise->set_value(std::move(values));
+        return true;
+    });
+    return handle;
+}
 
-    for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-            CPos from = src.shift(x, y);
-            CPos to = dst.shift(x, y);
-            size_t fromId = from.getUniqueId();
-            size_t toId = to.getUniqueId();
-
-            auto it = sheet.find(fromId);
-            if (it != sheet.end()) {
-                auto &content = it->second;
-                if (std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(content)) {
-                    std::stack<std::shared_ptr<ExprElement>> exprCopy;
-                    std::stack<std::shared_ptr<ExprElement>> originalExprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(content);
-
-                    std::stack<std::shared_ptr<ExprElement>> reversedCopy;
-                    while (!originalExprStack.empty()) {
-                        reversedCopy.push(originalExprStack.top());
-                        originalExprStack.pop();
+RecalcTask CSpreadsheet::recalculate(size_t quantum) const {
+    for (;;) {
+        uint64_t version = sheet.version();
+        std::vector<CPos> formulas = formulaCells();
+        RecalcTask::Result values;
+        values.reserve(formulas.size());
+
+        // Formula values are memoized across the steps, so every cell is evaluated once.
+        // A reference reached after the quantum suspends the evaluation; the cell it
+        // stopped at is then evaluated on its own first, so a deep chain is climbed one
+        // quantum per step and the formula that needed it resumes from the memo.
+        std::unordered_map<size_t, CValue> memo;
+        EvaluationContext context;
+        context.memo = &memo;
+        bool modified = false;
+        for (const auto &pos: formulas) {
+            std::vector<size_t> goals{pos.getUniqueId()};
+            bool bounded = true;
+            CValue value;
+            while (!goals.empty() && !modified) {
+                if (context.work >= quantum) {
+                    context.work = 0;
+                    co_await std::suspend_always{};
+                    modified = sheet.version() != version;
+                    continue;
+                }
+                context.cycleDetected = false;
+                context.memoCandidates.clear();
+                context.workLimit = bounded ? quantum : SIZE_MAX;
+                try {
+                    CValue result = evaluateCell(CPos::fromUniqueId(goals.back()), context);
+                    ++context.work;
+                    // Values computed on a cyclic chain depend on where the chain was entered.
+                    if (!context.cycleDetected) {
+                        memo.insert(context.memoCandidates.begin(), context.memoCandidates.end());
+                        memo.emplace(goals.back(), result);
+                    } else {
+                        bounded = false;
                     }
-
-                    while (!reversedCopy.empty()) {
-                        auto &elem = reversedCopy.top();
-                        if (auto ref = dynamic_cast<Reference *>(elem.get())) {
-                            auto copiedRef = std::make_shared<Reference>(*ref);
-                            copiedRef->moveRelativeReferencesBy(offset);
-                            exprCopy.push(copiedRef);
-                        } else {
-                            exprCopy.push(elem);
-                        }
-                        reversedCopy.pop();
+                    goals.pop_back();
+                    value = std::move(result);
+                } catch (const EvaluationSuspended &) {
+                    // The references completed before the suspension keep their values.
+                    if (!context.cycleDetected) {
+                        memo.insert(context.memoCandidates.begin(), context.memoCandidates.end());
                     }
+                    // A chain that leads back to a suspended cell is a cycle longer than the
+                    // quantum, which is evaluated without suspending, as a whole.
+                    if (context.cycleDetected
+                        || std::find(goals.begin(), goals.end(), context.suspendedAt) != goals.end()) {
+                        bounded = false;
+                    } else {
+                        goals.push_back(context.suspendedAt);
+                    }
+                }
+            }
+            if (modified) {
+                break;
+            }
+            values.emplace_back(pos, std::move(value));
+        }
+        if (!modified) {
+            co_return values;
+        }
+        // The sheet was modified while suspended: start over on the new contents.
+    }
+}
 
-                    tempStorage.emplace_back(toId, std::move(exprCopy));
-                } else {
-                    tempStorage.emplace_back(toId, content);
+MemoryUsage CSpreadsheet::memoryUsage() const {
+    // Elements are allocated by make_shared, with a control block of two counters and a vtable pointer.
+    constexpr size_t CONTROL_BLOCK_BYTES = 2 * sizeof(void *);
+    MemoryUsage usage;
+    usage.cellSlots = sheet.slotMemoryUsage();
+    std::unordered_set<const ExprElement *> counted;
+    sheet.forEach([&usage, &counted](size_t, const CustomCValue &contents) {
+        if (std::holds_alternative<InlineString>(contents)) {
+            usage.strings += std::get<InlineString>(contents).heapBytes();
+        } else if (std::holds_alternative<ExprStack>(contents)) {
+            const auto &formula = std::get<ExprStack>(contents);
+            usage.expressionNodes += exprContainerMemoryUsage(formula);
+            for (const auto &element : exprElements(formula)) {
+                if (counted.insert(element.get()).second) {
+                    usage.expressionNodes += CONTROL_BLOCK_BYTES + element->memoryUsage();
                 }
-            } else {
-                tempStorage.emplace_back(toId, CustomCValue());
             }
         }
+    });
+    for (const auto &[key, plan] : columnPlans) {
+        // A tree node holds three pointers and a color besides the entry.
+        usage.caches += 4 * sizeof(void *) + sizeof(std::pair<const std::pair<size_t, size_t>, ColumnEvaluator::Plan>)
+                        + plan.capacity() * sizeof(ColumnEvaluator::Run);
+        for (const auto &run : plan) {
+            usage.caches += run.program.capacity() * sizeof(ColumnEvaluator::Instruction);
+        }
     }
+    usage.indexes = rangeIndex.memoryUsage();
+    return usage;
+}
 
-    for (auto &[id, val] : tempStorage) {
-        sheet[id] = std::move(val);
+void CSpreadsheet::compact() {
+    auto paused = scheduler.pause();
+    // Elements that behave identically are shared by all formulas, keyed by type and identity.
+    std::unordered_map<std::string, std::shared_ptr<ExprElement>> shared;
+    sheet.compact([&shared](size_t, CustomCValue &contents) {
+        if (!std::holds_alternative<ExprStack>(contents)) {
+            return;
+        }
+        auto &formula = std::get<ExprStack>(contents);
+        ExprStack::container_type elements = exprElements(formula);
+        for (auto &element : elements) {
+            const ExprElement &object = *element;
+            std::string key = typeid(object).name();
+            key += '\n';
+            key += object.identity();
+            auto [it, inserted] = shared.try_emplace(std::move(key), element);
+            element = it->second;
+        }
+        // A fresh container, sized for the formula, replaces the old one.
+        formula = ExprStack(std::move(elements));
+    });
+    columnPlans.clear();
+    rangeIndex.reset();
+#ifdef __GLIBC__
+    // Hand the freed pages back to the operating system.
+    malloc_trim(0);
+#endif
+}
+
+std::vector<CPos> CSpreadsheet::rangeDependents(const CPos &pos) const {
+    rangeIndex.build([this](RangeIndex &index) {
+        sheet.forEach([&index](size_t key, const CustomCValue &contents) {
+            index.assign(key, rangeOperands(contents));
+        });
+    });
+    std::vector<CPos> dependents;
+    for (size_t key : rangeIndex.covering(pos)) {
+        dependents.push_back(CPos::fromUniqueId(key));
     }
+    std::sort(dependents.begin(), dependents.end(), [](const CPos &a, const CPos &b) {
+        return a.getOrderKey(CellOrder::RowMajor) < b.getOrderKey(CellOrder::RowMajor);
+    });
+    return dependents;
+}
+
+std::vector<CPos> CSpreadsheet::formulaCells() const {
+    std::vector<CPos> formulas;
+    sheet.forEach([&formulas](size_t key, const CustomCValue &value) {
+        if (std::holds_alternative<ExprStack>(value)) {
+            formulas.push_back(CPos::fromUniqueId(key));
+        }
+    });
+    std::sort(formulas.begin(), formulas.end(), [](const CPos &a, const CPos &b) {
+        return a.getOrderKey(CellOrder::RowMajor) < b.getOrderKey(CellOrder::RowMajor);
+    });
+    return formulas;
+}
+
+std::vector<CValue> CSpreadsheet::getColumnValues(const CPos &top, size_t count) const {
+    StatsScope statsScope(statistics, &EvaluationStats::getColumnValues);
+    EvaluationProfiler::Activation profiling(evaluationProfiler);
+    // Plans only depend on the formulas, so they stay valid until a formula changes.
+    if (columnPlansVersion != sheet.formulaVersion()) {
+        columnPlans.clear();
+        columnPlansVersion = sheet.formulaVersion();
+    }
+    auto key = std::make_pair(top.getUniqueId(), count);
+    auto it = columnPlans.find(key);
+    if (it == columnPlans.end()) {
+        EXCEL_STATS(++excelStats->columnPlanMisses);
+        it = columnPlans.emplace(key, ColumnEvaluator::plan(sheet, top, count)).first;
+    } else {
+        EXCEL_STATS(++excelStats->columnPlanHits);
+    }
+    return ColumnEvaluator::evaluate(it->second, sheet, top, [this](const CPos &pos) { return getValue(pos); });
+}
+
+bool CSpreadsheet::exportCSV(std::ostream &os, const CPos &topLeft, size_t w, size_t h, char delimiter) const {
+    StatsScope statsScope(statistics, &EvaluationStats::exportCSV);
+    constexpr size_t BAND_ROWS = 4096;
+    std::vector<std::vector<CValue>> columns(w);
+    std::string out;
+    for (size_t band = 0; band < h; band += BAND_ROWS) {
+        size_t rows = std::min(BAND_ROWS, h - band);
+        // Planned without the cache of getColumnValues, which would keep a plan per band.
+        for (size_t x = 0; x < w; ++x) {
+            CPos top(topLeft.getColumn() + x, topLeft.getRow() + band);
+            columns[x] = ColumnEvaluator::evaluate(ColumnEvaluator::plan(sheet, top, rows), sheet, top,
+                                                   [this](const CPos &pos) { return getValue(pos); });
+        }
+        out.clear();
+        for (size_t y = 0; y < rows; ++y) {
+            for (size_t x = 0; x < w; ++x) {
+                if (x) out += delimiter;
+                CsvFormat::writeValue(out, columns[x][y], delimiter);
+            }
+            out += '\n';
+        }
+        os.write(out.data(), static_cast<std::streamsize>(out.size()));
+    }
+    return static_cast<bool>(os);
+}
+
+const EvaluationStats &CSpreadsheet::stats() const {
+    return statistics.total();
+}
+
+void CSpreadsheet::resetStats() {
+    statistics.reset();
+}
+
+EvaluationProfiler &CSpreadsheet::profiler() const {
+    return evaluationProfiler;
+}
+
+void CSpreadsheet::copyRect(CPos dst, CPos src, int w, int h) {
+    StatsScope statsScope(statistics, &EvaluationStats::copyRect);
+    auto paused = scheduler.pause();
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    auto offset = dst - src;
+    auto shifted = [](size_t key, size_t dx, size_t dy) {
+        CPos pos = CPos::fromUniqueId(key);
+        return CPos(pos.getColumn() + dx, pos.getRow() + dy).getUniqueId();
+    };
+
+    // Only stored cells are visited, so empty parts of the region cost nothing, and lazily
+    // loaded formulas are copied without being compiled.
+    std::vector<std::pair<size_t, CustomCValue>> copies;
+    sheet.forEachInRect(src, w, h, [&](size_t key, const CustomCValue &content) {
+        size_t toId = shifted(key, offset.getColumn(), offset.getRow());
+        if (std::holds_alternative<ExprStack>(content)) {
+            copies.emplace_back(toId, LazyFormula::relocated(std::get<ExprStack>(content), offset));
+        } else {
+            copies.emplace_back(toId, content);
+        }
+    });
+
+    // Destination cells whose source cell is empty become empty; a full source leaves none.
+    std::vector<size_t> cleared;
+    if (copies.size() < static_cast<size_t>(w) * h) {
+        sheet.forEachInRect(dst, w, h, [&](size_t key, const CustomCValue &) {
+            if (!sheet.find(shifted(key, -offset.getColumn(), -offset.getRow()))) {
+                cleared.push_back(key);
+            }
+        });
+    }
+
+    for (size_t key : cleared) {
+        rangeIndex.assign(key, {});
+        sheet.erase(key);
+    }
+    if (rangeIndex.isActive()) {
+        for (const auto &[key, contents] : copies) {
+            rangeIndex.assign(key, rangeOperands(contents));
+        }
+    }
+    sheet.setMany(copies);
 }
 
 CustomCValue CSpreadsheet::DetermineValue(const std::string &contents) {
     if (contents.empty()) {
         return std::monostate();
     }
-    try {
-        size_t idx;
-        double numVal = std::stod(contents, &idx);
-        if (idx == contents.size()) {
-            return numVal;
-        }
-    } catch (const std::invalid_argument &) {
-    } catch (const std::out_of_range &) {
+    double number;
+    if (readNumber(contents, number)) {
+        return number;
     }
     return contents;
 }
\ No newline at end of file
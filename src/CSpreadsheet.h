@@ -4,9 +4,14 @@
 #include "main.h"
 #include "CPos.h"
 #include "ExprElement.h"
-
-// Custom type definition for spreadsheet cell values
-using CustomCValue = std::variant<std::monostate, double, std::string, int, std::stack<std::shared_ptr<ExprElement>>>;
+#include "CellStore.h"
+#include "ColumnEvaluator.h"
+#include "EvaluationStats.h"
+#include "RecalcScheduler.h"
+#include "RecalcTask.h"
+#include "RangeIndex.h"
+#include "MemoryUsage.h"
+#include "BlockFormat.h"
 
 /**
  * @class CSpreadsheet
@@ -39,12 +44,44 @@ public:
      *
      * This function reads data from the provided input stream, initializes the
      * spreadsheet with the data, and verifies the integrity using a checksum.
+     * All formats written by save (see setSaveFormat) are accepted; in the block and
+     * columnar formats, the sections are verified in parallel before any cell is loaded.
      *
      * @param is An input stream containing the spreadsheet data.
      * @return bool True if the data is successfully loaded and verified, false otherwise.
      */
     bool load(std::istream &is);
 
+    /**
+     * @brief Loads the cells of a rectangle from a saved sheet, with the cells their formulas read.
+     *
+     * Loads the cells of the rectangle and, transitively, every cell a loaded formula
+     * references or reads through a range, so the loaded cells evaluate as they would in
+     * the whole sheet. Other cells are not loaded. In the block and columnar formats (see
+     * setSaveFormat) only the blocks or sections whose bounds hold such cells are read,
+     * by seeking if the stream allows it, and only those are verified, so the cost depends
+     * on the cells loaded rather than on the size of the file. A file in the CHECKSUM
+     * format is read and verified whole.
+     *
+     * @param is An input stream containing the spreadsheet data.
+     * @param topLeft The top left corner of the rectangle.
+     * @param w The number of columns.
+     * @param h The number of rows.
+     * @return bool True if the cells are loaded and the data read is verified, false otherwise.
+     */
+    bool loadRegion(std::istream &is, const CPos &topLeft, size_t w, size_t h);
+
+    /**
+     * @brief Loads whole columns from a saved sheet, with the cells their formulas read.
+     *
+     * The column projection of loadRegion, which it otherwise behaves like.
+     *
+     * @param is An input stream containing the spreadsheet data.
+     * @param columns The columns to load (1 for column A).
+     * @return bool True if the cells are loaded and the data read is verified, false otherwise.
+     */
+    bool loadColumns(std::istream &is, const std::vector<size_t> &columns);
+
     /**
      * @brief Saves the current spreadsheet data to an output stream.
      *
@@ -56,6 +93,36 @@ public:
      */
     bool save(std::ostream &os) const;
 
+    /**
+     * @brief Selects the order in which save writes the cells.
+     *
+     * The default (CellOrder::Storage) writes cells in hash map order. Sorted orders
+     * make the output deterministic; CellOrder::Morton additionally keeps cells that
+     * are close in the sheet close in the file, so a later load inserts them in a
+     * cache-friendly order. The order does not affect what load accepts.
+     *
+     * @param order The order to write the cells in.
+     */
+    void setSaveOrder(CellOrder order);
+
+    /**
+     * @brief Selects the file format save writes.
+     *
+     * SaveFormat::Checksum (the default) protects the whole file with a byte sum, which
+     * load can only check after reading everything and which misses reordered bytes.
+     * SaveFormat::Blocks cuts the cells into blocks of about blockBytes, each with a
+     * CRC32C, and starts the file with an index of the blocks and the cells they bound
+     * (see BlockFormat). Combined with a sorted save order, the bounds of the blocks
+     * are tight, so a reader can locate the blocks holding given cells.
+     * SaveFormat::Columnar writes the cells column by column in a compressed binary
+     * encoding (see ColumnarFormat), ignoring the save order; numbers are stored
+     * exactly rather than with six decimals.
+     *
+     * @param format The format to write.
+     * @param blockBytes The block size of SaveFormat::Blocks; ignored by the other formats.
+     */
+    void setSaveFormat(SaveFormat format, size_t blockBytes = BlockFormat::DEFAULT_BLOCK_BYTES);
+
     /**
      * @brief Sets the contents of a specific cell.
      *
@@ -63,23 +130,246 @@ public:
      * can be a direct value or an expression. If the contents start with '=', they
      * are treated as an expression and parsed accordingly.
      *
+     * Several threads may set cells at the same time, as long as no other operation runs
+     * on the sheet meanwhile. Cells are stored in shards by column band (see CellStore),
+     * so threads writing to different column ranges do not contend for a lock.
+     *
      * @param pos The position of the cell to set.
      * @param contents A string representing the cell's contents.
      * @return bool True if the cell contents are successfully set, false otherwise.
      */
     bool setCell(const CPos &pos, const std::string &contents);
 
+    /**
+     * @brief Sets the contents of many cells at once.
+     *
+     * Equivalent to calling setCell for every entry in order, but the contents are parsed
+     * on a pool of worker threads (see setIngestThreads) while the calling thread inserts
+     * the results. If a formula cannot be parsed, the cells before it are set and the
+     * parse error is rethrown. Like setCell, it may run concurrently with other writers.
+     *
+     * @param cells The positions and contents to set, in order.
+     * @return bool True if all cells are set.
+     */
+    bool setCells(const std::vector<std::pair<CPos, std::string>> &cells);
+
+    /**
+     * @brief Sets cells from comma separated values (see CsvFormat).
+     *
+     * Each record fills a row and each field a cell, starting at topLeft; empty fields
+     * leave their cells unchanged. The stream is read and parsed in chunks of
+     * CsvFormat::CHUNK_BYTES on the ingest threads (see setIngestThreads), and the cells
+     * of each chunk are inserted into the store at once, so an input of any size is
+     * imported in bounded memory. Numbers are read with std::from_chars, so a field with
+     * surrounding spaces is text. As with setCells, if a formula cannot be parsed, the
+     * cells of the chunks before it are set and the parse error is rethrown.
+     *
+     * @param is An input stream containing the records.
+     * @param topLeft The cell receiving the first field of the first record.
+     * @param delimiter The field delimiter.
+     * @return bool True if the input is well formed; false if a quoted field is not closed
+     *              or is followed by other characters, or if a record is longer than
+     *              CsvFormat::MAX_RECORD_BYTES, in which case the records before its chunk
+     *              are set and the rest of the input is not read.
+     */
+    bool importCSV(std::istream &is, const CPos &topLeft, char delimiter = ',');
+
+    /**
+     * @brief Sets the number of threads used by setCells and load to parse cells.
+     *
+     * @param threads The number of threads; 0 (the default) uses all hardware threads.
+     */
+    void setIngestThreads(unsigned threads);
+
+    /**
+     * @brief Selects whether load compiles formulas up front or on first use.
+     *
+     * In lazy mode, load keeps every formula in its saved form and compiles it only when
+     * it is first evaluated or planned for columnar evaluation, so opening a large
+     * sheet to read a few cells costs time proportional to the formulas touched. This
+     * includes the formulas filled down a column of a Columnar file and the copies made by
+     * copyRect, which are moved to their cells when compiled. Lazily loaded formulas are saved byte for byte as they were
+     * loaded, except those moved copies, which are compiled to be saved. A malformed formula is
+     * reported when it is compiled: its evaluation yields an undefined value.
+     *
+     * @param lazy True to compile loaded formulas on first use; false (the default) compiles them in load.
+     */
+    void setLazyLoading(bool lazy);
+
     /**
      * @brief Retrieves the evaluated value of a specific cell.
      *
      * This function returns the evaluated value of the cell at the given position.
      * If the cell contains an expression, it is evaluated, and the result is returned.
+     * The evaluation state lives in a per-call EvaluationContext, so any number of threads
+     * may call getValue concurrently as long as no thread modifies the sheet.
      *
      * @param pos The position of the cell to retrieve the value from.
      * @return CValue The evaluated value of the cell.
      */
     CValue getValue(const CPos &pos) const;
 
+    /**
+     * @brief Returns why the formula of a cell fails to evaluate.
+     *
+     * getValue returns an undefined value for a failing formula, as CValue has no error
+     * alternative; this evaluates the cell the same way and returns the error code
+     * instead, such as CellError::Div0 for "#DIV/0!". A formula that reads a failing cell
+     * sees an undefined value, so it reports its own error (e.g. CellError::Value) rather
+     * than the one it read. A cell left undefined by a cycle in its evaluation reports CellError::Cycle.
+     *
+     * @param pos The position of the cell.
+     * @return CellError The error, or CellError::None if the cell holds no formula or its formula evaluates.
+     */
+    CellError getError(const CPos &pos) const;
+
+    /**
+     * @brief Retrieves the evaluated values of a column of cells.
+     *
+     * Runs of cells holding the same relative formula (e.g. a formula filled down with
+     * copyRect) are evaluated together in columnar mode, one operation at a time over
+     * the whole run. The results are identical to calling getValue for each cell.
+     * The runs found for a column are cached until a formula in the sheet changes, so
+     * repeated recalculations of the same column only pay for the evaluation. Because
+     * of the cache, getColumnValues must not run concurrently with other calls on the sheet.
+     *
+     * @param top The position of the first cell of the column.
+     * @param count The number of cells to evaluate.
+     * @return std::vector<CValue> The evaluated values, from top to bottom.
+     */
+    std::vector<CValue> getColumnValues(const CPos &top, size_t count) const;
+
+    /**
+     * @brief Writes the values of a rectangle as comma separated values (see CsvFormat).
+     *
+     * Writes one record per row, with the evaluated value of each cell; undefined values
+     * are empty fields. The rectangle is evaluated and written in bands of rows, a column
+     * of each band at a time as in getColumnValues, so the memory used does not depend
+     * on the height of the rectangle.
+     *
+     * @param os The stream to write to.
+     * @param topLeft The top left corner of the rectangle.
+     * @param w The number of columns.
+     * @param h The number of rows.
+     * @param delimiter The field delimiter.
+     * @return bool True if the stream accepted the output.
+     */
+    bool exportCSV(std::ostream &os, const CPos &topLeft, size_t w, size_t h, char delimiter = ',') const;
+
+    /**
+     * @brief Evaluates a cell on the background thread of the sheet.
+     *
+     * Asynchronous evaluations run one at a time, in the order they were requested. If
+     * the sheet is modified (setCell, setCells, copyRect, load) while an evaluation is in
+     * flight, the evaluation is abandoned before the change is applied and restarted after
+     * it, so the value always reflects the sheet as of the latest change. Modifications
+     * therefore never wait for more than the formula being evaluated at that moment.
+     *
+     * @param pos The position of the cell to evaluate.
+     * @return std::future<CValue> The value of the cell, as getValue would return it.
+     */
+    std::future<CValue> getValueAsync(const CPos &pos) const;
+
+    /**
+     * @brief Evaluates every formula cell on the background thread of the sheet.
+     *
+     * Like getValueAsync, the recalculation is restarted if the sheet is modified while it
+     * runs. It can also be cancelled through the returned handle.
+     *
+     * @return RecalculationHandle The handle delivering the values of all formula cells.
+     */
+    RecalculationHandle recalculateAsync() const;
+
+    /**
+     * @brief Evaluates every formula cell in steps, on the thread that resumes the task.
+     *
+     * The returned coroutine does nothing until resumed. Each resume evaluates formulas
+     * until about quantum cells were visited (through references and ranges), then
+     * suspends. A reference to a formula reached past the quantum suspends even in the
+     * middle of a chain: the next step evaluates the referenced cell on its own, and the
+     * formulas waiting for it resume from the memoized values. A step goes past its
+     * quantum only by one range scan, or by a whole cycle longer than the quantum.
+     * The sheet may be modified while the task is suspended, not while it runs; a
+     * modification makes the next resume start the recalculation over.
+     *
+     * @param quantum The work to do before suspending.
+     * @return RecalcTask The suspended recalculation, with the same result as recalculateAsync.
+     */
+    RecalcTask recalculate(size_t quantum = 1024) const;
+
+    /**
+     * @brief Returns the formula cells that read the given cell through a range operand.
+     *
+     * For example, after setCell(A500) the cells returned for A500 are the range formulas
+     * (sum, count, min, max, countval) whose value may have changed. The answer comes from
+     * a spatial index of the ranges (see RangeIndex), so a range costs one entry however
+     * many cells it spans and a query takes logarithmic time in the number of ranges.
+     * References to single cells are not included.
+     *
+     * The index is built by the first call and kept up to date by setCell and copyRect;
+     * setCells and load drop it, to be rebuilt by the next call. Until then those updates
+     * skip reading the range operands of the formulas. Several threads may call this at
+     * once (the first one builds the index), but not concurrently with changes to the sheet.
+     *
+     * @param pos The cell whose dependents are looked up.
+     * @return std::vector<CPos> The dependent formula cells, in row-major order.
+     */
+    std::vector<CPos> rangeDependents(const CPos &pos) const;
+
+    /**
+     * @brief Estimates the memory used by the sheet, by category.
+     *
+     * Formula elements shared by several cells are counted once. Do not call this
+     * concurrently with any other operation on the sheet.
+     *
+     * @return MemoryUsage The estimated bytes of cell storage, strings, formulas, caches and indexes.
+     */
+    MemoryUsage memoryUsage() const;
+
+    /**
+     * @brief Releases memory the sheet no longer needs.
+     *
+     * Drops empty cells (such as those cleared by setCell(pos, "")), shrinks the hash
+     * tables of the cell storage to fit, shares identical formula elements between all
+     * formulas, clears the columnar plan cache and the range index (both are rebuilt on
+     * demand) and returns free heap pages to the operating system where the C library
+     * allows it. The values of the cells do not change, but empty cells are no longer
+     * saved. Do not call this concurrently with any other operation on the sheet.
+     */
+    void compact();
+
+    /**
+     * @brief Returns the statistics collected since construction or the last resetStats call.
+     *
+     * The statistics include per-operation call counts and times, the number of cells
+     * evaluated through references, per-function range scan volumes, cache hit rates and
+     * a histogram of evaluation depths. They are only collected when the engine is built
+     * with EXCEL_ENABLE_STATS. Concurrent getValue calls each collect their statistics
+     * privately and add them to the shard of their thread when they finish (see
+     * StatsCollector); the result sums the shards.
+     *
+     * @return const EvaluationStats& The collected statistics, valid until the next call.
+     */
+    const EvaluationStats &stats() const;
+
+    /**
+     * @brief Resets the collected statistics to zero.
+     */
+    void resetStats();
+
+    /**
+     * @brief Gives access to the per-formula evaluation profiler of this sheet.
+     *
+     * Profiling is disabled by default. Once enabled (EvaluationProfiler::enable), every
+     * formula evaluation performed by this sheet is recorded and can be exported as a
+     * hot-cell report or a Chrome trace. The profiler records a single thread of
+     * evaluation; do not enable it while the sheet is read concurrently, including by
+     * asynchronous evaluations.
+     *
+     * @return EvaluationProfiler& The profiler of this sheet.
+     */
+    EvaluationProfiler &profiler() const;
+
     /**
      * @brief Copies a rectangular region of cells from one area to another.
      *
@@ -105,10 +395,73 @@ private:
      * @param contents A string containing the value or expression.
      * @return CustomCValue The determined value type.
      */
-    CustomCValue DetermineValue(const std::string &contents);
+    static CustomCValue DetermineValue(const std::string &contents);
+
+    /**
+     * @brief Evaluates a cell in the given context.
+     *
+     * The context carries the stop token, memo and work counter of the caller; its
+     * evaluation path is reset. The value is undefined if the stop token was triggered.
+     *
+     * @param pos The position of the cell.
+     * @param context The context to evaluate in.
+     * @return CValue The evaluated value of the cell.
+     */
+    CValue evaluateCell(const CPos &pos, EvaluationContext &context) const;
+
+    /**
+     * @brief Returns the positions of all formula cells, in row-major order.
+     */
+    std::vector<CPos> formulaCells() const;
+
+    /**
+     * @brief Parses one line of the saved format into the cell key and contents.
+     *
+     * Independent of the sheet, so lines can be parsed concurrently.
+     *
+     * @param line The line, without the line terminator.
+     * @param lazy True to keep a formula in its saved form (see setLazyLoading).
+     * @param key Receives the unique identifier of the cell.
+     * @param cell Receives the contents of the cell.
+     */
+    static void parseSavedCell(const std::string &line, bool lazy, size_t &key, CustomCValue &cell);
+
+    /**
+     * @brief Parses consecutive lines of the saved format.
+     *
+     * @param lines The lines, each terminated by '\n' (the last one may lack it).
+     * @param lazy True to keep formulas in their saved form (see setLazyLoading).
+     * @return std::vector<std::pair<size_t, CustomCValue>> The unique identifiers and contents of the cells, in order.
+     */
+    static std::vector<std::pair<size_t, CustomCValue>> parseSavedLines(std::string_view lines, bool lazy);
+
+    /**
+     * @brief Loads the cells within the given areas, with the cells their formulas read (see loadRegion).
+     */
+    bool loadAreas(std::istream &is, std::vector<RangeIndex::Area> areas);
+
+    /**
+     * @brief Builds a formula cell from its saved form.
+     *
+     * @param saved The saved form, from the opening to the closing bracket.
+     * @param lazy True to keep the formula in its saved form (see setLazyLoading).
+     * @param cell Receives the contents of the cell.
+     */
+    static void parseSavedFormula(std::string saved, bool lazy, CustomCValue &cell);
+
+    CellStore sheet; ///< The internal storage for cell values and expressions, sharded by column band.
 
-    std::unordered_map<size_t, CustomCValue> sheet; ///< The internal storage for cell values and expressions.
-    mutable std::unordered_set<size_t> evaluationPath; ///< A set used to track evaluation paths for detecting cyclic dependencies.
+    mutable std::map<std::pair<size_t, size_t>, ColumnEvaluator::Plan> columnPlans; ///< Cached columnar plans keyed by top cell and length.
+    mutable uint64_t columnPlansVersion = 0; ///< The formula version of the sheet the cached plans were built for.
+    mutable StatsCollector statistics; ///< Counters and timers of the operations performed on this sheet.
+    mutable EvaluationProfiler evaluationProfiler; ///< Opt-in per-formula profiler.
+    CellOrder saveOrder = CellOrder::Storage; ///< The order in which save writes the cells.
+    SaveFormat saveFormat = SaveFormat::Checksum; ///< The format save writes.
+    size_t saveBlockBytes = BlockFormat::DEFAULT_BLOCK_BYTES; ///< The block size of SaveFormat::Blocks.
+    unsigned ingestThreads = 0; ///< Threads parsing cells in setCells and load (0 = all hardware threads).
+    bool lazyLoading = false;   ///< True if load leaves formulas in their saved form until first use.
+    mutable RangeIndex rangeIndex; ///< The range operands of the formulas, built by the first rangeDependents call.
+    mutable RecalcScheduler scheduler; ///< Runs the asynchronous evaluations; declared last, so it stops first.
 };
 
 #endif // CSPREADSHEET_H
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef CELL_ERROR_H
+#define CELL_ERROR_H
+
+#include "main.h"
+
+/**
+ * @brief Why the evaluation of a formula failed, as the error codes of spreadsheet programs.
+ *
+ * Elements report a failure by setting EvaluationContext::error and returning, rather than
+ * by throwing: errors are common in real sheets (e.g. references to empty cells), and
+ * unwinding an exception costs far more than evaluating a formula. The formula whose
+ * evaluation failed evaluates to an undefined value, since CValue has no error alternative.
+ */
+enum class CellError : unsigned char {
+    None,  ///< No error.
+    Ref,   ///< "#REF!": a reference to an empty cell or a malformed range.
+    Value, ///< "#VALUE!": an operand of the wrong type.
+    Div0,  ///< "#DIV/0!": a division by zero.
+    Num,   ///< "#NUM!": sum, min or max over a range without numbers.
+    Cycle, ///< "#CYCLE!": a cyclic reference.
+    Name   ///< "#NAME?": an unknown function or a malformed formula.
+};
+
+constexpr size_t CELL_ERRORS = 7; ///< The number of CellError values, including None.
+
+/**
+ * @brief Returns the spreadsheet name of an error code, such as "#DIV/0!", or "" for None.
+ */
+constexpr const char *cellErrorName(CellError error) {
+    constexpr const char *names[CELL_ERRORS] = {"", "#REF!", "#VALUE!", "#DIV/0!", "#NUM!", "#CYCLE!", "#NAME?"};
+    return names[static_cast<size_t>(error)];
+}
+
+#endif // CELL_ERROR_H
@@ -0,0 +1,42 @@
+#include "main.h"
+#include "CellReference.h"
+
+namespace {
+    // Parses a reference at the start of [first, last) and returns the end of it, or nullptr.
+    const char *parsePrefix(const char *first, const char *last, CellReference &reference) noexcept {
+        reference = CellReference();
+        if (first != last && *first == '$') {
+            reference.absoluteColumn = true;
+            ++first;
+        }
+
+        const char *letters = first;
+        for (; first != last; ++first) {
+            unsigned char value = COLUMN_LETTER_VALUES[static_cast<unsigned char>(*first)];
+            if (!value) break;
+            reference.column = reference.column * 26 + value;
+            if (reference.column > MAX_CELL_COORDINATE) return nullptr;
+        }
+        if (first == letters) return nullptr;
+
+        if (first != last && *first == '$') {
+            reference.absoluteRow = true;
+            ++first;
+        }
+        auto [end, error] = std::from_chars(first, last, reference.row);
+        if (error != std::errc() || reference.row > MAX_CELL_COORDINATE) return nullptr;
+        return end;
+    }
+}
+
+bool parseCellReference(std::string_view text, CellReference &reference) noexcept {
+    const char *last = text.data() + text.size();
+    return parsePrefix(text.data(), last, reference) == last;
+}
+
+bool parseCellRange(std::string_view text, CellReference &first, CellReference &last) noexcept {
+    const char *end = text.data() + text.size();
+    const char *separator = parsePrefix(text.data(), end, first);
+    if (!separator || separator == end || *separator != ':') return false;
+    return parsePrefix(separator + 1, end, last) == end;
+}
@@ -0,0 +1,56 @@
+#ifndef CELL_REFERENCE_H
+#define CELL_REFERENCE_H
+
+#include "main.h"
+
+/**
+ * @struct CellReference
+ * @brief The components of an A1-style cell reference such as "B7" or "$AA$12".
+ */
+struct CellReference {
+    size_t column = 0;           ///< The column number (1 for "A").
+    size_t row = 0;              ///< The row number.
+    bool absoluteColumn = false; ///< True if the column was prefixed by '$'.
+    bool absoluteRow = false;    ///< True if the row was prefixed by '$'.
+};
+
+/**
+ * @brief Maps every byte to its column letter value (1 for 'A'/'a' ... 26 for 'Z'/'z'), or 0.
+ */
+inline constexpr std::array<unsigned char, 256> COLUMN_LETTER_VALUES = [] {
+    std::array<unsigned char, 256> table{};
+    for (int letter = 0; letter < 26; ++letter) {
+        table['A' + letter] = static_cast<unsigned char>(letter + 1);
+        table['a' + letter] = static_cast<unsigned char>(letter + 1);
+    }
+    return table;
+}();
+
+/**
+ * @brief The largest column or row number a reference may contain (see CPos).
+ */
+inline constexpr size_t MAX_CELL_COORDINATE = 0xFFFFFFFF;
+
+/**
+ * @brief Parses a complete A1-style cell reference.
+ *
+ * Accepts one or more column letters followed by a decimal row number, each optionally
+ * prefixed by '$'. The whole text must be consumed. The parser neither allocates nor throws.
+ *
+ * @param text The text to parse.
+ * @param reference Receives the parsed components on success.
+ * @return bool True if the text is a valid reference.
+ */
+bool parseCellReference(std::string_view text, CellReference &reference) noexcept;
+
+/**
+ * @brief Parses a cell range of the form "<reference>:<reference>".
+ *
+ * @param text The text to parse.
+ * @param first Receives the first corner of the range on success.
+ * @param last Receives the second corner of the range on success.
+ * @return bool True if the text is a valid range.
+ */
+bool parseCellRange(std::string_view text, CellReference &first, CellReference &last) noexcept;
+
+#endif // CELL_REFERENCE_H
@@ -0,0 +1,99 @@
+#include "CellStore.h"
+#include "MemoryUsage.h"
+
+CellStore::CellStore(const CellStore &other) {
+    *this = other;
+}
+
+CellStore &CellStore::operator=(const CellStore &other) {
+    if (this != &other) {
+        // The locks are not copied: each store guards its own shards.
+        for (size_t i = 0; i < SHARD_COUNT; ++i) {
+            shards[i].cells = other.shards[i].cells;
+            shards[i].formulaChanges = other.shards[i].formulaChanges;
+            shards[i].changes = other.shards[i].changes;
+        }
+    }
+    return *this;
+}
+
+void CellStore::set(size_t key, CustomCValue value) {
+    Shard &shard = shards[shardOf(key)];
+    bool isFormula = std::holds_alternative<ExprStack>(value);
+    std::lock_guard lock(shard.mutex);
+    auto [it, inserted] = shard.cells.try_emplace(key);
+    ++shard.changes;
+    if (isFormula || std::holds_alternative<ExprStack>(it->second)) {
+        ++shard.formulaChanges;
+    }
+    it->second = std::move(value);
+}
+
+void CellStore::setMany(std::vector<std::pair<size_t, CustomCValue>> &cells) {
+    std::array<std::vector<std::pair<size_t, CustomCValue> *>, SHARD_COUNT> byShard;
+    for (auto &cell: cells) {
+        byShard[shardOf(cell.first)].push_back(&cell);
+    }
+    for (size_t i = 0; i < SHARD_COUNT; ++i) {
+        if (byShard[i].empty()) {
+            continue;
+        }
+        Shard &shard = shards[i];
+        std::lock_guard lock(shard.mutex);
+        for (auto *cell: byShard[i]) {
+            auto [it, inserted] = shard.cells.try_emplace(cell->first);
+            ++shard.changes;
+            if (std::holds_alternative<ExprStack>(cell->second)
+                || std::holds_alternative<ExprStack>(it->second)) {
+                ++shard.formulaChanges;
+            }
+            it->second = std::move(cell->second);
+        }
+    }
+}
+
+void CellStore::erase(size_t key) {
+    Shard &shard = shards[shardOf(key)];
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.cells.find(key);
+    if (it == shard.cells.end()) {
+        return;
+    }
+    ++shard.changes;
+    if (std::holds_alternative<ExprStack>(it->second)) {
+        ++shard.formulaChanges;
+    }
+    shard.cells.erase(it);
+}
+
+size_t CellStore::size() const {
+    size_t count = 0;
+    for (const auto &shard: shards) {
+        count += shard.cells.size();
+    }
+    return count;
+}
+
+size_t CellStore::slotMemoryUsage() const {
+    size_t bytes = sizeof(*this);
+    for (const auto &shard: shards) {
+        bytes += MemoryUsage::hashMapBytes(shard.cells);
+    }
+    return bytes;
+}
+
+uint64_t CellStore::formulaVersion() const {
+    uint64_t version = 0;
+    for (const auto &shard: shards) {
+        version += shard.formulaChanges;
+    }
+    return version;
+}
+
+uint64_t CellStore::version() const {
+    uint64_t version = 0;
+    for (const auto &shard: shards) {
+        version += shard.changes;
+    }
+    return version;
+}
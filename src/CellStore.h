@@ -0,0 +1,207 @@
+#ifndef CELL_STORE_H
+#define CELL_STORE_H
+
+#include "main.h"
+#include <mutex>
+#include "CPos.h"
+#include "InlineVector.h"
+#include "InlineString.h"
+
+class ExprElement;
+
+// An expression in evaluation order; formulas of up to four elements (e.g. =A1+1) need no heap storage
+using ExprStack = std::stack<std::shared_ptr<ExprElement>, InlineVector<std::shared_ptr<ExprElement>, 4>>;
+
+// Custom type definition for cell values, supporting various types including expressions
+using CustomCValue = std::variant<std::monostate, double, InlineString, int, ExprStack>;
+
+/**
+ * @class CellStore
+ * @brief Sharded storage of the cells of a spreadsheet, keyed by their unique IDs.
+ *
+ * Cells are split into shards by column band (BAND_WIDTH adjacent columns per band, the
+ * bands assigned to the SHARD_COUNT shards round-robin). Each shard has its own hash map
+ * and lock, so threads writing to different column bands insert concurrently without
+ * contention, while threads writing to the same band are serialized by its lock.
+ *
+ * Lookups take no locks: reading is safe from any number of threads as long as no thread
+ * writes, and writing is safe from any number of threads as long as no thread reads.
+ *
+ * Every shard counts the changes that replaced or inserted a formula. Their sum
+ * (formulaVersion) tells caches derived from the formulas when they are out of date,
+ * without writers having to touch shared state. The count of all changes (version) does the
+ * same for results derived from any cell.
+ */
+class CellStore {
+public:
+    static constexpr size_t SHARD_COUNT = 64; ///< The number of shards.
+    static constexpr size_t BAND_WIDTH = 8;   ///< The number of adjacent columns kept in the same shard.
+
+    CellStore() = default;
+    CellStore(const CellStore &other);
+    CellStore &operator=(const CellStore &other);
+
+    /**
+     * @brief Returns the shard holding the given cell.
+     *
+     * @param key The unique ID of the cell.
+     * @return size_t The index of the shard.
+     */
+    static size_t shardOf(size_t key) {
+        // The column is the upper half of the unique ID (see CPos).
+        return (key >> 32) / BAND_WIDTH % SHARD_COUNT;
+    }
+
+    /**
+     * @brief Looks up a cell without locking.
+     *
+     * @param key The unique ID of the cell.
+     * @return const CustomCValue* The contents of the cell, or nullptr if the cell was never set.
+     */
+    const CustomCValue *find(size_t key) const {
+        const auto &cells = shards[shardOf(key)].cells;
+        auto it = cells.find(key);
+        return it != cells.end() ? &it->second : nullptr;
+    }
+
+    /**
+     * @brief Sets the contents of a cell, locking only its shard.
+     *
+     * @param key The unique ID of the cell.
+     * @param value The new contents of the cell.
+     */
+    void set(size_t key, CustomCValue value);
+
+    /**
+     * @brief Sets the contents of many cells, locking each shard once.
+     *
+     * @param cells The unique IDs and new contents of the cells; the contents are moved from.
+     */
+    void setMany(std::vector<std::pair<size_t, CustomCValue>> &cells);
+
+    /**
+     * @brief Removes a cell, locking only its shard.
+     *
+     * @param key The unique ID of the cell.
+     */
+    void erase(size_t key);
+
+    /**
+     * @brief Returns the number of stored cells.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns the number of formula changes made to the store so far.
+     *
+     * The value changes whenever a formula is inserted, replaced or overwritten.
+     */
+    uint64_t formulaVersion() const;
+
+    /**
+     * @brief Returns the number of changes made to the store so far, of any kind.
+     */
+    uint64_t version() const;
+
+    /**
+     * @brief Calls fn(key, contents) for every stored cell, shard by shard.
+     *
+     * @param fn The callable to invoke.
+     */
+    template<typename Fn>
+    void forEach(Fn &&fn) const {
+        for (const auto &shard: shards) {
+            for (const auto &[key, value]: shard.cells) {
+                fn(key, value);
+            }
+        }
+    }
+
+    /**
+     * @brief Drops empty cells, lets fn rewrite the others and shrinks every hash table to fit.
+     *
+     * fn(key, contents) may replace the contents with equivalent ones, for example to share
+     * their parts with other cells; the change counters are not advanced.
+     *
+     * @param fn The callable to invoke for every remaining cell.
+     */
+    template<typename Fn>
+    void compact(Fn &&fn) {
+        for (auto &shard: shards) {
+            std::lock_guard lock(shard.mutex);
+            std::erase_if(shard.cells, [](const auto &cell) { return std::holds_alternative<std::monostate>(cell.second); });
+            for (auto &[key, value]: shard.cells) {
+                fn(key, value);
+            }
+            shard.cells.rehash(0);
+        }
+    }
+
+    /**
+     * @brief Returns the bytes of the store and its hash tables, with the inline cell contents.
+     */
+    size_t slotMemoryUsage() const;
+
+    /**
+     * @brief Calls fn(key, contents) for every stored cell within a rectangle.
+     *
+     * Visits whichever is smaller: the positions of the rectangle, probed one by one, or
+     * the cells of the shards whose column bands the rectangle overlaps. Large, sparse
+     * rectangles therefore cost no more than the cells actually stored.
+     *
+     * @param corner The top left corner of the rectangle.
+     * @param width The number of columns.
+     * @param height The number of rows.
+     * @param fn The callable to invoke.
+     */
+    template<typename Fn>
+    void forEachInRect(const CPos &corner, size_t width, size_t height, Fn &&fn) const {
+        if (width == 0 || height == 0) {
+            return;
+        }
+        // Divided rather than multiplied: the area of a whole-sheet rectangle overflows.
+        if (width <= size() / height) {
+            for (size_t x = 0; x < width; ++x) {
+                for (size_t y = 0; y < height; ++y) {
+                    size_t key = CPos(corner.getColumn() + x, corner.getRow() + y).getUniqueId();
+                    if (const CustomCValue *value = find(key)) {
+                        fn(key, *value);
+                    }
+                }
+            }
+            return;
+        }
+        std::array<bool, SHARD_COUNT> touched{};
+        for (size_t band = 0; band < SHARD_COUNT && band * BAND_WIDTH < width + BAND_WIDTH; ++band) {
+            touched[shardOf(CPos(corner.getColumn() + band * BAND_WIDTH, 0).getUniqueId())] = true;
+        }
+        for (size_t i = 0; i < SHARD_COUNT; ++i) {
+            if (!touched[i]) {
+                continue;
+            }
+            for (const auto &[key, value]: shards[i].cells) {
+                CPos pos = CPos::fromUniqueId(key);
+                // Unsigned differences, so positions left of or above the corner fall outside.
+                if (static_cast<uint32_t>(pos.getColumn() - corner.getColumn()) < width
+                    && static_cast<uint32_t>(pos.getRow() - corner.getRow()) < height) {
+                    fn(key, value);
+                }
+            }
+        }
+    }
+
+private:
+    /**
+     * @brief One shard, aligned to its own cache lines so that writers do not false-share.
+     */
+    struct alignas(64) Shard {
+        std::unordered_map<size_t, CustomCValue> cells; ///< The cells of the shard.
+        uint64_t formulaChanges = 0;                    ///< Changes that involved a formula.
+        uint64_t changes = 0;                           ///< All changes.
+        std::mutex mutex;                               ///< Serializes writers of the shard.
+    };
+
+    std::array<Shard, SHARD_COUNT> shards;
+};
+
+#endif // CELL_STORE_H
@@ -0,0 +1,206 @@
+#include "ColumnEvaluator.h"
+
+namespace {
+    // Maps a binary operator to its single character code.
+    char binaryCode(const std::string &op) {
+        if (op == "<=") return 'l';
+        if (op == ">=") return 'g';
+        if (op == "<>") return '!';
+        return op.size() == 1 ? op[0] : 0;
+    }
+}
+
+ColumnEvaluator::Plan ColumnEvaluator::plan(const CellStore &sheet, const CPos &top,
+                                            size_t count) {
+    Plan plan;
+    std::vector<Instruction> program, candidate;
+
+    // Returns the expression stack stored at the given offset, if any.
+    auto formulaAt = [&](size_t offset) -> const ExprStack * {
+        auto cell = sheet.find(CPos(top.getColumn(), top.getRow() + offset).getUniqueId());
+        auto exprStack = cell ? std::get_if<ExprStack>(cell) : nullptr;
+        if (exprStack) {
+            // Lazily loaded formulas are compiled here; a malformed one is left to scalar evaluation.
+            try {
+                return &LazyFormula::expand(*exprStack);
+            } catch (const std::exception &) {
+            }
+        }
+        return exprStack;
+    };
+
+    size_t i = 0;
+    while (i < count) {
+        auto exprStack = formulaAt(i);
+        if (!exprStack || !compile(*exprStack, CPos(top.getColumn(), top.getRow() + i), program)) {
+            if (plan.empty() || !plan.back().program.empty()) {
+                plan.push_back({i, 0, {}});
+            }
+            ++plan.back().count;
+            ++i;
+            continue;
+        }
+
+        // Extend the run while the following cells share the same formula shape.
+        size_t end = i + 1;
+        for (; end < count; ++end) {
+            auto nextStack = formulaAt(end);
+            if (!nextStack || !compile(*nextStack, CPos(top.getColumn(), top.getRow() + end), candidate)
+                || candidate != program) {
+                break;
+            }
+        }
+
+        if (end - i == 1) {
+            if (plan.empty() || !plan.back().program.empty()) {
+                plan.push_back({i, 0, {}});
+            }
+            ++plan.back().count;
+        } else {
+            plan.push_back({i, end - i, program});
+        }
+        i = end;
+    }
+    return plan;
+}
+
+std::vector<CValue> ColumnEvaluator::evaluate(const Plan &plan, const CellStore &sheet,
+                                              const CPos &top, const std::function<CValue(const CPos &)> &scalarValue) {
+    std::vector<CValue> results(plan.empty() ? 0 : plan.back().offset + plan.back().count);
+    for (const auto &run: plan) {
+        if (run.program.empty()) {
+            for (size_t i = run.offset; i < run.offset + run.count; ++i) {
+                results[i] = scalarValue(CPos(top.getColumn(), top.getRow() + i));
+            }
+        } else {
+            evaluateRun(run.program, sheet, top.getColumn(), top.getRow() + run.offset, scalarValue,
+                        std::span<CValue>(results).subspan(run.offset, run.count));
+        }
+    }
+    return results;
+}
+
+bool ColumnEvaluator::compile(const ExprStack &exprStack, const CPos &cell,
+                              std::vector<Instruction> &program) {
+    program.clear();
+    size_t depth = 0;
+    for (const auto &element: exprElements(exprStack)) {
+        // typeid is used instead of dynamic_cast chains, as compile runs once per cell of a run.
+        const std::type_info &type = typeid(*element);
+        Instruction instruction{};
+        if (type == typeid(Constant)) {
+            instruction.kind = Instruction::Kind::Constant;
+            instruction.value = static_cast<const Constant *>(element.get())->getValue();
+            ++depth;
+        } else if (type == typeid(FoldedConstant)) {
+            const CValue &value = static_cast<const FoldedConstant *>(element.get())->getValue();
+            if (!std::holds_alternative<double>(value)) return false;
+            instruction.kind = Instruction::Kind::Constant;
+            instruction.value = std::get<double>(value);
+            ++depth;
+        } else if (type == typeid(Reference)) {
+            auto reference = static_cast<const Reference *>(element.get());
+            instruction.kind = Instruction::Kind::Reference;
+            instruction.absoluteColumn = reference->isColumnAbsolute();
+            instruction.absoluteRow = reference->isRowAbsolute();
+            instruction.column = static_cast<long long>(reference->getColumn())
+                                 - (instruction.absoluteColumn ? 0 : static_cast<long long>(cell.getColumn()));
+            instruction.row = static_cast<long long>(reference->getRow())
+                              - (instruction.absoluteRow ? 0 : static_cast<long long>(cell.getRow()));
+            ++depth;
+        } else if (type == typeid(BinaryOperation)) {
+            instruction.kind = Instruction::Kind::Binary;
+            instruction.op = binaryCode(static_cast<const BinaryOperation *>(element.get())->getOp());
+            if (!instruction.op || depth < 2) return false;
+            --depth;
+        } else if (type == typeid(UnaryOperation)) {
+            if (static_cast<const UnaryOperation *>(element.get())->getOp() != "-" || depth < 1) return false;
+            instruction.kind = Instruction::Kind::Negate;
+        } else if (type == typeid(NumericIdentity)) {
+            if (depth < 1) return false;
+            instruction.kind = Instruction::Kind::Check;
+        } else {
+            // Strings, ranges and functions are left to the scalar evaluator.
+            return false;
+        }
+        program.push_back(instruction);
+    }
+    return depth == 1;
+}
+
+void ColumnEvaluator::evaluateRun(const std::vector<Instruction> &program,
+                                  const CellStore &sheet, size_t column, size_t firstRow,
+                                  const std::function<CValue(const CPos &)> &scalarValue, std::span<CValue> results) {
+    const size_t count = results.size();
+    std::vector<std::vector<double>> stack;
+    std::vector<char> valid(count, 1); // Cleared for cells that must be evaluated by the scalar path.
+
+    for (const auto &instruction: program) {
+        switch (instruction.kind) {
+            case Instruction::Kind::Constant:
+                stack.emplace_back(count, instruction.value);
+                break;
+            case Instruction::Kind::Reference: {
+                std::vector<double> &buffer = stack.emplace_back(count);
+                for (size_t i = 0; i < count; ++i) {
+                    long long col = instruction.column + (instruction.absoluteColumn ? 0 : static_cast<long long>(column));
+                    long long row = instruction.row + (instruction.absoluteRow ? 0 : static_cast<long long>(firstRow + i));
+                    CPos input(static_cast<size_t>(col), static_cast<size_t>(row));
+                    auto cell = sheet.find(input.getUniqueId());
+                    if (cell && std::holds_alternative<double>(*cell)) {
+                        buffer[i] = std::get<double>(*cell);
+                    } else if (cell && std::holds_alternative<ExprStack>(*cell)) {
+                        CValue value = scalarValue(input);
+                        if (std::holds_alternative<double>(value)) {
+                            buffer[i] = std::get<double>(value);
+                        } else {
+                            valid[i] = 0;
+                        }
+                    } else {
+                        valid[i] = 0;
+                    }
+                }
+                break;
+            }
+            case Instruction::Kind::Binary: {
+                std::vector<double> right = std::move(stack.back());
+                stack.pop_back();
+                std::vector<double> &left = stack.back();
+                double *l = left.data();
+                const double *r = right.data();
+                switch (instruction.op) {
+                    case '+': for (size_t i = 0; i < count; ++i) l[i] += r[i]; break;
+                    case '-': for (size_t i = 0; i < count; ++i) l[i] -= r[i]; break;
+                    case '*': for (size_t i = 0; i < count; ++i) l[i] *= r[i]; break;
+                    case '/':
+                        for (size_t i = 0; i < count; ++i) {
+                            valid[i] &= r[i] != 0;
+                            l[i] /= r[i];
+                        }
+                        break;
+                    case '^': for (size_t i = 0; i < count; ++i) l[i] = std::pow(l[i], r[i]); break;
+                    case '<': for (size_t i = 0; i < count; ++i) l[i] = l[i] < r[i] ? 1.0 : 0.0; break;
+                    case 'l': for (size_t i = 0; i < count; ++i) l[i] = l[i] <= r[i] ? 1.0 : 0.0; break;
+                    case '>': for (size_t i = 0; i < count; ++i) l[i] = l[i] > r[i] ? 1.0 : 0.0; break;
+                    case 'g': for (size_t i = 0; i < count; ++i) l[i] = l[i] >= r[i] ? 1.0 : 0.0; break;
+                    case '=': for (size_t i = 0; i < count; ++i) l[i] = l[i] == r[i] ? 1.0 : 0.0; break;
+                    case '!': for (size_t i = 0; i < count; ++i) l[i] = l[i] != r[i] ? 1.0 : 0.0; break;
+                }
+                break;
+            }
+            case Instruction::Kind::Negate: {
+                double *v = stack.back().data();
+                for (size_t i = 0; i < count; ++i) v[i] = -v[i];
+                break;
+            }
+            case Instruction::Kind::Check:
+                // Every buffer holds numbers only, so the check always succeeds.
+                break;
+        }
+    }
+
+    const std::vector<double> &values = stack.back();
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = valid[i] ? CValue(values[i]) : scalarValue(CPos(column, firstRow + i));
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef COLUMN_EVALUATOR_H
+#define COLUMN_EVALUATOR_H
+
+#include "main.h"
+#include "CPos.h"
+#include "ExprElement.h"
+
+/**
+ * @class ColumnEvaluator
+ * @brief Evaluates runs of filled-down formulas one column at a time.
+ *
+ * Cells of a column that hold the same relative formula (as produced by copyRect or by
+ * filling a formula down) are compiled once into a small numeric program. The program
+ * is then run over contiguous buffers holding the inputs of all cells in the run, so
+ * each operation is a single tight loop instead of a virtual call per cell. Cells whose
+ * inputs are not plain numbers, or whose formula cannot be compiled, are evaluated by
+ * the regular scalar path.
+ *
+ * Planning (finding runs and compiling them) is separate from evaluation, so a plan
+ * can be reused for as long as the formulas of the column do not change.
+ */
+class ColumnEvaluator {
+public:
+    /**
+     * @brief A single step of a compiled column program.
+     */
+    struct Instruction {
+        enum class Kind { Constant, Reference, Binary, Negate, Check } kind;
+        char op = 0;          ///< Binary operator code ('+', '-', '*', '/', '^', '<', 'l', '>', 'g', '=', '!').
+        double value = 0;     ///< Value of a constant.
+        long long column = 0; ///< Referenced column (absolute) or column offset (relative).
+        long long row = 0;    ///< Referenced row (absolute) or row offset (relative).
+        bool absoluteColumn = false, absoluteRow = false;
+
+        bool operator==(const Instruction &other) const = default;
+    };
+
+    /**
+     * @brief A run of consecutive cells evaluated the same way.
+     */
+    struct Run {
+        size_t offset;                    ///< Index of the first cell of the run, relative to the top of the column.
+        size_t count;                     ///< Number of cells in the run.
+        std::vector<Instruction> program; ///< Shared compiled program, empty if the cells are evaluated one by one.
+    };
+
+    using Plan = std::vector<Run>;
+
+    /**
+     * @brief Splits a column into runs and compiles the formulas shared by each run.
+     *
+     * @param sheet The map representing the spreadsheet, where cells are identified by unique IDs.
+     * @param top The position of the first cell of the column.
+     * @param count The number of cells in the column.
+     * @return Plan The runs covering the column, from top to bottom.
+     */
+    static Plan plan(const CellStore &sheet, const CPos &top, size_t count);
+
+    /**
+     * @brief Evaluates a column of cells according to a plan.
+     *
+     * @param plan A plan created for the same column and the current formulas of the sheet.
+     * @param sheet The map representing the spreadsheet, where cells are identified by unique IDs.
+     * @param top The position of the first cell of the column.
+     * @param scalarValue Evaluates a single cell; used for inputs and cells that cannot be vectorized.
+     * @return std::vector<CValue> The values of the cells, from top to bottom.
+     */
+    static std::vector<CValue> evaluate(const Plan &plan, const CellStore &sheet,
+                                        const CPos &top, const std::function<CValue(const CPos &)> &scalarValue);
+
+private:
+    /**
+     * @brief Compiles the formula stored in a cell into a column program.
+     *
+     * @param exprStack The expression stack of the cell.
+     * @param cell The position of the cell, used to turn relative references into offsets.
+     * @param program Receives the compiled instructions.
+     * @return bool True if the formula is purely numeric and can be vectorized.
+     */
+    static bool compile(const ExprStack &exprStack, const CPos &cell,
+                        std::vector<Instruction> &program);
+
+    /**
+     * @brief Runs a compiled program over a run of cells of one column.
+     *
+     * @param program The compiled program shared by all cells of the run.
+     * @param sheet The map representing the spreadsheet, where cells are identified by unique IDs.
+     * @param column The column of the run.
+     * @param firstRow The row of the first cell of the run.
+     * @param scalarValue Evaluates a single cell; used for inputs and cells that cannot be vectorized.
+     * @param results Receives one value per cell of the run.
+     */
+    static void evaluateRun(const std::vector<Instruction> &program, const CellStore &sheet,
+                            size_t column, size_t firstRow, const std::function<CValue(const CPos &)> &scalarValue,
+                            std::span<CValue> results);
+};
+
+#endif // COLUMN_EVALUATOR_H
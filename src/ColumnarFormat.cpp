@@ -0,0 +1,453 @@
+#include "ColumnarFormat.h"
+#include "ByteScan.h"
+#include "CPos.h"
+#include "ExprElement.h"
+#include <bit>
+
+namespace {
+
+// The kinds of cells, stored run-length encoded.
+enum Kind : unsigned char {
+    EMPTY,
+    NUMBER,
+    TEXT,
+    FORMULA
+};
+
+void putVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Reads the bytes of a section, throwing if they run out.
+class Reader {
+public:
+    explicit Reader(std::string_view data) : data(data) {}
+
+    unsigned char byte() {
+        if (position >= data.size()) {
+            throw std::runtime_error("Malformed column section");
+        }
+        return static_cast<unsigned char>(data[position++]);
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            unsigned char next = byte();
+            value |= static_cast<uint64_t>(next & 0x7F) << shift;
+            if (!(next & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Malformed column section");
+    }
+
+    std::string_view bytes(uint64_t size) {
+        if (size > data.size() - position) {
+            throw std::runtime_error("Malformed column section");
+        }
+        std::string_view result = data.substr(position, size);
+        position += size;
+        return result;
+    }
+
+    size_t remaining() const {
+        return data.size() - position;
+    }
+
+private:
+    std::string_view data;
+    size_t position = 0;
+};
+
+// Appends bits to a string, most significant first.
+class BitWriter {
+public:
+    explicit BitWriter(std::string &out) : out(out) {}
+
+    void put(uint64_t value, unsigned count) {
+        while (count > 0) {
+            if (free == 0) {
+                out += '\0';
+                free = 8;
+            }
+            unsigned take = std::min(count, free);
+            auto chunk = static_cast<unsigned char>((value >> (count - take)) & ((1u << take) - 1));
+            out.back() = static_cast<char>(static_cast<unsigned char>(out.back()) | chunk << (free - take));
+            free -= take;
+            count -= take;
+        }
+    }
+
+private:
+    std::string &out;
+    unsigned free = 0;
+};
+
+// Reads the bits written by BitWriter.
+class BitReader {
+public:
+    explicit BitReader(Reader &reader) : reader(reader) {}
+
+    uint64_t get(unsigned count) {
+        uint64_t value = 0;
+        while (count > 0) {
+            if (available == 0) {
+                current = reader.byte();
+                available = 8;
+            }
+            unsigned take = std::min(count, available);
+            value = value << take | ((current >> (available - take)) & ((1u << take) - 1));
+            available -= take;
+            count -= take;
+        }
+        return value;
+    }
+
+private:
+    Reader &reader;
+    unsigned char current = 0;
+    unsigned available = 0;
+};
+
+// Encodes the numbers of a column as XORs with the previous number: a repeated number
+// takes one bit, and a changed one only the bits between the leading and trailing zeros.
+std::string encodeNumbers(const std::vector<double> &numbers) {
+    std::string out;
+    BitWriter bits(out);
+    uint64_t previous = 0;
+    unsigned leading = 64, trailing = 0; // The current window; none before the first change.
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        uint64_t value = std::bit_cast<uint64_t>(numbers[i]);
+        if (i == 0) {
+            bits.put(value, 64);
+        } else if (uint64_t diff = value ^ previous; diff == 0) {
+            bits.put(0, 1);
+        } else {
+            auto diffLeading = std::min(static_cast<unsigned>(std::countl_zero(diff)), 31u);
+            auto diffTrailing = static_cast<unsigned>(std::countr_zero(diff));
+            if (leading != 64 && diffLeading >= leading && diffTrailing >= trailing) {
+                bits.put(0b10, 2);
+                bits.put(diff >> trailing, 64 - leading - trailing);
+            } else {
+                leading = diffLeading;
+                trailing = diffTrailing;
+                unsigned length = 64 - leading - trailing;
+                bits.put(0b11, 2);
+                bits.put(leading, 5);
+                bits.put(length - 1, 6);
+                bits.put(diff >> trailing, length);
+            }
+        }
+        previous = value;
+    }
+    return out;
+}
+
+std::vector<double> decodeNumbers(Reader &reader, size_t count) {
+    std::vector<double> numbers;
+    numbers.reserve(count);
+    BitReader bits(reader);
+    uint64_t previous = 0;
+    unsigned leading = 64, trailing = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t value;
+        if (i == 0) {
+            value = bits.get(64);
+        } else if (bits.get(1) == 0) {
+            value = previous;
+        } else {
+            if (bits.get(1) == 1) {
+                leading = static_cast<unsigned>(bits.get(5));
+                unsigned length = static_cast<unsigned>(bits.get(6)) + 1;
+                if (leading + length > 64) {
+                    throw std::runtime_error("Malformed column section");
+                }
+                trailing = 64 - leading - length;
+            } else if (leading == 64) {
+                throw std::runtime_error("Malformed column section");
+            }
+            value = previous ^ bits.get(64 - leading - trailing) << trailing;
+        }
+        numbers.push_back(std::bit_cast<double>(value));
+        previous = value;
+    }
+    return numbers;
+}
+
+// Writes the distinct values and then, for every value in order, the index of its entry.
+// Values with equal keys share the entry of the first of them.
+void encodeDictionary(std::string &out, const std::vector<std::string_view> &values,
+                      const std::vector<std::string_view> &keys) {
+    std::unordered_map<std::string_view, size_t> ids;
+    std::vector<std::string_view> distinct;
+    std::vector<size_t> indices;
+    indices.reserve(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        auto [it, added] = ids.try_emplace(keys[i], distinct.size());
+        if (added) {
+            distinct.push_back(values[i]);
+        }
+        indices.push_back(it->second);
+    }
+    putVarint(out, distinct.size());
+    for (std::string_view value : distinct) {
+        putVarint(out, value.size());
+        out += value;
+    }
+    for (size_t index : indices) {
+        putVarint(out, index);
+    }
+}
+
+// Reads the entries of a dictionary and returns the entry index of every value.
+std::vector<size_t> decodeDictionary(Reader &reader, size_t count, std::vector<std::string_view> &distinct) {
+    uint64_t distinctCount = reader.varint();
+    if (distinctCount > reader.remaining()) {
+        throw std::runtime_error("Malformed column section");
+    }
+    distinct.resize(distinctCount);
+    for (auto &value : distinct) {
+        value = reader.bytes(reader.varint());
+    }
+    std::vector<size_t> indices;
+    indices.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t index = reader.varint();
+        if (index >= distinct.size()) {
+            throw std::runtime_error("Malformed column section");
+        }
+        indices.push_back(index);
+    }
+    return indices;
+}
+
+// Returns a key that is equal for formulas that differ only by the position of their
+// relative references: the formula as it would read if moved to row 0.
+std::string formulaKey(const ExprStack &formula, size_t row) {
+    try {
+        return savedFormula(relocateFormula(formula, CPos(0, static_cast<uint32_t>(0 - row))));
+    } catch (const std::exception &) {
+        // A lazily loaded formula that does not compile is kept apart, in its saved form.
+        return std::to_string(row) + savedFormula(formula);
+    }
+}
+
+// Encodes the cells of one column, sorted by row.
+std::string encodeColumn(const ColumnarFormat::SavedCell *cells, size_t count) {
+    std::string out;
+
+    // Runs of consecutive rows.
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t i = 0; i < count; ++i) {
+        size_t row = CPos::fromUniqueId(cells[i].first).getRow();
+        if (!runs.empty() && runs.back().first + runs.back().second == row) {
+            ++runs.back().second;
+        } else {
+            runs.emplace_back(row, 1);
+        }
+    }
+    putVarint(out, runs.size());
+    size_t end = 0;
+    for (const auto &[first, length] : runs) {
+        putVarint(out, first - end);
+        putVarint(out, length);
+        end = first + length;
+    }
+
+    // Kinds, run-length encoded, and the values of each kind.
+    std::vector<std::pair<Kind, size_t>> kinds;
+    std::vector<double> numbers;
+    std::vector<std::string_view> texts, formulas, formulaKeys;
+    std::vector<std::string> formulaStorage, formulaKeyStorage;
+    formulaStorage.reserve(count);
+    formulaKeyStorage.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const CustomCValue &value = *cells[i].second;
+        Kind kind = EMPTY;
+        if (std::holds_alternative<double>(value)) {
+            kind = NUMBER;
+            numbers.push_back(std::get<double>(value));
+        } else if (std::holds_alternative<InlineString>(value)) {
+            kind = TEXT;
+            texts.push_back(std::get<InlineString>(value).view());
+        } else if (std::holds_alternative<ExprStack>(value)) {
+            kind = FORMULA;
+            const auto &formula = std::get<ExprStack>(value);
+            formulas.emplace_back(formulaStorage.emplace_back(savedFormula(formula)));
+            size_t row = CPos::fromUniqueId(cells[i].first).getRow();
+            formulaKeys.emplace_back(formulaKeyStorage.emplace_back(formulaKey(formula, row)));
+        }
+        if (!kinds.empty() && kinds.back().first == kind) {
+            ++kinds.back().second;
+        } else {
+            kinds.emplace_back(kind, 1);
+        }
+    }
+    putVarint(out, kinds.size());
+    for (const auto &[kind, length] : kinds) {
+        out += static_cast<char>(kind);
+        putVarint(out, length);
+    }
+
+    std::string numberBits = encodeNumbers(numbers);
+    putVarint(out, numberBits.size());
+    out += numberBits;
+    encodeDictionary(out, texts, texts);
+    encodeDictionary(out, formulas, formulaKeys);
+    return out;
+}
+
+} // namespace
+
+void ColumnarFormat::write(std::ostream &os, const std::vector<SavedCell> &cells) {
+    std::vector<Section> index;
+    std::string sections;
+    for (size_t first = 0; first < cells.size();) {
+        size_t column = CPos::fromUniqueId(cells[first].first).getColumn();
+        size_t last = first + 1;
+        while (last < cells.size() && last - first < SECTION_CELLS
+               && CPos::fromUniqueId(cells[last].first).getColumn() == column) {
+            ++last;
+        }
+        std::string section = encodeColumn(cells.data() + first, last - first);
+        index.push_back({column, CPos::fromUniqueId(cells[first].first).getRow(),
+                         CPos::fromUniqueId(cells[last - 1].first).getRow(), last - first, sections.size(),
+                         section.size(), ByteScan::crc32c(section)});
+        sections += section;
+        first = last;
+    }
+
+    std::ostringstream indexStream;
+    for (const auto &section : index) {
+        indexStream << section.column << ' ' << section.top << ' ' << section.bottom << ' ' << section.cells << ' ' << section.length << ' ' << section.crc << '\n';
+    }
+    std::string indexText = indexStream.str();
+    os << "COLUMNAR " << index.size() << ' ' << ByteScan::crc32c(indexText) << '\n' << indexText << sections;
+}
+
+bool ColumnarFormat::readIndex(const std::string &header, std::istream &is, std::vector<Section> &sections) {
+    std::istringstream headerStream(header);
+    std::string label;
+    size_t count;
+    uint32_t indexCrc;
+    if (!(headerStream >> label >> count >> indexCrc) || label != "COLUMNAR") {
+        return false;
+    }
+
+    sections.clear();
+    uint32_t crc = 0;
+    size_t offset = 0;
+    std::string line;
+    for (size_t i = 0; i < count; ++i) {
+        if (!getline(is, line)) {
+            return false;
+        }
+        crc = ByteScan::crc32c(line + '\n', crc);
+        Section section{};
+        section.offset = offset;
+        std::istringstream lineStream(line);
+        if (!(lineStream >> section.column >> section.top >> section.bottom >> section.cells >> section.length
+                         >> section.crc)) {
+            return false;
+        }
+        offset += section.length;
+        sections.push_back(section);
+    }
+    return crc == indexCrc;
+}
+
+bool ColumnarFormat::verify(std::string_view data, const Section &section, size_t base) {
+    if (section.offset < base || section.offset - base + section.length > data.size()) {
+        return false;
+    }
+    return ByteScan::crc32c(data.substr(section.offset - base, section.length)) == section.crc;
+}
+
+std::vector<std::pair<size_t, CustomCValue>> ColumnarFormat::decode(std::string_view data, const Section &section,
+                                                                    const FormulaParser &formulaParser, size_t base) {
+    if (section.offset < base || section.offset - base + section.length > data.size()) {
+        throw std::runtime_error("Malformed column section");
+    }
+    Reader reader(data.substr(section.offset - base, section.length));
+    std::vector<std::pair<size_t, CustomCValue>> cells;
+    cells.reserve(std::min(section.cells, section.length * 128));
+
+    size_t runCount = reader.varint(), end = 0;
+    for (size_t run = 0; run < runCount; ++run) {
+        size_t first = end + reader.varint();
+        end = first + reader.varint();
+        if (end < first || end - first > section.cells - cells.size()) {
+            throw std::runtime_error("Malformed column section");
+        }
+        for (size_t row = first; row < end; ++row) {
+            cells.emplace_back(CPos(section.column, row).getUniqueId(), std::monostate());
+        }
+    }
+
+    std::vector<Kind> kinds;
+    kinds.reserve(cells.size());
+    size_t numberCount = 0, textCount = 0, formulaCount = 0;
+    size_t kindRuns = reader.varint();
+    for (size_t run = 0; run < kindRuns; ++run) {
+        auto kind = static_cast<Kind>(reader.byte());
+        size_t length = reader.varint();
+        if (kind > FORMULA || length > cells.size() - kinds.size()) {
+            throw std::runtime_error("Malformed column section");
+        }
+        kinds.insert(kinds.end(), length, kind);
+        numberCount += kind == NUMBER ? length : 0;
+        textCount += kind == TEXT ? length : 0;
+        formulaCount += kind == FORMULA ? length : 0;
+    }
+    if (cells.size() != section.cells || kinds.size() != cells.size()) {
+        throw std::runtime_error("Malformed column section");
+    }
+
+    Reader numberReader(reader.bytes(reader.varint()));
+    std::vector<double> numbers = decodeNumbers(numberReader, numberCount);
+    std::vector<std::string_view> textEntries, formulaEntries;
+    std::vector<size_t> texts = decodeDictionary(reader, textCount, textEntries);
+    std::vector<size_t> formulas = decodeDictionary(reader, formulaCount, formulaEntries);
+
+    // A formula used by several cells is built once, at its first row, and moved to the others;
+    // when the parser keeps formulas lazy, the moved copies are compiled on first use too.
+    std::vector<size_t> uses(formulaEntries.size());
+    for (size_t index : formulas) {
+        ++uses[index];
+    }
+    std::vector<std::optional<std::pair<size_t, ExprStack>>> shared(formulaEntries.size());
+
+    size_t number = 0, text = 0, formula = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        switch (kinds[i]) {
+            case NUMBER:
+                cells[i].second = numbers[number++];
+                break;
+            case TEXT:
+                cells[i].second = InlineString(textEntries[texts[text++]]);
+                break;
+            case FORMULA: {
+                size_t index = formulas[formula++];
+                size_t row = CPos::fromUniqueId(cells[i].first).getRow();
+                auto &first = shared[index];
+                if (uses[index] == 1) {
+                    cells[i].second = formulaParser(std::string(formulaEntries[index]));
+                } else if (!first) {
+                    first.emplace(row, std::get<ExprStack>(formulaParser(std::string(formulaEntries[index]))));
+                    cells[i].second = first->second;
+                } else {
+                    cells[i].second = LazyFormula::relocated(first->second, CPos(0, row - first->first));
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return cells;
+}
@@ -0,0 +1,95 @@
+#ifndef COLUMNAR_FORMAT_H
+#define COLUMNAR_FORMAT_H
+
+#include "main.h"
+#include "CellStore.h"
+
+/**
+ * @class ColumnarFormat
+ * @brief Encodes and decodes the compressed, column by column file format (SaveFormat::Columnar).
+ *
+ * The cells are grouped by column, and each column is stored as binary sections of up to
+ * SECTION_CELLS cells, each with its own encodings:
+ *   - the rows, as runs of consecutive rows (gap from the previous run and length, as
+ *     varints), so a filled column costs a few bytes regardless of its height;
+ *   - the kinds of the cells (empty, number, text, formula), run-length encoded;
+ *   - the numbers, XOR-compressed against the previous number of the column (as in
+ *     Gorilla), which stores repeated and slowly changing values in a few bits and keeps
+ *     every double exact;
+ *   - text, through a dictionary of the distinct values of the section;
+ *   - formulas, through a dictionary of distinct formulas up to the position of their
+ *     relative references, so a formula filled down a column is stored once: each cell
+ *     refers to the first cell with the same formula, and its own formula is rebuilt by
+ *     moving the references of that one (as copyRect does) rather than by parsing.
+ *
+ * The file starts with the line "COLUMNAR <count> <crc>", followed by one index line per
+ * section, "<column> <top> <bottom> <cells> <length> <crc>" (top and bottom being its first
+ * and last rows), and then the sections back to back. As in
+ * BlockFormat, the crc of the first line covers the index and every section has a CRC32C,
+ * so the sections can be verified and decoded in parallel, and a reader interested in some
+ * cells can skip the sections of other columns and rows.
+ */
+class ColumnarFormat {
+public:
+    static constexpr size_t SECTION_CELLS = 4096; ///< The most cells in one section.
+
+    /**
+     * @brief One entry of the section index.
+     */
+    struct Section {
+        size_t column;      ///< The column number.
+        size_t top, bottom; ///< The first and last rows of the cells in the section.
+        size_t cells;       ///< The number of cells in the section.
+        size_t offset;      ///< The position of the section, counted from the end of the index.
+        size_t length;      ///< The length of the section in bytes.
+        uint32_t crc;       ///< The CRC32C of the section.
+    };
+
+    using SavedCell = std::pair<size_t, const CustomCValue *>;      ///< A cell to save: its unique identifier and contents.
+    using FormulaParser = std::function<CustomCValue(std::string)>; ///< Builds a formula cell from its saved form.
+
+    /**
+     * @brief Writes cells in the columnar format.
+     *
+     * @param os The stream to write to.
+     * @param cells The cells, sorted by unique identifier (by column, then by row).
+     */
+    static void write(std::ostream &os, const std::vector<SavedCell> &cells);
+
+    /**
+     * @brief Reads and verifies the section index.
+     *
+     * @param header The first line of the file, already read.
+     * @param is The stream, positioned after the first line; left positioned at the first section.
+     * @param sections Receives the index.
+     * @return bool False if the header or the index is malformed or fails its checksum.
+     */
+    static bool readIndex(const std::string &header, std::istream &is, std::vector<Section> &sections);
+
+    /**
+     * @brief Returns true if the bytes of a section match its checksum.
+     *
+     * @param data Bytes read from the sections, containing the section.
+     * @param section The section.
+     * @param base The offset (see Section::offset) of the first byte of data.
+     */
+    static bool verify(std::string_view data, const Section &section, size_t base = 0);
+
+    /**
+     * @brief Decodes a section.
+     *
+     * @param data Bytes read from the sections, containing the section.
+     * @param section The section.
+     * @param formulaParser Builds a formula cell from its saved form (see savedFormula), used
+     *                      at the first cell of each formula; the other cells of a formula get
+     *                      moved copies of it (see LazyFormula::relocated), which stay lazy if
+     *                      the parser returns lazy formulas.
+     * @param base The offset (see Section::offset) of the first byte of data.
+     * @return std::vector<std::pair<size_t, CustomCValue>> The cells of the section, by row.
+     * @throws std::runtime_error If the section is malformed.
+     */
+    static std::vector<std::pair<size_t, CustomCValue>> decode(std::string_view data, const Section &section,
+                                                               const FormulaParser &formulaParser, size_t base = 0);
+};
+
+#endif // COLUMNAR_FORMAT_H
@@ -0,0 +1,178 @@
+#include "CsvFormat.h"
+#include "ByteScan.h"
+
+namespace {
+
+constexpr size_t npos = std::string_view::npos;
+
+// Calls visit(row, column, field, quoted) for every field of up to maxRecords records,
+// with the quotes of quoted fields removed. Returns the number of records, or npos if a
+// quoted field is malformed.
+template<typename Visit>
+size_t forEachField(std::string_view data, char delimiter, Visit visit, size_t maxRecords = npos) {
+    std::string unquoted;
+    size_t position = 0, row = 0;
+    for (; position < data.size() && row < maxRecords; ++row) {
+        size_t lineEnd = std::min(ByteScan::find(data, '\n', position), data.size());
+        for (size_t column = 0;; ++column) {
+            std::string_view field;
+            bool quoted = position < lineEnd && data[position] == '"';
+            size_t end;
+            if (quoted) {
+                unquoted.clear();
+                size_t from = position + 1;
+                while (true) {
+                    size_t quote = ByteScan::find(data, '"', from);
+                    if (quote == npos) return npos;
+                    unquoted.append(data.substr(from, quote - from));
+                    if (quote + 1 < data.size() && data[quote + 1] == '"') {
+                        unquoted += '"';
+                        from = quote + 2;
+                        continue;
+                    }
+                    end = quote + 1;
+                    break;
+                }
+                field = unquoted;
+                // The field may span lines, moving the end of the record.
+                if (end > lineEnd) {
+                    lineEnd = std::min(ByteScan::find(data, '\n', end), data.size());
+                }
+                if (end + 1 == lineEnd && data[end] == '\r') {
+                    end = lineEnd;
+                } else if (end < lineEnd && data[end] != delimiter) {
+                    return npos;
+                }
+            } else {
+                end = std::min(ByteScan::find(data.substr(0, lineEnd), delimiter, position), lineEnd);
+                field = data.substr(position, end - position);
+                if (end == lineEnd && field.ends_with('\r')) {
+                    field.remove_suffix(1);
+                }
+            }
+            visit(row, column, field, quoted);
+            if (end >= lineEnd) break;
+            position = end + 1;
+        }
+        position = lineEnd + 1;
+    }
+    return row;
+}
+
+bool parseNumber(std::string_view field, double &number) {
+    auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), number);
+    return error == std::errc() && end == field.data() + field.size();
+}
+
+bool startsNumber(char first) {
+    return std::isdigit(static_cast<unsigned char>(first)) || first == '-' || first == '.';
+}
+
+} // namespace
+
+size_t CsvFormat::completeRecords(std::string_view data, char delimiter) {
+    // Line breaks count outside quoted fields only. As in forEachField, a quote opens a field
+    // only at its start, and a doubled quote inside the field stands for one.
+    size_t complete = 0, position = 0;
+    while (true) {
+        size_t quote = ByteScan::find(data, '"', position);
+        while (quote != npos && quote > 0 && data[quote - 1] != delimiter && data[quote - 1] != '\n') {
+            quote = ByteScan::find(data, '"', quote + 1);
+        }
+        size_t end = quote == npos ? data.size() : quote;
+        size_t lineBreak = data.substr(position, end - position).rfind('\n');
+        if (lineBreak != npos) {
+            complete = position + lineBreak + 1;
+        }
+        if (quote == npos) return complete;
+        size_t from = quote + 1;
+        while (true) {
+            size_t close = ByteScan::find(data, '"', from);
+            if (close == npos) return complete;
+            if (close + 1 < data.size() && data[close + 1] == '"') {
+                from = close + 2;
+                continue;
+            }
+            position = close + 1;
+            break;
+        }
+    }
+}
+
+std::vector<CsvFormat::ColumnType> CsvFormat::inferTypes(std::string_view data, char delimiter) {
+    std::vector<size_t> numbers, texts;
+    auto sample = [&](size_t firstRow, size_t maxRecords) {
+        return forEachField(data, delimiter, [&](size_t row, size_t column, std::string_view field, bool quoted) {
+            if (row < firstRow || field.empty() || (!quoted && field[0] == '=')) return;
+            if (column >= numbers.size()) {
+                numbers.resize(column + 1);
+                texts.resize(column + 1);
+            }
+            double number;
+            ++(parseNumber(field, number) ? numbers : texts)[column];
+        }, maxRecords);
+    };
+    // The first record often holds column titles, so it is only sampled when it is alone.
+    if (sample(1, SAMPLE_RECORDS) == 1) {
+        sample(0, 1);
+    }
+    std::vector<ColumnType> types(numbers.size(), ColumnType::Number);
+    for (size_t column = 0; column < types.size(); ++column) {
+        if (!numbers[column] && texts[column]) {
+            types[column] = ColumnType::Text;
+        }
+    }
+    return types;
+}
+
+CsvFormat::Parsed CsvFormat::parse(std::string_view data, char delimiter, const std::vector<ColumnType> &types,
+                                   const FormulaParser &formulaParser) {
+    Parsed parsed;
+    size_t records = forEachField(data, delimiter, [&](size_t row, size_t column, std::string_view field, bool quoted) {
+        if (field.empty()) return;
+        // Built in place: moving a whole Field through push_back copies the variant again.
+        Field &parsedField = parsed.fields.emplace_back();
+        parsedField.row = row;
+        parsedField.column = column;
+        if (!quoted && field[0] == '=') {
+            parsedField.value = formulaParser(std::string(field));
+            return;
+        }
+        double number;
+        bool numeric = column >= types.size() || types[column] == ColumnType::Number || startsNumber(field[0]);
+        if (numeric && parseNumber(field, number)) {
+            parsedField.value = number;
+        } else {
+            parsedField.value = InlineString(field);
+        }
+    });
+    if (records == npos) {
+        parsed.malformed = true;
+    } else {
+        parsed.records = records;
+    }
+    return parsed;
+}
+
+void CsvFormat::writeValue(std::string &out, const CValue &value, char delimiter) {
+    if (std::holds_alternative<double>(value)) {
+        char buffer[32];
+        auto end = std::to_chars(buffer, buffer + sizeof(buffer), std::get<double>(value)).ptr;
+        out.append(buffer, end);
+    } else if (std::holds_alternative<std::string>(value)) {
+        const std::string &text = std::get<std::string>(value);
+        if (text.find_first_of(std::string{delimiter, '"', '\n', '\r'}) == std::string::npos
+            && !text.starts_with('=')) {
+            out += text;
+            return;
+        }
+        out += '"';
+        for (char ch: text) {
+            if (ch == '"') {
+                out += '"';
+            }
+            out += ch;
+        }
+        out += '"';
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef CSV_FORMAT_H
+#define CSV_FORMAT_H
+
+#include "main.h"
+#include "CellStore.h"
+
+/**
+ * @class CsvFormat
+ * @brief Tokenizes and writes comma separated values (RFC 4180) for importCSV and exportCSV.
+ *
+ * A record ends at a line break ("\n" or "\r\n") outside quotes. A field enclosed in double
+ * quotes may contain delimiters and line breaks, and a doubled quote stands for one quote.
+ * Delimiters, line breaks and quotes are located with ByteScan, so unquoted fields are cut
+ * at vector speed.
+ *
+ * An unquoted field starting with '=' is a formula, as in setCell. Other fields are numbers
+ * if std::from_chars reads them whole, and text otherwise; the type of each column is
+ * inferred once, from a sample of the first records, so the fields of a text column are not
+ * parsed as numbers unless they start like one. Empty fields hold no cell.
+ */
+class CsvFormat {
+public:
+    static constexpr size_t CHUNK_BYTES = 1 << 20;  ///< The size of the pieces an import reads and parses at once.
+    static constexpr size_t MAX_RECORD_BYTES = 4 * CHUNK_BYTES; ///< The longest record an import accepts.
+    static constexpr size_t SAMPLE_RECORDS = 1000;  ///< The records inferTypes looks at.
+
+    /**
+     * @brief The type of a column, chosen from a sample of its fields.
+     */
+    enum class ColumnType {
+        Number, ///< Every field is parsed as a number, falling back to text.
+        Text    ///< Only fields starting with a digit, '-' or '.' are parsed as numbers.
+    };
+
+    /**
+     * @brief One non-empty field, at its record and column counted from 0.
+     */
+    struct Field {
+        size_t row, column;
+        CustomCValue value;
+    };
+
+    /**
+     * @brief The fields of a run of records.
+     */
+    struct Parsed {
+        std::vector<Field> fields; ///< The non-empty fields, in order.
+        size_t records = 0;        ///< The number of records, including those without fields.
+        bool malformed = false;    ///< True if a quoted field is not closed or is followed by other characters.
+    };
+
+    using FormulaParser = std::function<CustomCValue(std::string)>; ///< Builds a formula cell from a field.
+
+    /**
+     * @brief Returns the length of the complete records at the start of the data.
+     *
+     * @param data Records, the last of which may be cut short.
+     * @param delimiter The field delimiter, after which a quote opens a quoted field.
+     * @return size_t The position after the last line break outside quoted fields, or 0 if there is none.
+     */
+    static size_t completeRecords(std::string_view data, char delimiter);
+
+    /**
+     * @brief Chooses the type of each column from the first SAMPLE_RECORDS records.
+     *
+     * The first record is left out of the sample when others follow, as it often holds
+     * column titles. A column is Text if none of its sampled fields is a number, and Number
+     * otherwise; columns beyond the returned ones are Number.
+     *
+     * @param data The first records of the input.
+     * @param delimiter The field delimiter.
+     */
+    static std::vector<ColumnType> inferTypes(std::string_view data, char delimiter);
+
+    /**
+     * @brief Parses complete records into cell values.
+     *
+     * @param data The records.
+     * @param delimiter The field delimiter.
+     * @param types The column types (see inferTypes).
+     * @param formulaParser Builds the cells of fields starting with '='; may throw on malformed formulas.
+     */
+    static Parsed parse(std::string_view data, char delimiter, const std::vector<ColumnType> &types,
+                        const FormulaParser &formulaParser);
+
+    /**
+     * @brief Appends a value as one field.
+     *
+     * Numbers are written exactly, in the shortest form that reads back the same. Text is
+     * quoted if it contains the delimiter, a quote or a line break, or starts with '=',
+     * so it does not read back as a formula. An undefined value is an empty field.
+     *
+     * @param out The text to append to.
+     * @param value The value.
+     * @param delimiter The field delimiter.
+     */
+    static void writeValue(std::string &out, const CValue &value, char delimiter);
+};
+
+#endif // CSV_FORMAT_H
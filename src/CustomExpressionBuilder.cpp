@@ -70,6 +70,6 @@ void CustomExpressionBuilder::funcCall(std::string fnName, int paramCount) {
     expression.push(std::make_unique<FunctionCall>(std::move(fnName), paramCount));
 }
 
-const std::stack<std::shared_ptr<ExprElement>> &CustomExpressionBuilder::getExpression() const {
+const ExprStack &CustomExpressionBuilder::getExpression() const {
     return expression;
 }
@@ -151,12 +151,12 @@ public:
      * Returns a constant reference to the stack containing the constructed expression
      * elements, which can be evaluated or further manipulated.
      *
-     * @return const std::stack<std::shared_ptr<ExprElement>>& The expression stack.
+     * @return const ExprStack& The expression stack.
      */
-    const std::stack<std::shared_ptr<ExprElement>> &getExpression() const;
+    const ExprStack &getExpression() const;
 
 private:
-    std::stack<std::shared_ptr<ExprElement>> expression; ///< Stack holding the constructed expression elements.
+    ExprStack expression; ///< Stack holding the constructed expression elements.
 };
 
 #endif // CUSTOM_EXPRESSION_BUILDER_H
@@ -0,0 +1,64 @@
+#ifndef EVALUATION_CONTEXT_H
+#define EVALUATION_CONTEXT_H
+
+#include "main.h"
+#include <stop_token>
+#include "CellError.h"
+
+/**
+ * @struct EvaluationSuspended
+ * @brief Thrown when an evaluation reaches its work limit, to be resumed by the caller.
+ *
+ * Not derived from std::exception, so the handlers that turn failures into undefined
+ * values let it pass.
+ */
+struct EvaluationSuspended {};
+
+/**
+ * @struct EvaluationContext
+ * @brief The mutable state of one top-level evaluation.
+ *
+ * Every getValue call creates its own context and passes it through ExprElement::evaluate,
+ * so evaluations running concurrently on different threads share no state and reading an
+ * unchanging sheet from many threads needs no locks.
+ */
+struct EvaluationContext {
+    std::unordered_set<size_t> evaluationPath; ///< Formula cells on the current reference chain, for cycle detection.
+    std::stop_token stopToken;                 ///< Abandons the evaluation when stop is requested (asynchronous reads).
+    size_t work = 0;                           ///< Cells visited so far, through references and ranges.
+    size_t workLimit = SIZE_MAX;               ///< The work after which references to formulas suspend the evaluation.
+    size_t suspendedAt = 0;                    ///< The formula cell the last suspension stopped before.
+    bool cycleDetected = false;                ///< True once a cyclic reference was found.
+    CellError error = CellError::None;         ///< Set by the element that failed, until its formula gives up.
+    CellError failure = CellError::None;       ///< The error of the last top-level formula evaluated, if it failed.
+
+    /**
+     * @brief Values of formula cells already known in this recalculation, or nullptr.
+     *
+     * Set by recalculations that evaluate many cells of an unchanging sheet. References to
+     * cells found here are not evaluated again.
+     */
+    const std::unordered_map<size_t, CValue> *memo = nullptr;
+    std::vector<std::pair<size_t, CValue>> memoCandidates; ///< Referenced values to memoize if no cycle is found.
+
+    /**
+     * @brief Throws if the evaluation was cancelled, unwinding it formula by formula.
+     */
+    void checkCancelled() const {
+        if (stopToken.stop_requested()) {
+            throw std::runtime_error("Evaluation cancelled");
+        }
+    }
+
+    /**
+     * @brief Throws EvaluationSuspended if the work limit is reached, before a formula cell is evaluated.
+     */
+    void checkSuspended(size_t uniqueId) {
+        if (work >= workLimit) {
+            suspendedAt = uniqueId;
+            throw EvaluationSuspended{};
+        }
+    }
+};
+
+#endif // EVALUATION_CONTEXT_H
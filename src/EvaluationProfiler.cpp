@@ -0,0 +1,92 @@
+#include "EvaluationProfiler.h"
+#include "CPos.h"
+
+thread_local EvaluationProfiler *EvaluationProfiler::active = nullptr;
+
+void EvaluationProfiler::enable(bool trace, size_t maxEvents) {
+    if (!enabled && !tracing) {
+        epoch = Clock::now();
+    }
+    enabled = true;
+    tracing = trace;
+    maxTraceEvents = maxEvents;
+}
+
+void EvaluationProfiler::disable() {
+    enabled = false;
+}
+
+bool EvaluationProfiler::isEnabled() const {
+    return enabled;
+}
+
+void EvaluationProfiler::reset() {
+    profiles.clear();
+    traceEvents.clear();
+    frames.clear();
+    epoch = Clock::now();
+}
+
+const std::unordered_map<size_t, EvaluationProfiler::CellProfile> &EvaluationProfiler::cells() const {
+    return profiles;
+}
+
+void EvaluationProfiler::enter(size_t cellId) {
+    frames.push_back({cellId, Clock::now()});
+}
+
+void EvaluationProfiler::leave() {
+    OpenFrame frame = frames.back();
+    frames.pop_back();
+    auto end = Clock::now();
+    uint64_t inclusive = std::chrono::duration_cast<std::chrono::nanoseconds>(end - frame.start).count();
+
+    CellProfile &profile = profiles[frame.cellId];
+    ++profile.evaluations;
+    profile.inclusiveNs += inclusive;
+    profile.exclusiveNs += inclusive - std::min(inclusive, frame.childNs);
+    profile.cellsVisited += frame.cellsVisited;
+
+    if (!frames.empty()) {
+        frames.back().childNs += inclusive;
+    }
+    if (tracing && traceEvents.size() < maxTraceEvents) {
+        uint64_t start = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.start - epoch).count();
+        traceEvents.push_back({frame.cellId, start, inclusive, frames.size(), frame.cellsVisited});
+    }
+}
+
+void EvaluationProfiler::report(std::ostream &os, size_t limit) const {
+    std::vector<std::pair<size_t, CellProfile>> sorted(profiles.begin(), profiles.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.exclusiveNs > b.second.exclusiveNs;
+    });
+    if (sorted.size() > limit) {
+        sorted.resize(limit);
+    }
+
+    os << std::left << std::setw(12) << "cell" << std::right << std::setw(12) << "evaluations"
+       << std::setw(16) << "inclusive us" << std::setw(16) << "exclusive us" << std::setw(14) << "visited" << std::endl;
+    for (const auto &[cellId, profile]: sorted) {
+        os << std::left << std::setw(12) << CPos::fromUniqueId(cellId).toString() << std::right
+           << std::setw(12) << profile.evaluations
+           << std::setw(16) << std::fixed << std::setprecision(1) << static_cast<double>(profile.inclusiveNs) / 1000
+           << std::setw(16) << static_cast<double>(profile.exclusiveNs) / 1000
+           << std::setw(14) << profile.cellsVisited << std::endl;
+    }
+}
+
+bool EvaluationProfiler::writeChromeTrace(std::ostream &os) const {
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (size_t i = 0; i < traceEvents.size(); ++i) {
+        const TraceEvent &event = traceEvents[i];
+        os << (i ? ",\n" : "\n")
+           << "{\"name\":\"" << CPos::fromUniqueId(event.cellId).toString() << "\",\"cat\":\"cell\",\"ph\":\"X\""
+           << ",\"ts\":" << std::fixed << std::setprecision(3) << static_cast<double>(event.startNs) / 1000
+           << ",\"dur\":" << static_cast<double>(event.durationNs) / 1000
+           << ",\"pid\":1,\"tid\":1,\"args\":{\"depth\":" << event.depth
+           << ",\"visited\":" << event.cellsVisited << "}}";
+    }
+    os << "\n]}" << std::endl;
+    return static_cast<bool>(os);
+}
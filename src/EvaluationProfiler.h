@@ -0,0 +1,155 @@
+#ifndef EVALUATION_PROFILER_H
+#define EVALUATION_PROFILER_H
+
+#include "main.h"
+#include <chrono>
+
+/**
+ * @class EvaluationProfiler
+ * @brief Opt-in per-formula profiler of spreadsheet evaluation.
+ *
+ * While enabled, every evaluation of a formula cell (requested directly through getValue,
+ * reached through a reference or scanned by a range function) is recorded with its
+ * inclusive and exclusive time and the number of cells it visited. The results can be
+ * written as a report of the hottest cells or as a Chrome trace (chrome://tracing,
+ * Perfetto). When disabled, each hook costs a single thread-local pointer check.
+ */
+class EvaluationProfiler {
+public:
+    /**
+     * @brief Profile of one formula cell.
+     */
+    struct CellProfile {
+        size_t evaluations = 0;      ///< Number of times the formula was evaluated.
+        uint64_t inclusiveNs = 0;    ///< Time spent in the formula, including the formulas it referenced.
+        uint64_t exclusiveNs = 0;    ///< Time spent in the formula itself.
+        size_t cellsVisited = 0;     ///< Cells visited through references and range functions.
+    };
+
+    /**
+     * @brief Enables profiling, optionally recording a trace event per evaluation.
+     *
+     * @param trace True to record events for writeChromeTrace.
+     * @param maxTraceEvents Upper bound on recorded events, limiting memory use.
+     */
+    void enable(bool trace = false, size_t maxTraceEvents = 1000000);
+
+    /**
+     * @brief Disables profiling. Collected data is kept until reset.
+     */
+    void disable();
+
+    /**
+     * @brief Returns true if profiling is enabled.
+     */
+    bool isEnabled() const;
+
+    /**
+     * @brief Discards all collected profiles and trace events.
+     */
+    void reset();
+
+    /**
+     * @brief Returns the collected profiles, keyed by the unique ID of the cell.
+     */
+    const std::unordered_map<size_t, CellProfile> &cells() const;
+
+    /**
+     * @brief Writes the hottest cells sorted by exclusive time.
+     *
+     * @param os The output stream to write the report to.
+     * @param limit The maximal number of cells to report.
+     */
+    void report(std::ostream &os, size_t limit = 20) const;
+
+    /**
+     * @brief Writes the recorded trace events in the Chrome trace event JSON format.
+     *
+     * @param os The output stream to write the trace to.
+     * @return bool True if the trace was written successfully.
+     */
+    bool writeChromeTrace(std::ostream &os) const;
+
+    /**
+     * @class Activation
+     * @brief Makes a profiler the target of the evaluation hooks for the duration of an operation.
+     */
+    class Activation {
+    public:
+        explicit Activation(EvaluationProfiler &profiler)
+                : previous(active) {
+            if (profiler.enabled) active = &profiler;
+        }
+
+        ~Activation() { active = previous; }
+
+        Activation(const Activation &) = delete;
+        Activation &operator=(const Activation &) = delete;
+
+    private:
+        EvaluationProfiler *previous;
+    };
+
+    /**
+     * @class Frame
+     * @brief Records one evaluation of a formula cell in the active profiler.
+     */
+    class Frame {
+    public:
+        explicit Frame(size_t cellId) : profiler(active) {
+            if (profiler) profiler->enter(cellId);
+        }
+
+        ~Frame() {
+            if (profiler) profiler->leave();
+        }
+
+        Frame(const Frame &) = delete;
+        Frame &operator=(const Frame &) = delete;
+
+    private:
+        EvaluationProfiler *profiler;
+    };
+
+    /**
+     * @brief Attributes visited cells to the formula currently being evaluated.
+     *
+     * @param count The number of cells visited.
+     */
+    static void countVisits(size_t count) {
+        if (active && !active->frames.empty()) active->frames.back().cellsVisited += count;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct OpenFrame {
+        size_t cellId;
+        Clock::time_point start;
+        uint64_t childNs = 0;
+        size_t cellsVisited = 0;
+    };
+
+    struct TraceEvent {
+        size_t cellId;
+        uint64_t startNs;
+        uint64_t durationNs;
+        size_t depth;
+        size_t cellsVisited;
+    };
+
+    void enter(size_t cellId);
+    void leave();
+
+    bool enabled = false;
+    bool tracing = false;
+    size_t maxTraceEvents = 0;
+    Clock::time_point epoch;                       ///< Time origin of the trace.
+    std::unordered_map<size_t, CellProfile> profiles; ///< Collected profiles by cell.
+    std::vector<OpenFrame> frames;                 ///< Formulas currently being evaluated.
+    std::vector<TraceEvent> traceEvents;           ///< Completed evaluations, if tracing.
+
+    static thread_local EvaluationProfiler *active;
+};
+
+#endif // EVALUATION_PROFILER_H
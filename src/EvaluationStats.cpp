@@ -0,0 +1,177 @@
+#include "EvaluationStats.h"
+
+double EvaluationStats::columnPlanHitRate() const {
+    size_t lookups = columnPlanHits + columnPlanMisses;
+    return lookups ? static_cast<double>(columnPlanHits) / static_cast<double>(lookups) : 0.0;
+}
+
+void EvaluationStats::reset() {
+    *this = EvaluationStats();
+}
+
+void EvaluationStats::merge(const EvaluationStats &other) {
+    for (auto operation: {&EvaluationStats::setCell, &EvaluationStats::setCells, &EvaluationStats::getValue,
+                          &EvaluationStats::getColumnValues, &EvaluationStats::copyRect, &EvaluationStats::load,
+                          &EvaluationStats::save, &EvaluationStats::parse,
+                          &EvaluationStats::importCSV, &EvaluationStats::exportCSV}) {
+        (this->*operation).count += (other.*operation).count;
+        (this->*operation).nanoseconds += (other.*operation).nanoseconds;
+    }
+    referenceEvaluations += other.referenceEvaluations;
+    rangeCellsScanned += other.rangeCellsScanned;
+    for (const auto &[name, function]: other.functions) {
+        functions[name].calls += function.calls;
+        functions[name].cellsScanned += function.cellsScanned;
+    }
+    columnPlanHits += other.columnPlanHits;
+    columnPlanMisses += other.columnPlanMisses;
+    lazyCompilations += other.lazyCompilations;
+    for (size_t i = 0; i < DEPTH_BUCKETS; ++i) {
+        depthHistogram[i] += other.depthHistogram[i];
+    }
+    for (size_t i = 0; i < CELL_ERRORS; ++i) {
+        errors[i] += other.errors[i];
+    }
+}
+
+void EvaluationStats::print(std::ostream &os) const {
+    auto printOperation = [&os](const char *name, const OperationStats &operation) {
+        os << std::left << std::setw(18) << name << std::right << std::setw(12) << operation.count
+           << std::setw(16) << operation.nanoseconds / 1000 << " us" << std::endl;
+    };
+    printOperation("setCell", setCell);
+    printOperation("setCells", setCells);
+    printOperation("getValue", getValue);
+    printOperation("getColumnValues", getColumnValues);
+    printOperation("copyRect", copyRect);
+    printOperation("load", load);
+    printOperation("save", save);
+    printOperation("parseExpression", parse);
+    printOperation("importCSV", importCSV);
+    printOperation("exportCSV", exportCSV);
+    os << "reference evaluations: " << referenceEvaluations << std::endl;
+    os << "range cells scanned:   " << rangeCellsScanned << std::endl;
+    for (const auto &[name, function]: functions) {
+        os << "  " << std::left << std::setw(10) << name << std::right << std::setw(10) << function.calls
+           << " calls" << std::setw(14) << function.cellsScanned << " cells" << std::endl;
+    }
+    os << "column plan cache:     " << columnPlanHits << " hits, " << columnPlanMisses << " misses" << std::endl;
+    os << "lazy compilations:     " << lazyCompilations << std::endl;
+    os << "evaluation depth:     ";
+    for (size_t i = 0; i < DEPTH_BUCKETS; ++i) {
+        os << ' ' << (i == 0 ? 0 : size_t(1) << (i - 1)) << (i + 1 == DEPTH_BUCKETS ? "+" : "") << ':'
+           << depthHistogram[i];
+    }
+    os << std::endl;
+    os << "evaluation errors:    ";
+    for (size_t i = 1; i < CELL_ERRORS; ++i) {
+        os << ' ' << cellErrorName(static_cast<CellError>(i)) << ' ' << errors[i];
+    }
+    os << std::endl;
+}
+
+StatsCollector::StatsCollector() {
+    static std::atomic<uint64_t> collectors = 0;
+    id = ++collectors;
+}
+
+StatsCollector::StatsCollector(const StatsCollector &other) : StatsCollector() {
+    add(other.total());
+}
+
+StatsCollector &StatsCollector::operator=(const StatsCollector &other) {
+    if (this != &other) {
+        EvaluationStats copied = other.total();
+        reset();
+        add(copied);
+    }
+    return *this;
+}
+
+StatsCollector::Shard &StatsCollector::shard() {
+    // The last shard used by the thread, found without a lock while it keeps recording into one sheet.
+    thread_local uint64_t cachedId = 0;
+    thread_local Shard *cached = nullptr;
+    if (cachedId != id) {
+        std::lock_guard lock(shardsMutex);
+        auto &threadShard = shards[std::this_thread::get_id()];
+        if (!threadShard) {
+            threadShard = std::make_unique<Shard>();
+        }
+        cachedId = id;
+        cached = threadShard.get();
+    }
+    return *cached;
+}
+
+void StatsCollector::add(const EvaluationStats &stats) {
+    Shard &own = shard();
+    std::lock_guard lock(own.mutex);
+    own.stats.merge(stats);
+}
+
+const EvaluationStats &StatsCollector::total() const {
+    std::lock_guard lock(shardsMutex);
+    sum.reset();
+    for (const auto &[thread, threadShard]: shards) {
+        std::lock_guard shardLock(threadShard->mutex);
+        sum.merge(threadShard->stats);
+    }
+    return sum;
+}
+
+void StatsCollector::reset() {
+    std::lock_guard lock(shardsMutex);
+    for (const auto &[thread, threadShard]: shards) {
+        std::lock_guard shardLock(threadShard->mutex);
+        threadShard->stats.reset();
+    }
+}
+
+#ifdef EXCEL_ENABLE_STATS
+
+thread_local EvaluationStats *StatsScope::active = nullptr;
+thread_local StatsScope *StatsScope::innermost = nullptr;
+
+StatsScope::StatsScope(StatsCollector &stats, EvaluationStats::OperationStats EvaluationStats::*operation)
+        : stats(stats), operation(operation), start(std::chrono::steady_clock::now()), previous(innermost) {
+    // Operations nested in another operation of the same sheet record into its buffer.
+    buffer = previous && &previous->stats == &stats ? previous->buffer : &local;
+    innermost = this;
+    active = buffer;
+}
+
+StatsScope::~StatsScope() {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EvaluationStats::OperationStats &target = buffer->*operation;
+    ++target.count;
+    target.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    if (operation == &EvaluationStats::getValue) {
+        size_t bucket = 0;
+        while (bucket + 1 < EvaluationStats::DEPTH_BUCKETS && (size_t(1) << bucket) <= maxDepth) {
+            ++bucket;
+        }
+        ++buffer->depthHistogram[bucket];
+    }
+
+    if (buffer == &local) {
+        stats.add(local);
+    }
+    innermost = previous;
+    active = previous ? previous->buffer : nullptr;
+}
+
+StatsDepthGuard::StatsDepthGuard() : scope(StatsScope::innermost) {
+    if (scope) {
+        scope->maxDepth = std::max(scope->maxDepth, ++scope->depth);
+    }
+}
+
+StatsDepthGuard::~StatsDepthGuard() {
+    if (scope) {
+        --scope->depth;
+    }
+}
+
+#endif // EXCEL_ENABLE_STATS
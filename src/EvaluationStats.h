@@ -0,0 +1,202 @@
+#ifndef EVALUATION_STATS_H
+#define EVALUATION_STATS_H
+
+#include "main.h"
+#include "CellError.h"
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+/**
+ * @struct EvaluationStats
+ * @brief Counters and timers describing the work done by a spreadsheet.
+ *
+ * Statistics are only collected when the engine is compiled with EXCEL_ENABLE_STATS
+ * (the default of the debug builds of both the Makefile and CMake; the optimized builds
+ * leave it out). Without it all hooks compile to nothing and the counters stay at zero.
+ */
+struct EvaluationStats {
+    /**
+     * @brief Number of calls and total wall time of one public operation.
+     */
+    struct OperationStats {
+        size_t count = 0;          ///< Number of calls.
+        uint64_t nanoseconds = 0;  ///< Total time spent in the calls.
+    };
+
+    /**
+     * @brief Number of calls and scanned range cells of one spreadsheet function.
+     */
+    struct FunctionStats {
+        size_t calls = 0;          ///< Number of evaluations of the function.
+        size_t cellsScanned = 0;   ///< Number of range cells visited by those evaluations.
+    };
+
+    static constexpr size_t DEPTH_BUCKETS = 8; ///< Buckets 0, 1, 2-3, 4-7, ..., 32-63 and 64+.
+
+    OperationStats setCell, setCells, getValue, getColumnValues, copyRect, load, save, parse, importCSV, exportCSV;
+    size_t referenceEvaluations = 0;           ///< Cells evaluated through Reference::evaluate.
+    size_t rangeCellsScanned = 0;              ///< Range cells visited by all functions.
+    std::map<std::string, FunctionStats> functions; ///< Per-function scan volumes.
+    size_t columnPlanHits = 0, columnPlanMisses = 0; ///< Lookups in the columnar plan cache.
+    size_t lazyCompilations = 0;               ///< Lazily loaded formulas compiled on first use.
+    std::array<size_t, DEPTH_BUCKETS> depthHistogram{}; ///< getValue calls by their deepest reference chain.
+    std::array<size_t, CELL_ERRORS> errors{};  ///< Failed formula evaluations, indexed by CellError.
+
+    /**
+     * @brief Returns the fraction of columnar plan lookups served from the cache.
+     *
+     * @return double The hit rate between 0 and 1, or 0 if there were no lookups.
+     */
+    double columnPlanHitRate() const;
+
+    /**
+     * @brief Resets all counters and timers to zero.
+     */
+    void reset();
+
+    /**
+     * @brief Adds the counters and timers of another statistics object to this one.
+     *
+     * @param other The statistics to add.
+     */
+    void merge(const EvaluationStats &other);
+
+    /**
+     * @brief Writes a human readable summary of the statistics.
+     *
+     * @param os The output stream to write the summary to.
+     */
+    void print(std::ostream &os) const;
+};
+
+/**
+ * @class StatsCollector
+ * @brief The statistics of one spreadsheet, recorded by every thread into a shard of its own.
+ *
+ * A finished operation adds its counters to the shard of its thread, under the shard's
+ * lock, which only total and reset contend for; operations running concurrently on other
+ * threads never wait for each other.
+ */
+class StatsCollector {
+public:
+    StatsCollector();
+
+    /**
+     * @brief Copies the total of another collector, as the statistics of the calling thread.
+     */
+    StatsCollector(const StatsCollector &other);
+    StatsCollector &operator=(const StatsCollector &other);
+
+    /**
+     * @brief Adds statistics recorded on the calling thread.
+     */
+    void add(const EvaluationStats &stats);
+
+    /**
+     * @brief Returns the sum of the statistics of all threads.
+     *
+     * The result is rebuilt by every call; the reference stays valid until the next one.
+     */
+    const EvaluationStats &total() const;
+
+    /**
+     * @brief Resets the statistics of all threads to zero.
+     */
+    void reset();
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        EvaluationStats stats;
+    };
+
+    Shard &shard();
+
+    uint64_t id;                   ///< Never reused, so the shard cached by a thread is never mistaken for another's.
+    mutable std::mutex shardsMutex; ///< Guards the list of shards and the total.
+    std::unordered_map<std::thread::id, std::unique_ptr<Shard>> shards; ///< The shard of each thread that recorded.
+    mutable EvaluationStats sum;   ///< The last total.
+};
+
+#ifdef EXCEL_ENABLE_STATS
+
+/**
+ * @class StatsScope
+ * @brief Attributes the work done by one public operation to a statistics object.
+ *
+ * While a scope is alive, the hooks in the evaluator (EXCEL_STATS, StatsDepthGuard)
+ * update the statistics of the spreadsheet that opened it. The time spent in the
+ * scope is added to the given operation when the scope ends.
+ *
+ * The outermost scope of a thread collects into a private buffer (shared with the
+ * scopes nested in it) and adds the buffer to the thread's shard of the spreadsheet's
+ * statistics when it ends, so operations running concurrently on one sheet, such as
+ * getValue calls, never update the same counters at the same time.
+ */
+class StatsScope {
+public:
+    StatsScope(StatsCollector &stats, EvaluationStats::OperationStats EvaluationStats::*operation);
+    ~StatsScope();
+
+    StatsScope(const StatsScope &) = delete;
+    StatsScope &operator=(const StatsScope &) = delete;
+
+    /**
+     * @brief Returns the statistics of the innermost active scope on this thread, if any.
+     */
+    static EvaluationStats *current() { return active; }
+
+private:
+    friend class StatsDepthGuard;
+
+    StatsCollector &stats;
+    EvaluationStats *buffer;      ///< Where the hooks record: local, or the buffer of the enclosing scope.
+    EvaluationStats local;        ///< The private buffer of an outermost scope.
+    EvaluationStats::OperationStats EvaluationStats::*operation;
+    std::chrono::steady_clock::time_point start;
+    StatsScope *previous;         ///< The enclosing scope, restored when this one ends.
+    size_t depth = 0, maxDepth = 0; ///< Current and deepest reference nesting inside this scope.
+
+    static thread_local EvaluationStats *active;
+    static thread_local StatsScope *innermost;
+};
+
+/**
+ * @class StatsDepthGuard
+ * @brief Tracks the nesting depth of reference evaluation for the depth histogram.
+ */
+class StatsDepthGuard {
+public:
+    StatsDepthGuard();
+    ~StatsDepthGuard();
+
+    StatsDepthGuard(const StatsDepthGuard &) = delete;
+    StatsDepthGuard &operator=(const StatsDepthGuard &) = delete;
+
+private:
+    StatsScope *scope;
+};
+
+// Runs the statement with `excelStats` bound to the active statistics, if there are any.
+#define EXCEL_STATS(statement) do { if (EvaluationStats *excelStats = StatsScope::current()) { statement; } } while (0)
+
+#else
+
+class StatsScope {
+public:
+    StatsScope(StatsCollector &, EvaluationStats::OperationStats EvaluationStats::*) {}
+    static EvaluationStats *current() { return nullptr; }
+};
+
+class StatsDepthGuard {
+public:
+    StatsDepthGuard() {}
+};
+
+#define EXCEL_STATS(statement) do {} while (0)
+
+#endif // EXCEL_ENABLE_STATS
+
+#endif // EVALUATION_STATS_H
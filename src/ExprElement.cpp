@@ -1,40 +1,72 @@
 #include "ExprElement.h"
-
-// Evaluates a stack of expression elements
-static CValue evaluateExpression(const std::stack<std::shared_ptr<ExprElement>> &exprStack,
-                                 const std::unordered_map<size_t, CustomCValue> &sheet,
-                                 std::unordered_set<size_t> &evaluationPath) {
-    // Reverse the stack for correct evaluation order
-    std::stack<std::shared_ptr<ExprElement>> copyExprStack;
-    auto tempStack = exprStack;
-    while (!tempStack.empty()) {
-        copyExprStack.push(tempStack.top());
-        tempStack.pop();
+#include "CellReference.h"
+#include "ExprOptimizer.h"
+#include "MemoryUsage.h"
+
+// Evaluates a stack of expression elements referenced from another formula
+static CValue evaluateExpression(const ExprStack &exprStack,
+                                 const CellStore &sheet,
+                                 EvaluationContext &context) {
+    context.checkCancelled();
+    StatsDepthGuard depthGuard;
+    // The elements are stored in evaluation order.
+    std::stack<CValue> evalStack;
+    for (const auto &element : exprElements(exprStack)) {
+        element->evaluate(evalStack, sheet, context);
+        if (context.error != CellError::None) break;
+    }
+    if (context.error == CellError::None && evalStack.size() != 1) {
+        context.error = CellError::Name;
+    }
+    if (context.error != CellError::None) {
+        // The formula fails as a whole; the formulas referencing it see an undefined value.
+        EXCEL_STATS(++excelStats->errors[static_cast<size_t>(context.error)]);
+        context.error = CellError::None;
+        return CValue();
     }
+    return evalStack.top();
+}
 
-    std::stack<CValue> evalStack;
-    while (!copyExprStack.empty()) {
-        auto element = copyExprStack.top();
-        copyExprStack.pop();
-        try {
-            element->evaluate(evalStack, sheet, evaluationPath);
-        } catch (const std::exception &e) {
-            return CValue(); // Return error value on exception
+// Renders a number exactly: the shortest form that reads back to the same value.
+static std::string exactNumber(double value) {
+    char buffer[32];
+    auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return std::string(buffer, end);
+}
+
+size_t exprContainerMemoryUsage(const ExprStack &exprStack) {
+    // Short expressions are stored inside the stack object itself.
+    const auto &elements = exprElements(exprStack);
+    return elements.isInline() ? 0 : elements.capacity() * sizeof(std::shared_ptr<ExprElement>);
+}
+
+ExprStack relocateFormula(const ExprStack &formula, const CPos &offset) {
+    ExprStack::container_type elements = exprElements(LazyFormula::expand(formula));
+    for (auto &element : elements) {
+        if (auto moved = element->relocated(offset)) {
+            element = std::move(moved);
         }
     }
+    return ExprStack(std::move(elements));
+}
 
-    if (evalStack.size() != 1) {
-        throw std::runtime_error("Invalid expression: more than one value remains after evaluation");
+std::string savedFormula(const ExprStack &formula) {
+    std::string saved = "[";
+    const auto &elements = exprElements(formula);
+    for (size_t i = 0; i < elements.size(); ++i) {
+        if (i > 0) saved += ", ";
+        saved += elements[i]->save();
     }
-
-    return evalStack.top();
+    return saved + "]";
 }
 
 // Implementation for Constant class
 Constant::Constant(double val) : value(val) {}
 
-void Constant::evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                        std::unordered_set<size_t> &evaluationPath) const {
+double Constant::getValue() const { return value; }
+
+void Constant::evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                        EvaluationContext &context) const {
     evalStack.push(value);
 }
 
@@ -42,12 +74,20 @@ std::string Constant::save() const {
     return "Constant " + std::to_string(value);
 }
 
+std::string Constant::identity() const {
+    return "Constant " + exactNumber(value);
+}
+
+size_t Constant::memoryUsage() const {
+    return sizeof(*this);
+}
+
 // Implementation for StringVariable class
 StringVariable::StringVariable(std::string name) : name(std::move(name)) {}
 
 void StringVariable::evaluate(std::stack<CValue> &evalStack,
-                              const std::unordered_map<size_t, CustomCValue> &sheet,
-                              std::unordered_set<size_t> &evaluationPath) const {
+                              const CellStore &sheet,
+                              EvaluationContext &context) const {
     evalStack.push(name);
 }
 
@@ -63,6 +103,10 @@ std::string StringVariable::save() const {
     return "String \"" + escapedName + "\"";
 }
 
+size_t StringVariable::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(name);
+}
+
 // Implementation for BinaryOperation class
 BinaryOperation::BinaryOperation(std::string op) : op(std::move(op)) {}
 
@@ -72,11 +116,16 @@ std::string BinaryOperation::save() const {
     return "BinaryOperation " + op;
 }
 
+size_t BinaryOperation::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(op);
+}
+
 void BinaryOperation::evaluate(std::stack<CValue> &evalStack,
-                               const std::unordered_map<size_t, CustomCValue> & /*sheet*/,
-                               std::unordered_set<size_t> &evaluationPath) const {
+                               const CellStore & /*sheet*/,
+                               EvaluationContext &context) const {
     if (evalStack.size() < 2) {
-        throw std::runtime_error("Insufficient operands for binary operation");
+        context.error = CellError::Name;
+        return;
     }
 
     auto rightValue = evalStack.top();
@@ -86,7 +135,10 @@ void BinaryOperation::evaluate(std::stack<CValue> &evalStack,
 
     CValue result = perform(op, leftValue, rightValue);
     if (std::holds_alternative<std::monostate>(result)) {
-        throw std::runtime_error("Invalid operation or operand types");
+        bool divisionByZero = op == "/" && std::holds_alternative<double>(leftValue)
+                              && std::holds_alternative<double>(rightValue) && std::get<double>(rightValue) == 0;
+        context.error = divisionByZero ? CellError::Div0 : CellError::Value;
+        return;
     }
     evalStack.push(result);
 }
@@ -94,10 +146,12 @@ void BinaryOperation::evaluate(std::stack<CValue> &evalStack,
 CValue BinaryOperation::perform(const std::string &op, const CValue &left, const CValue &right) const {
     if (op == "+") {
         if (std::holds_alternative<std::string>(left) || std::holds_alternative<std::string>(right)) {
-            std::string leftStr = std::holds_alternative<std::string>(left) ? std::get<std::string>(left)
-                                                                            : std::to_string(std::get<double>(left));
-            std::string rightStr = std::holds_alternative<std::string>(right) ? std::get<std::string>(right)
-                                                                              : std::to_string(std::get<double>(right));
+            // An undefined operand, as left by a failed formula, makes the concatenation fail too.
+            const double *leftNum = std::get_if<double>(&left), *rightNum = std::get_if<double>(&right);
+            if (!leftNum && !std::holds_alternative<std::string>(left)) return std::monostate();
+            if (!rightNum && !std::holds_alternative<std::string>(right)) return std::monostate();
+            std::string leftStr = leftNum ? std::to_string(*leftNum) : std::get<std::string>(left);
+            std::string rightStr = rightNum ? std::to_string(*rightNum) : std::get<std::string>(right);
             return leftStr + rightStr;
         } else if (std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
             return std::get<double>(left) + std::get<double>(right);
@@ -145,21 +199,25 @@ std::string UnaryOperation::save() const {
     return "UnaryOperation " + op;
 }
 
+size_t UnaryOperation::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(op);
+}
+
 void UnaryOperation::evaluate(std::stack<CValue> &evalStack,
-                              const std::unordered_map<size_t, CustomCValue> &sheet,
-                              std::unordered_set<size_t> &evaluationPath) const {
+                              const CellStore &sheet,
+                              EvaluationContext &context) const {
     if (evalStack.empty()) {
-        throw std::runtime_error("No operand for unary operation");
+        context.error = CellError::Name;
+        return;
     }
-    CValue topValue = evalStack.top();
-    evalStack.pop();
-    double operand;
-    try {
-        operand = std::get<double>(topValue);
-    } catch (const std::bad_variant_access &) {
-        throw std::runtime_error("Operand for unary operation is not a number.");
+    auto operand = std::get_if<double>(&evalStack.top());
+    if (!operand || op != "-") {
+        context.error = operand ? CellError::Name : CellError::Value;
+        return;
     }
-    evalStack.push(apply(op, operand));
+    double result = apply(op, *operand);
+    evalStack.pop();
+    evalStack.push(result);
 }
 
 double UnaryOperation::apply(const std::string &op, double value) const {
@@ -168,11 +226,24 @@ double UnaryOperation::apply(const std::string &op, double value) const {
 }
 
 // Implementation for Range class
-Range::Range(std::string rangeRef) : rangeRef(std::move(rangeRef)) {}
+Range::Range(std::string rangeRef) : rangeRef(std::move(rangeRef)), start(0, 0), end(0, 0), valid(false) {
+    CellReference first, last;
+    if (parseCellRange(this->rangeRef, first, last)) {
+        start = CPos(first.column, first.row);
+        end = CPos(last.column, last.row);
+        valid = true;
+    }
+}
+
+const CPos &Range::getStart() const { return start; }
+
+const CPos &Range::getEnd() const { return end; }
+
+bool Range::isValid() const { return valid; }
 
 void Range::evaluate(std::stack<CValue> &evalStack,
-                     const std::unordered_map<size_t, CustomCValue> &sheet,
-                     std::unordered_set<size_t> &evaluationPath) const {
+                     const CellStore &sheet,
+                     EvaluationContext &context) const {
     evalStack.push(rangeRef);
 }
 
@@ -180,53 +251,99 @@ std::string Range::save() const {
     return "Range " + rangeRef;
 }
 
+size_t Range::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(rangeRef);
+}
+
 // Implementation for FunctionCall class
 FunctionCall::FunctionCall(std::string fnName, size_t paramCount)
         : functionName(std::move(fnName)), parameterCount(paramCount) {}
 
+size_t FunctionCall::getParameterCount() const { return parameterCount; }
+
+size_t FunctionCall::getStackParameterCount() const { return boundRange ? parameterCount - 1 : parameterCount; }
+
+std::shared_ptr<FunctionCall> FunctionCall::bindRange(std::shared_ptr<const Range> range) const {
+    size_t rangeIndex = functionName == "countval" ? 1 : 0;
+    bool takesRange = functionName == "sum" || functionName == "count" || functionName == "min"
+                      || functionName == "max" || functionName == "countval";
+    if (boundRange || !takesRange || parameterCount != rangeIndex + 1) {
+        return nullptr;
+    }
+    auto bound = std::make_shared<FunctionCall>(*this);
+    bound->boundRange = std::move(range);
+    return bound;
+}
+
 std::string FunctionCall::save() const {
-    return "Function " + functionName + " " + std::to_string(parameterCount);
+    std::string saved = "Function " + functionName + " " + std::to_string(parameterCount);
+    return boundRange ? boundRange->save() + ", " + saved : saved;
+}
+
+size_t FunctionCall::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(functionName) + (boundRange ? boundRange->memoryUsage() : 0);
 }
 
 void FunctionCall::evaluate(std::stack<CValue> &evalStack,
-                            const std::unordered_map<size_t, CustomCValue> &sheet,
-                            std::unordered_set<size_t> &evaluationPath) const {
-    if (evalStack.size() < parameterCount) {
-        throw std::runtime_error("Not enough parameters for function call");
+                            const CellStore &sheet,
+                            EvaluationContext &context) const {
+    size_t stackParameterCount = getStackParameterCount();
+    if (evalStack.size() < stackParameterCount) {
+        context.error = CellError::Name;
+        return;
     }
 
     std::vector<CValue> params;
-    for (size_t i = 0; i < parameterCount; ++i) {
+    for (size_t i = 0; i < stackParameterCount; ++i) {
         params.push_back(evalStack.top());
         evalStack.pop();
     }
     std::reverse(params.begin(), params.end());
 
-    if (functionName != "countval" && functionName != "if" && !std::holds_alternative<std::string>(params[0])) {
-        throw std::runtime_error(functionName + " function expects a range parameter");
+    if (!boundRange && functionName != "countval" && functionName != "if"
+        && (params.empty() || !std::holds_alternative<std::string>(params[0]))) {
+        context.error = CellError::Value;
+        return;
     }
     CPos start(0, 0);
     CPos end(0, 0);
 
-    auto removeDollarInRange = [](const std::string &ref) -> std::string {
-        std::string cleanedRef;
-        std::copy_if(ref.begin(), ref.end(), std::back_inserter(cleanedRef), [](char c) { return c != '$'; });
-        return cleanedRef;
-    };
-
+    EXCEL_STATS(++excelStats->functions[functionName].calls);
     if (functionName != "if") {
-        std::string rangeStr = (functionName != "countval" ? std::get<std::string>(params[0])
-                                                           : std::get<std::string>(params[1]));
-        auto posDelimiter = rangeStr.find(':');
-        if (posDelimiter == std::string::npos) {
-            throw std::runtime_error("Invalid range format");
+        if (boundRange) {
+            if (!boundRange->isValid()) {
+                context.error = CellError::Ref;
+                return;
+            }
+            start = boundRange->getStart();
+            end = boundRange->getEnd();
+        } else {
+            // The range operand was not bound when the formula was built; parse it now.
+            size_t rangeParameter = functionName != "countval" ? 0 : 1;
+            auto rangeStr = rangeParameter < params.size() ? std::get_if<std::string>(&params[rangeParameter]) : nullptr;
+            CellReference first, last;
+            if (!rangeStr) {
+                context.error = CellError::Value;
+                return;
+            }
+            if (!parseCellRange(*rangeStr, first, last)) {
+                context.error = CellError::Ref;
+                return;
+            }
+            start = CPos(first.column, first.row);
+            end = CPos(last.column, last.row);
         }
 
-        std::string startStr = removeDollarInRange(rangeStr.substr(0, posDelimiter));
-        std::string endStr = removeDollarInRange(rangeStr.substr(posDelimiter + 1));
-
-        start = CPos(startStr);
-        end = CPos(endStr);
+        EXCEL_STATS(
+                size_t scanned = end.getRow() >= start.getRow() && end.getColumn() >= start.getColumn()
+                                 ? (end.getRow() - start.getRow() + 1) * (end.getColumn() - start.getColumn() + 1) : 0;
+                excelStats->rangeCellsScanned += scanned;
+                excelStats->functions[functionName].cellsScanned += scanned);
+        if (end.getRow() >= start.getRow() && end.getColumn() >= start.getColumn()) {
+            size_t visited = (end.getRow() - start.getRow() + 1) * (end.getColumn() - start.getColumn() + 1);
+            EvaluationProfiler::countVisits(visited);
+            context.work += visited;
+        }
     }
     if (functionName == "sum") {
         double sum = 0;
@@ -234,14 +351,15 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
         for (size_t r = start.getRow(); r <= end.getRow(); ++r) {
             for (size_t c = start.getColumn(); c <= end.getColumn(); ++c) {
                 CPos pos(c, r);
-                auto it = sheet.find(pos.getUniqueId());
-                if (it != sheet.end() && std::holds_alternative<double>(it->second)) {
-                    sum += std::get<double>(it->second);
+                auto cell = sheet.find(pos.getUniqueId());
+                if (cell && std::holds_alternative<double>(*cell)) {
+                    sum += std::get<double>(*cell);
                     hasNumeric = true;
-                } else if (it != sheet.end() &&
-                           std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(it->second)) {
-                    const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(it->second);
-                    CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
+                } else if (cell &&
+                           std::holds_alternative<ExprStack>(*cell)) {
+                    const auto &exprStack = std::get<ExprStack>(*cell);
+                    EvaluationProfiler::Frame profileFrame(pos.getUniqueId());
+                    CValue result = evaluateExpression(exprStack, sheet, context);
                     if (std::holds_alternative<double>(result)) {
                         sum += std::get<double>(result);
                         hasNumeric = true;
@@ -250,7 +368,8 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
             }
         }
         if (!hasNumeric) {
-            throw std::runtime_error("No numeric values found in the range for sum computation");
+            context.error = CellError::Num;
+            return;
         }
         evalStack.push(sum);
     } else if (functionName == "count") {
@@ -258,11 +377,12 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
         for (size_t r = start.getRow(); r <= end.getRow(); ++r) {
             for (size_t c = start.getColumn(); c <= end.getColumn(); ++c) {
                 CPos pos(c, r);
-                auto it = sheet.find(pos.getUniqueId());
-                if (it != sheet.end() && !std::holds_alternative<std::monostate>(it->second)) {
-                    if (std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(it->second)) {
-                        const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(it->second);
-                        CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
+                auto cell = sheet.find(pos.getUniqueId());
+                if (cell && !std::holds_alternative<std::monostate>(*cell)) {
+                    if (std::holds_alternative<ExprStack>(*cell)) {
+                        const auto &exprStack = std::get<ExprStack>(*cell);
+                        EvaluationProfiler::Frame profileFrame(pos.getUniqueId());
+                        CValue result = evaluateExpression(exprStack, sheet, context);
                         if (!std::holds_alternative<std::monostate>(result))
                             count++;
                     } else
@@ -276,16 +396,17 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
         for (size_t r = start.getRow(); r <= end.getRow(); ++r) {
             for (size_t c = start.getColumn(); c <= end.getColumn(); ++c) {
                 CPos pos(c, r);
-                auto it = sheet.find(pos.getUniqueId());
-                if (it != sheet.end() && std::holds_alternative<double>(it->second)) {
-                    double val = std::get<double>(it->second);
+                auto cell = sheet.find(pos.getUniqueId());
+                if (cell && std::holds_alternative<double>(*cell)) {
+                    double val = std::get<double>(*cell);
                     if (!minVal || val < *minVal) {
                         minVal = val;
                     }
-                } else if (it != sheet.end() &&
-                           std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(it->second)) {
-                    const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(it->second);
-                    CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
+                } else if (cell &&
+                           std::holds_alternative<ExprStack>(*cell)) {
+                    const auto &exprStack = std::get<ExprStack>(*cell);
+                    EvaluationProfiler::Frame profileFrame(pos.getUniqueId());
+                    CValue result = evaluateExpression(exprStack, sheet, context);
                     if (std::holds_alternative<double>(result)) {
                         double val = std::get<double>(result);
                         if (!minVal || val < *minVal) {
@@ -295,26 +416,27 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
                 }
             }
         }
-        if (minVal) {
-            evalStack.push(*minVal);
-        } else {
-            throw std::runtime_error("No numeric values found for min function");
+        if (!minVal) {
+            context.error = CellError::Num;
+            return;
         }
+        evalStack.push(*minVal);
     } else if (functionName == "max") {
         std::optional<double> maxVal;
         for (size_t r = start.getRow(); r <= end.getRow(); ++r) {
             for (size_t c = start.getColumn(); c <= end.getColumn(); ++c) {
                 CPos pos(c, r);
-                auto it = sheet.find(pos.getUniqueId());
-                if (it != sheet.end() && std::holds_alternative<double>(it->second)) {
-                    double val = std::get<double>(it->second);
+                auto cell = sheet.find(pos.getUniqueId());
+                if (cell && std::holds_alternative<double>(*cell)) {
+                    double val = std::get<double>(*cell);
                     if (!maxVal || val > *maxVal) {
                         maxVal = val;
                     }
-                } else if (it != sheet.end() &&
-                           std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(it->second)) {
-                    const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(it->second);
-                    CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
+                } else if (cell &&
+                           std::holds_alternative<ExprStack>(*cell)) {
+                    const auto &exprStack = std::get<ExprStack>(*cell);
+                    EvaluationProfiler::Frame profileFrame(pos.getUniqueId());
+                    CValue result = evaluateExpression(exprStack, sheet, context);
                     if (std::holds_alternative<double>(result)) {
                         double val = std::get<double>(result);
                         if (!maxVal || val > *maxVal) {
@@ -324,31 +446,33 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
                 }
             }
         }
-        if (maxVal) {
-            evalStack.push(*maxVal);
-        } else {
-            throw std::runtime_error("No numeric values found for max function");
+        if (!maxVal) {
+            context.error = CellError::Num;
+            return;
         }
+        evalStack.push(*maxVal);
     } else if (functionName == "countval") {
         if (parameterCount != 2) {
-            throw std::runtime_error("countval expects two parameters");
+            context.error = CellError::Name;
+            return;
         }
         CValue valueToMatch = params[0];
         size_t count = 0;
         for (size_t r = start.getRow(); r <= end.getRow(); ++r) {
             for (size_t c = start.getColumn(); c <= end.getColumn(); ++c) {
                 CPos pos(c, r);
-                auto it = sheet.find(pos.getUniqueId());
-                if (it != sheet.end()) {
-                    const auto &cellValue = it->second;
+                auto cell = sheet.find(pos.getUniqueId());
+                if (cell) {
+                    const auto &cellValue = *cell;
                     if (std::holds_alternative<double>(cellValue) && std::holds_alternative<double>(valueToMatch)) {
                         count += (std::get<double>(cellValue) == std::get<double>(valueToMatch));
-                    } else if (std::holds_alternative<std::string>(cellValue) &&
+                    } else if (std::holds_alternative<InlineString>(cellValue) &&
                                std::holds_alternative<std::string>(valueToMatch)) {
-                        count += (std::get<std::string>(cellValue) == std::get<std::string>(valueToMatch));
-                    } else if (std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(cellValue)) {
-                        const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(cellValue);
-                        CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
+                        count += (std::get<InlineString>(cellValue).view() == std::get<std::string>(valueToMatch));
+                    } else if (std::holds_alternative<ExprStack>(cellValue)) {
+                        const auto &exprStack = std::get<ExprStack>(cellValue);
+                        EvaluationProfiler::Frame profileFrame(pos.getUniqueId());
+                        CValue result = evaluateExpression(exprStack, sheet, context);
                         if (std::holds_alternative<double>(result) &&
                             std::holds_alternative<double>(valueToMatch)) {
                             count += (std::get<double>(result) == std::get<double>(valueToMatch));
@@ -363,18 +487,201 @@ void FunctionCall::evaluate(std::stack<CValue> &evalStack,
         evalStack.push(static_cast<double>(count));
     } else if (functionName == "if") {
         if (parameterCount != 3) {
-            throw std::runtime_error("Invalid parameter count for if function");
+            context.error = CellError::Name;
+            return;
         }
-        bool condition = false;
-        if (auto cond = std::get_if<double>(&params[0])) {
-            condition = *cond != 0.0;
-        } else {
-            throw std::runtime_error("Conditional expression in 'if' did not evaluate to a numeric type.");
+        auto condition = std::get_if<double>(&params[0]);
+        if (!condition) {
+            context.error = CellError::Value;
+            return;
         }
-        evalStack.push(condition ? params[1] : params[2]);
+        evalStack.push(*condition != 0.0 ? params[1] : params[2]);
     } else {
-        throw std::runtime_error("Unknown function call");
+        context.error = CellError::Name;
+    }
+}
+
+// Implementation for FoldedConstant class
+FoldedConstant::FoldedConstant(CValue val, std::string original)
+        : value(std::move(val)), original(std::move(original)) {}
+
+const CValue &FoldedConstant::getValue() const { return value; }
+
+void FoldedConstant::evaluate(std::stack<CValue> &evalStack,
+                              const CellStore & /*sheet*/,
+                              EvaluationContext & /*context*/) const {
+    evalStack.push(value);
+}
+
+std::string FoldedConstant::save() const {
+    return original;
+}
+
+std::string FoldedConstant::identity() const {
+    // The saved form renders the folded constants in decimal, so it may not tell values apart.
+    if (std::holds_alternative<double>(value)) {
+        return original + " = " + exactNumber(std::get<double>(value));
+    } else if (std::holds_alternative<std::string>(value)) {
+        return original + " = \"" + std::get<std::string>(value);
+    }
+    return original + " = undefined";
+}
+
+size_t FoldedConstant::memoryUsage() const {
+    size_t bytes = sizeof(*this) + MemoryUsage::heapBytes(original);
+    if (std::holds_alternative<std::string>(value)) {
+        bytes += MemoryUsage::heapBytes(std::get<std::string>(value));
+    }
+    return bytes;
+}
+
+// Implementation for NumericIdentity class
+NumericIdentity::NumericIdentity(std::string original) : original(std::move(original)) {}
+
+void NumericIdentity::evaluate(std::stack<CValue> &evalStack,
+                               const CellStore & /*sheet*/,
+                               EvaluationContext &context) const {
+    if (evalStack.empty() || !std::holds_alternative<double>(evalStack.top())) {
+        context.error = CellError::Value;
+    }
+}
+
+std::string NumericIdentity::save() const {
+    return original;
+}
+
+size_t NumericIdentity::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(original);
+}
+
+// Implementation for LazyFormula class
+LazyFormula::LazyFormula(std::string source, const CPos &offset) : source(std::move(source)), offset(offset) {}
+
+ExprStack LazyFormula::compile(const std::string &source) {
+    std::stringstream ss(source);
+    ExprStack exprStack;
+    std::string element;
+
+    while (getline(ss, element, ',')) {
+        element.erase(0, element.find_first_not_of(" "));
+        if (element.back() == ']') {
+            element.pop_back();
+        }
+
+        std::stringstream elemStream(element);
+        std::string type;
+        elemStream >> type >> std::ws;
+
+        if (type == "Reference") {
+            std::string value;
+            elemStream >> value;
+            exprStack.push(std::make_shared<Reference>(value));
+        } else if (type == "Constant") {
+            double value;
+            elemStream >> value;
+            exprStack.push(std::make_shared<Constant>(value));
+        } else if (type == "UnaryOperation") {
+            std::string op;
+            elemStream >> op;
+            exprStack.push(std::make_shared<UnaryOperation>(op));
+        } else if (type == "BinaryOperation") {
+            std::string op;
+            elemStream >> op;
+            exprStack.push(std::make_shared<BinaryOperation>(op));
+        } else if (type == "String") {
+            // The text lies between the first and the last quote, and a doubled quote stands for one.
+            size_t open = element.find('"'), close = element.rfind('"');
+            std::string content;
+            for (size_t i = open + 1; open != std::string::npos && i < close; ++i) {
+                content += element[i];
+                if (element[i] == '"') ++i;
+            }
+            exprStack.push(std::make_shared<StringVariable>(std::move(content)));
+        } else if (type == "Range") {
+            std::string range;
+            elemStream >> range;
+            exprStack.push(std::make_shared<Range>(range));
+        } else if (type == "Function") {
+            std::string functionName;
+            double paramCount;
+            elemStream >> functionName >> paramCount;
+            exprStack.push(std::make_shared<FunctionCall>(functionName, paramCount));
+        }
+    }
+    return ExprOptimizer::optimize(exprStack);
+}
+
+const ExprStack &LazyFormula::expand(const ExprStack &exprStack) {
+    if (exprStack.size() == 1) {
+        if (auto lazy = dynamic_cast<const LazyFormula *>(exprStack.top().get())) {
+            return lazy->getExpression();
+        }
+    }
+    return exprStack;
+}
+
+ExprStack LazyFormula::relocated(const ExprStack &exprStack, const CPos &offset) {
+    if (exprStack.size() == 1) {
+        if (auto lazy = dynamic_cast<const LazyFormula *>(exprStack.top().get())) {
+            CPos moved(static_cast<uint32_t>(lazy->offset.getColumn() + offset.getColumn()),
+                       static_cast<uint32_t>(lazy->offset.getRow() + offset.getRow()));
+            return ExprStack({std::make_shared<LazyFormula>(lazy->source, moved)});
+        }
     }
+    return relocateFormula(exprStack, offset);
+}
+
+const ExprStack &LazyFormula::getExpression() const {
+    std::call_once(compiled, [this] {
+        expression = compile(source);
+        if (offset.getUniqueId() != 0) {
+            expression = relocateFormula(expression, offset);
+        }
+        EXCEL_STATS(++excelStats->lazyCompilations);
+    });
+    return expression;
+}
+
+void LazyFormula::evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                           EvaluationContext &context) const {
+    const ExprStack *expression;
+    try {
+        expression = &getExpression();
+    } catch (const std::exception &) {
+        // Only a damaged file holds a saved formula that does not compile.
+        context.error = CellError::Name;
+        return;
+    }
+    // The compiled elements are evaluated in place, as if they were stored in the cell.
+    for (const auto &element: exprElements(*expression)) {
+        element->evaluate(evalStack, sheet, context);
+        if (context.error != CellError::None) return;
+    }
+}
+
+std::string LazyFormula::save() const {
+    if (offset.getUniqueId() == 0) {
+        return source;
+    }
+    // A moved formula has no saved form of its own until it is compiled.
+    try {
+        std::string saved = savedFormula(getExpression());
+        return saved.substr(1, saved.size() - 2);
+    } catch (const std::exception &) {
+        return source;
+    }
+}
+
+size_t LazyFormula::memoryUsage() const {
+    // The compiled expression, if any, is owned by this element alone.
+    size_t bytes = sizeof(*this) + MemoryUsage::heapBytes(source);
+    if (!expression.empty()) {
+        bytes += exprContainerMemoryUsage(expression);
+        for (const auto &element : exprElements(expression)) {
+            bytes += element->memoryUsage();
+        }
+    }
+    return bytes;
 }
 
 // Implementation for Reference class
@@ -386,66 +693,93 @@ std::string Reference::save() const {
     return "Reference " + cellReference;
 }
 
-void Reference::evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                         std::unordered_set<size_t> &evaluationPath) const {
+size_t Reference::memoryUsage() const {
+    return sizeof(*this) + MemoryUsage::heapBytes(cellReference);
+}
+
+void Reference::evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                         EvaluationContext &context) const {
     CPos position(column, row);
-    auto it = sheet.find(position.getUniqueId());
-    if (it == sheet.end()) {
-        throw std::runtime_error("Reference not found in spreadsheet context.");
+    EXCEL_STATS(++excelStats->referenceEvaluations);
+    EvaluationProfiler::countVisits(1);
+    ++context.work;
+    auto cell = sheet.find(position.getUniqueId());
+    if (!cell) {
+        context.error = CellError::Ref;
+        return;
     }
 
-    const auto &value = it->second;
+    const auto &value = *cell;
     if (std::holds_alternative<double>(value)) {
         evalStack.push(std::get<double>(value));
-    } else if (std::holds_alternative<std::string>(value)) {
-        evalStack.push(std::get<std::string>(value));
-    } else if (std::holds_alternative<std::stack<std::shared_ptr<ExprElement>>>(value)) {
-        if (!evaluationPath.insert(position.getUniqueId()).second) {
-            evaluationPath.clear();
-            throw std::runtime_error("Cyclic dependency detected!");
+    } else if (std::holds_alternative<InlineString>(value)) {
+        evalStack.push(std::get<InlineString>(value).str());
+    } else if (std::holds_alternative<ExprStack>(value)) {
+        if (context.memo) {
+            auto known = context.memo->find(position.getUniqueId());
+            if (known != context.memo->end()) {
+                evalStack.push(known->second);
+                return;
+            }
+        }
+        context.checkSuspended(position.getUniqueId());
+        if (!context.evaluationPath.insert(position.getUniqueId()).second) {
+            context.evaluationPath.clear();
+            context.cycleDetected = true;
+            context.error = CellError::Cycle;
+            return;
+        }
+        const auto &exprStack = std::get<ExprStack>(value);
+        EvaluationProfiler::Frame profileFrame(position.getUniqueId());
+        CValue result = evaluateExpression(exprStack, sheet, context);
+        context.evaluationPath.erase(position.getUniqueId());
+        if (context.memo) {
+            context.memoCandidates.emplace_back(position.getUniqueId(), result);
         }
-        const auto &exprStack = std::get<std::stack<std::shared_ptr<ExprElement>>>(value);
-        CValue result = evaluateExpression(exprStack, sheet, evaluationPath);
-        evaluationPath.erase(position.getUniqueId());
         evalStack.push(result);
     } else {
-        throw std::runtime_error("Unexpected cell content encountered during evaluation.");
+        // An empty cell, as a missing one.
+        context.error = CellError::Ref;
     }
 }
 
+size_t Reference::getRow() const { return row; }
+
+size_t Reference::getColumn() const { return column; }
+
+bool Reference::isRowAbsolute() const { return isAbsoluteRow; }
+
+bool Reference::isColumnAbsolute() const { return isAbsoluteColumn; }
+
+std::shared_ptr<ExprElement> Reference::relocated(const CPos &offset) const {
+    if (isAbsoluteRow && isAbsoluteColumn) {
+        return nullptr;
+    }
+    auto moved = std::make_shared<Reference>(*this);
+    moved->moveRelativeReferencesBy(offset);
+    return moved;
+}
+
 void Reference::moveRelativeReferencesBy(const CPos &offset) {
+    // Offsets are 32-bit wrapped (see CPos), so the sums wrap the same way.
     if (!isAbsoluteRow) {
-        row += offset.getRow();
+        row = static_cast<uint32_t>(row + offset.getRow());
     }
     if (!isAbsoluteColumn) {
-        column += offset.getColumn();
+        column = static_cast<uint32_t>(column + offset.getColumn());
     }
     updateCellReferenceString();
 }
 
 void Reference::parseReference(const std::string &ref) {
-    size_t i = 0;
-    column = 0;
-    row = 0;
-    isAbsoluteColumn = false;
-    isAbsoluteRow = false;
-    if (ref[i] == '$') {
-        isAbsoluteColumn = true;
-        i++;
-    }
-    while (i < ref.size() && std::isalpha(ref[i])) {
-        column = column * 26 + (toupper(ref[i]) - 'A' + 1);
-        i++;
-    }
-    if (i < ref.size() && ref[i] == '$') {
-        isAbsoluteRow = true;
-        i++;
-    }
-    if (i < ref.size()) {
-        row = std::stoul(ref.substr(i));
-    } else {
+    CellReference reference;
+    if (!parseCellReference(ref, reference)) {
         throw std::invalid_argument("Invalid cell reference format");
     }
+    column = reference.column;
+    row = reference.row;
+    isAbsoluteColumn = reference.absoluteColumn;
+    isAbsoluteRow = reference.absoluteRow;
 }
 
 void Reference::updateCellReferenceString() {
@@ -2,12 +2,31 @@
 #define EXPR_ELEMENT_H
 
 #include "main.h"
+#include <mutex>
 #include "CPos.h"
+#include "EvaluationStats.h"
+#include "EvaluationProfiler.h"
+#include "EvaluationContext.h"
+#include "CellStore.h"
 
-class ExprElement;
+/**
+ * @brief Provides read-only access to the elements of an expression stack.
+ *
+ * The returned container is ordered from the bottom of the stack to its top, which is
+ * the order in which the elements are evaluated. No copy of the stack is made.
+ *
+ * @param exprStack The expression stack to inspect.
+ * @return const ExprStack::container_type& The underlying container.
+ */
+inline const ExprStack::container_type &exprElements(const ExprStack &exprStack) {
+    struct Access : ExprStack {
+        static const container_type &get(const ExprStack &s) { return s.*&Access::c; }
+    };
+    return Access::get(exprStack);
+}
 
-// Custom type definition for cell values, supporting various types including expressions
-using CustomCValue = std::variant<std::monostate, double, std::string, int, std::stack<std::shared_ptr<ExprElement>>>;
+class Range;
+class Reference;
 
 /**
  * @class ExprElement
@@ -25,14 +44,16 @@ public:
      * @brief Evaluates the expression element and pushes the result onto the stack.
      *
      * This method must be implemented by derived classes to evaluate the expression
-     * element and push the result onto the evaluation stack.
+     * element and push the result onto the evaluation stack. An element that cannot be
+     * evaluated sets context.error (see CellError) and returns instead of throwing; the
+     * formula it belongs to then evaluates to an undefined value.
      *
      * @param evalStack The stack used to hold evaluation results.
-     * @param sheet The map representing the spreadsheet, where cells are identified by unique IDs.
-     * @param evaluationPath A set used to track the path of evaluations to detect cyclic dependencies.
+     * @param sheet The cells of the spreadsheet, identified by unique IDs.
+     * @param context The state of the evaluation in progress, including the path used to detect cyclic dependencies.
      */
-    virtual void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                          std::unordered_set<size_t> &evaluationPath) const = 0;
+    virtual void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                          EvaluationContext &context) const = 0;
 
     /**
      * @brief Saves the expression element as a string.
@@ -43,8 +64,75 @@ public:
      * @return std::string A string representation of the expression element.
      */
     virtual std::string save() const = 0;
+
+    /**
+     * @brief Returns the element as it reads in a formula copied by the given offset.
+     *
+     * Elements that do not depend on the position of their formula return nullptr, so
+     * copies of the formula can share them.
+     *
+     * @param offset The distance the formula is copied by.
+     * @return std::shared_ptr<ExprElement> The adjusted copy, or nullptr to share this element.
+     */
+    virtual std::shared_ptr<ExprElement> relocated(const CPos & /*offset*/) const { return nullptr; }
+
+    /**
+     * @brief Returns the range of cells the element reads as a whole, if any.
+     *
+     * @return const Range* The range operand, or nullptr if the element has none.
+     */
+    virtual const Range *rangeOperand() const { return nullptr; }
+
+    /**
+     * @brief Returns the single cell the element reads, if any.
+     *
+     * @return const Reference* The reference operand, or nullptr if the element has none.
+     */
+    virtual const Reference *referenceOperand() const { return nullptr; }
+
+    /**
+     * @brief Returns the bytes occupied by the element, including the memory it owns.
+     *
+     * Elements shared with it (such as a bound range) are included; its control block is not.
+     */
+    virtual size_t memoryUsage() const = 0;
+
+    /**
+     * @brief Returns a key that is equal for elements of the same type that behave identically.
+     *
+     * Used to share identical elements between formulas. The saved form serves as the key
+     * unless it loses information, as the decimal rendering of a constant does.
+     */
+    virtual std::string identity() const { return save(); }
 };
 
+/**
+ * @brief Returns the heap bytes used by the container of an expression stack; zero if it is inline.
+ *
+ * The elements themselves are not included (see ExprElement::memoryUsage).
+ *
+ * @param exprStack The expression stack.
+ * @return size_t The bytes of the heap buffer.
+ */
+size_t exprContainerMemoryUsage(const ExprStack &exprStack);
+
+/**
+ * @brief Copies a formula to a cell moved by offset.
+ *
+ * Elements that do not depend on the position of the formula are shared with the original;
+ * only relative references are replaced. A lazily loaded formula is compiled first.
+ *
+ * @param formula The formula.
+ * @param offset The offset to move by, 32-bit wrapped (see CPos), so it may move up or left.
+ * @return ExprStack The moved formula.
+ */
+ExprStack relocateFormula(const ExprStack &formula, const CPos &offset);
+
+/**
+ * @brief Returns the saved form of a formula: its elements, bottom of the stack first, in brackets.
+ */
+std::string savedFormula(const ExprStack &formula);
+
 /**
  * @class Constant
  * @brief Represents a constant numerical value in an expression.
@@ -54,10 +142,16 @@ class Constant : public ExprElement {
 public:
     explicit Constant(double val);
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    double getValue() const;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
 
     std::string save() const override;
+
+    std::string identity() const override;
+
+    size_t memoryUsage() const override;
 };
 
 /**
@@ -69,10 +163,12 @@ class StringVariable : public ExprElement {
 public:
     explicit StringVariable(std::string name);
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
 
     std::string save() const override;
+
+    size_t memoryUsage() const override;
 };
 
 /**
@@ -87,8 +183,10 @@ public:
     std::string getOp() const;
     std::string save() const override;
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    size_t memoryUsage() const override;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
 
     CValue perform(const std::string &op, const CValue &left, const CValue &right) const;
 };
@@ -105,8 +203,10 @@ public:
     std::string getOp() const;
     std::string save() const override;
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    size_t memoryUsage() const override;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
 
     double apply(const std::string &op, double value) const;
 };
@@ -117,13 +217,23 @@ public:
  */
 class Range : public ExprElement {
     std::string rangeRef; ///< The string representation of the cell range (e.g., "A1:B2").
+    CPos start, end;      ///< The corners of the range, parsed when the range is built.
+    bool valid;           ///< False if rangeRef is not a valid range.
 public:
     explicit Range(std::string rangeRef);
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    const CPos &getStart() const;
+    const CPos &getEnd() const;
+    bool isValid() const;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
 
     std::string save() const override;
+
+    size_t memoryUsage() const override;
+
+    const Range *rangeOperand() const override { return this; }
 };
 
 /**
@@ -131,15 +241,151 @@ public:
  * @brief Represents a function call in an expression.
  */
 class FunctionCall : public ExprElement {
-    std::string functionName; ///< The name of the function.
-    size_t parameterCount;    ///< The number of parameters the function takes.
+    std::string functionName;               ///< The name of the function.
+    size_t parameterCount;                  ///< The number of parameters the function takes.
+    std::shared_ptr<const Range> boundRange; ///< The range operand bound when the formula was built, if any.
 public:
     FunctionCall(std::string fnName, size_t paramCount);
 
+    size_t getParameterCount() const;
+
+    /**
+     * @brief Gets the number of parameters taken from the evaluation stack.
+     *
+     * This is the parameter count minus one if the range operand is bound.
+     */
+    size_t getStackParameterCount() const;
+
+    /**
+     * @brief Returns a copy of the call with its range operand resolved at build time.
+     *
+     * The range must be the last parameter of a range function (sum, count, min, max,
+     * countval), so that it directly precedes the call in the expression. The bound call
+     * reads the pre-parsed bounds instead of parsing the range string on every evaluation,
+     * and saves as the range followed by the call.
+     *
+     * @param range The range operand.
+     * @return std::shared_ptr<FunctionCall> The bound call, or nullptr if the function does not take the range there.
+     */
+    std::shared_ptr<FunctionCall> bindRange(std::shared_ptr<const Range> range) const;
+    std::string save() const override;
+
+    size_t memoryUsage() const override;
+
+    const Range *rangeOperand() const override { return boundRange.get(); }
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
+};
+
+/**
+ * @class FoldedConstant
+ * @brief Represents a constant subexpression that was evaluated ahead of time.
+ *
+ * Produced by the expression optimizer when a run of constants and pure operations
+ * can be reduced to a single value. The original elements are kept in their saved
+ * form so that the spreadsheet file format does not change.
+ */
+class FoldedConstant : public ExprElement {
+    CValue value;         ///< The precomputed value of the subexpression.
+    std::string original; ///< The saved form of the elements this constant replaces.
+public:
+    FoldedConstant(CValue val, std::string original);
+
+    const CValue &getValue() const;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
+
+    std::string save() const override;
+
+    std::string identity() const override;
+
+    size_t memoryUsage() const override;
+};
+
+/**
+ * @class NumericIdentity
+ * @brief Represents an operation that leaves a numeric operand unchanged (e.g. x*1, -(-x)).
+ *
+ * Evaluation only verifies that the operand on top of the stack is a number, which keeps
+ * the error behaviour of the operation it replaces. The original elements are kept in
+ * their saved form.
+ */
+class NumericIdentity : public ExprElement {
+    std::string original; ///< The saved form of the elements this identity replaces.
+public:
+    explicit NumericIdentity(std::string original);
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
+
+    std::string save() const override;
+
+    size_t memoryUsage() const override;
+};
+
+/**
+ * @class LazyFormula
+ * @brief Represents a loaded formula that is kept in its saved form until it is first used.
+ *
+ * A lazily loaded cell holds a stack with this single element. The saved elements are
+ * compiled (and optimized) the first time the formula is evaluated or inspected; until
+ * then the cell only costs its serialized bytes. Compilation happens at most once, also
+ * when several threads use the formula concurrently. The formula saves its original bytes.
+ */
+class LazyFormula : public ExprElement {
+    std::string source;                                      ///< The saved elements, without the enclosing brackets.
+    CPos offset;                                             ///< The move applied to the relative references once compiled.
+    mutable std::once_flag compiled;                         ///< Guards the one-time compilation.
+    mutable ExprStack expression; ///< The compiled expression, once compiled.
+public:
+    explicit LazyFormula(std::string source, const CPos &offset = CPos(0, 0));
+
+    /**
+     * @brief Compiles the saved form of an expression into an optimized expression stack.
+     *
+     * @param source The saved elements, separated by commas, without the enclosing brackets.
+     * @return ExprStack The expression in evaluation order.
+     */
+    static ExprStack compile(const std::string &source);
+
+    /**
+     * @brief Returns the compiled form of an expression stack.
+     *
+     * If the stack holds a lazily loaded formula, it is compiled if needed and its
+     * expression is returned; otherwise the stack itself is returned.
+     *
+     * @param exprStack The expression stack stored in a cell.
+     * @return const ExprStack& The expression to inspect.
+     */
+    static const ExprStack &expand(const ExprStack &exprStack);
+
+    /**
+     * @brief Moves the relative references of a formula, as relocateFormula, keeping a lazy one uncompiled.
+     *
+     * A lazily loaded formula yields another lazy formula with the same saved form, which
+     * is moved when it is compiled; other formulas are relocated at once.
+     *
+     * @param exprStack The expression stack stored in a cell.
+     * @param offset The columns and rows to move by.
+     * @return ExprStack The moved formula.
+     */
+    static ExprStack relocated(const ExprStack &exprStack, const CPos &offset);
+
+    /**
+     * @brief Returns the compiled expression, compiling it on first use.
+     *
+     * @throws std::exception If the saved form is malformed.
+     */
+    const ExprStack &getExpression() const;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
+
     std::string save() const override;
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    size_t memoryUsage() const override;
 };
 
 /**
@@ -156,8 +402,19 @@ public:
 
     std::string save() const override;
 
-    void evaluate(std::stack<CValue> &evalStack, const std::unordered_map<size_t, CustomCValue> &sheet,
-                  std::unordered_set<size_t> &evaluationPath) const override;
+    size_t memoryUsage() const override;
+
+    void evaluate(std::stack<CValue> &evalStack, const CellStore &sheet,
+                  EvaluationContext &context) const override;
+
+    std::shared_ptr<ExprElement> relocated(const CPos &offset) const override;
+
+    const Reference *referenceOperand() const override { return this; }
+
+    size_t getRow() const;
+    size_t getColumn() const;
+    bool isRowAbsolute() const;
+    bool isColumnAbsolute() const;
 
     /**
      * @brief Adjusts the reference for relative movement.
@@ -0,0 +1,136 @@
+#include "ExprOptimizer.h"
+
+namespace {
+    // Describes one operand on the simulated evaluation stack.
+    struct Operand {
+        size_t begin;             ///< Index of the first output element forming this operand.
+        std::optional<CValue> value; ///< The value of the operand, if it is known at build time.
+    };
+
+    // Joins the saved form of output elements [begin, end) followed by an optional trailing element.
+    std::string saveRange(const std::vector<std::shared_ptr<ExprElement>> &elements, size_t begin,
+                          const ExprElement *trailing = nullptr) {
+        std::string result;
+        for (size_t i = begin; i < elements.size(); ++i) {
+            if (!result.empty()) result += ", ";
+            result += elements[i]->save();
+        }
+        if (trailing) {
+            if (!result.empty()) result += ", ";
+            result += trailing->save();
+        }
+        return result;
+    }
+
+    // Returns true if the operand is a known number equal to the given value.
+    bool isNumber(const Operand &operand, double number) {
+        return operand.value && std::holds_alternative<double>(*operand.value)
+               && std::get<double>(*operand.value) == number;
+    }
+
+    // Replaces output elements [begin, end) by a single element.
+    void collapse(std::vector<std::shared_ptr<ExprElement>> &elements, size_t begin,
+                  std::shared_ptr<ExprElement> replacement) {
+        elements.resize(begin);
+        elements.push_back(std::move(replacement));
+    }
+}
+
+ExprStack ExprOptimizer::optimize(const ExprStack &exprStack) {
+    // Collect elements in evaluation order.
+    std::vector<std::shared_ptr<ExprElement>> input;
+    input.reserve(exprStack.size());
+    for (auto tempStack = exprStack; !tempStack.empty(); tempStack.pop()) {
+        input.push_back(tempStack.top());
+    }
+    std::reverse(input.begin(), input.end());
+
+    const CellStore noSheet;
+    EvaluationContext noContext;
+    std::vector<std::shared_ptr<ExprElement>> output;
+    std::vector<Operand> operands;
+    output.reserve(input.size());
+
+    for (const auto &element: input) {
+        if (dynamic_cast<Constant *>(element.get()) || dynamic_cast<StringVariable *>(element.get())
+            || dynamic_cast<FoldedConstant *>(element.get())) {
+            std::stack<CValue> evalStack;
+            element->evaluate(evalStack, noSheet, noContext);
+            operands.push_back({output.size(), evalStack.top()});
+            output.push_back(element);
+        } else if (auto binary = dynamic_cast<BinaryOperation *>(element.get())) {
+            if (operands.size() < 2) return exprStack;
+            Operand right = operands.back();
+            operands.pop_back();
+            Operand &left = operands.back();
+            const std::string op = binary->getOp();
+
+            if (left.value && right.value) {
+                CValue result = binary->perform(op, *left.value, *right.value);
+                if (!std::holds_alternative<std::monostate>(result)) {
+                    collapse(output, left.begin,
+                             std::make_shared<FoldedConstant>(result, saveRange(output, left.begin, binary)));
+                    left.value = result;
+                    continue;
+                }
+            } else if (!left.value && (((op == "*" || op == "/" || op == "^") && isNumber(right, 1.0))
+                                       || (op == "-" && isNumber(right, 0.0)))) {
+                collapse(output, right.begin,
+                         std::make_shared<NumericIdentity>(saveRange(output, right.begin, binary)));
+                continue;
+            }
+            left.value.reset();
+            output.push_back(element);
+        } else if (auto unary = dynamic_cast<UnaryOperation *>(element.get())) {
+            if (operands.empty()) return exprStack;
+            Operand &operand = operands.back();
+            if (operand.value && std::holds_alternative<double>(*operand.value) && unary->getOp() == "-") {
+                CValue result = -std::get<double>(*operand.value);
+                collapse(output, operand.begin,
+                         std::make_shared<FoldedConstant>(result, saveRange(output, operand.begin, unary)));
+                operand.value = result;
+                continue;
+            }
+            auto previous = dynamic_cast<UnaryOperation *>(output.back().get());
+            if (!operand.value && previous && previous->getOp() == "-" && unary->getOp() == "-") {
+                collapse(output, output.size() - 1,
+                         std::make_shared<NumericIdentity>(saveRange(output, output.size() - 1, unary)));
+                continue;
+            }
+            operand.value.reset();
+            output.push_back(element);
+        } else if (auto function = dynamic_cast<FunctionCall *>(element.get())) {
+            size_t paramCount = function->getStackParameterCount();
+            if (function->getParameterCount() == 0 || operands.size() < paramCount) return exprStack;
+            std::shared_ptr<ExprElement> call = element;
+            // A range directly preceding the call is its last parameter; bind its parsed bounds.
+            if (auto range = output.empty() ? nullptr : std::dynamic_pointer_cast<Range>(output.back())) {
+                if (auto bound = function->bindRange(range)) {
+                    output.pop_back();
+                    operands.pop_back();
+                    call = std::move(bound);
+                    --paramCount;
+                }
+            }
+            size_t begin = paramCount ? operands[operands.size() - paramCount].begin : output.size();
+            operands.resize(operands.size() - paramCount);
+            operands.push_back({begin, std::nullopt});
+            output.push_back(std::move(call));
+        } else {
+            // References, ranges and identities depend on the sheet or are already minimal.
+            if (dynamic_cast<NumericIdentity *>(element.get())) {
+                if (operands.empty()) return exprStack;
+                operands.back().value.reset();
+            } else {
+                operands.push_back({output.size(), std::nullopt});
+            }
+            output.push_back(element);
+        }
+    }
+
+    ExprStack result;
+    for (auto &element: output) {
+        result.push(std::move(element));
+    }
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef EXPR_OPTIMIZER_H
+#define EXPR_OPTIMIZER_H
+
+#include "main.h"
+#include "ExprElement.h"
+
+/**
+ * @class ExprOptimizer
+ * @brief Simplifies expression stacks before they are stored in the spreadsheet.
+ *
+ * The optimizer folds subexpressions built only from constants and pure operations
+ * into single FoldedConstant elements and replaces numeric identities (x*1, x/1, x^1,
+ * x-0, -(-x)) with NumericIdentity checks. Range operands of range functions are bound
+ * to the call, so their bounds are parsed once. Replaced elements keep their saved form,
+ * so an optimized expression saves exactly like the original one.
+ */
+class ExprOptimizer {
+public:
+    /**
+     * @brief Returns an optimized copy of the given expression stack.
+     *
+     * If the expression is malformed, it is returned unchanged so that evaluation
+     * reports the error as before.
+     *
+     * @param exprStack The expression stack as produced by the expression builder or loader.
+     * @return ExprStack The optimized expression stack.
+     */
+    static ExprStack optimize(const ExprStack &exprStack);
+};
+
+#endif // EXPR_OPTIMIZER_H
@@ -0,0 +1,482 @@
+#include "ExpressionParser.h"
+
+namespace {
+    enum class TokenType {
+        End, Number, String, Cell, Range, Function,
+        Plus, Minus, Star, Slash, Caret, Eq, Ne, Lt, Le, Gt, Ge,
+        LParen, RParen, Comma
+    };
+
+    struct Token {
+        TokenType type = TokenType::End;
+        size_t begin = 0;      ///< Position of the token in the formula.
+        std::string_view text; ///< The source text of the token (including quotes for strings).
+        double number = 0;     ///< The value of a number token.
+    };
+
+    // Ranges are only valid as function arguments, so every operand carries its kind.
+    enum class Operand { Value, Range };
+
+    // Limits the recursion on nested parentheses and unary minus.
+    constexpr size_t MAX_NESTING = 1024;
+
+    // Returns the symbol of a binary operator token.
+    std::string_view operatorSymbol(TokenType type) {
+        switch (type) {
+            case TokenType::Plus: return "+";
+            case TokenType::Minus: return "-";
+            case TokenType::Star: return "*";
+            case TokenType::Slash: return "/";
+            case TokenType::Caret: return "^";
+            case TokenType::Eq: return "=";
+            case TokenType::Ne: return "<>";
+            case TokenType::Lt: return "<";
+            case TokenType::Le: return "<=";
+            case TokenType::Gt: return ">";
+            default: return ">=";
+        }
+    }
+
+    bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    bool isLetter(char c) { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'); }
+
+    class Lexer {
+    public:
+        explicit Lexer(std::string_view expr) : expr(expr), pos(1) {}
+
+        Token next() {
+            while (pos < expr.size() && std::isspace(static_cast<unsigned char>(expr[pos]))) {
+                ++pos;
+            }
+            Token token;
+            token.begin = pos;
+            if (pos >= expr.size()) {
+                return token;
+            }
+
+            char c = expr[pos];
+            if (isDigit(c)) {
+                lexNumber(token);
+            } else if (c == '"') {
+                lexString(token);
+            } else if (c == '$' || isLetter(c)) {
+                lexCell(token);
+            } else {
+                token.type = lexOperator(c);
+            }
+            token.text = expr.substr(token.begin, pos - token.begin);
+            return token;
+        }
+
+        [[noreturn]] void fail(std::string_view message, size_t at) const {
+            std::string error(message);
+            error += '\n';
+            error += expr;
+            error += '\n';
+            error.append(std::min(at, expr.size()), ' ');
+            error += "^\n";
+            throw std::invalid_argument(error);
+        }
+
+    private:
+        std::string_view expr;
+        size_t pos;
+
+        void lexNumber(Token &token) {
+            while (pos < expr.size() && isDigit(expr[pos])) ++pos;
+            if (pos < expr.size() && expr[pos] == '.') {
+                ++pos;
+                while (pos < expr.size() && isDigit(expr[pos])) ++pos;
+            }
+            if (pos < expr.size() && (expr[pos] == 'e' || expr[pos] == 'E')) {
+                size_t exponent = pos + 1;
+                if (exponent < expr.size() && (expr[exponent] == '+' || expr[exponent] == '-')) ++exponent;
+                if (exponent >= expr.size() || !isDigit(expr[exponent])) {
+                    fail("Invalid number", exponent);
+                }
+                for (pos = exponent; pos < expr.size() && isDigit(expr[pos]); ++pos) {}
+            }
+
+            token.type = TokenType::Number;
+            const char *first = expr.data() + token.begin;
+            const char *last = expr.data() + pos;
+            if (std::from_chars(first, last, token.number).ec == std::errc::result_out_of_range) {
+                // Overflow and underflow saturate to infinity and zero, as strtod does.
+                token.number = std::strtod(std::string(first, last).c_str(), nullptr);
+            }
+        }
+
+        void lexString(Token &token) {
+            for (++pos;; pos += 2) {
+                pos = expr.find('"', pos);
+                if (pos == std::string_view::npos) {
+                    pos = expr.size();
+                    fail("Missing string terminator", pos);
+                }
+                if (pos + 1 >= expr.size() || expr[pos + 1] != '"') break;
+            }
+            ++pos;
+            token.type = TokenType::String;
+        }
+
+        // Scans "$?letters$?digits" at pos; returns false if it is not a complete reference.
+        bool scanReference() {
+            if (pos < expr.size() && expr[pos] == '$') ++pos;
+            size_t letters = pos;
+            while (pos < expr.size() && isLetter(expr[pos])) ++pos;
+            if (pos < expr.size() && expr[pos] == '$') ++pos;
+            size_t digits = pos;
+            while (pos < expr.size() && isDigit(expr[pos])) ++pos;
+            return pos > digits && digits > letters && isLetter(expr[letters]);
+        }
+
+        void lexCell(Token &token) {
+            bool absoluteColumn = expr[pos] == '$';
+            if (absoluteColumn) ++pos;
+            size_t letters = pos;
+            while (pos < expr.size() && isLetter(expr[pos])) ++pos;
+            if (pos == letters) {
+                fail(pos < expr.size() ? "Missing column id" : "Invalid cell/range", pos);
+            }
+
+            // A bare name followed by '(' is a function call.
+            size_t lookahead = pos;
+            while (lookahead < expr.size() && std::isspace(static_cast<unsigned char>(expr[lookahead]))) ++lookahead;
+            if (!absoluteColumn && lookahead < expr.size() && expr[lookahead] == '(') {
+                token.type = TokenType::Function;
+                return;
+            }
+
+            bool absoluteRow = pos < expr.size() && expr[pos] == '$';
+            if (absoluteRow) ++pos;
+            size_t digits = pos;
+            while (pos < expr.size() && isDigit(expr[pos])) ++pos;
+            if (pos == digits) {
+                fail(absoluteRow ? "Missing cell row" : "Invalid cell/range", pos);
+            }
+
+            token.type = TokenType::Cell;
+            if (pos < expr.size() && expr[pos] == ':') {
+                ++pos;
+                if (!scanReference()) {
+                    fail("Invalid cell/range", pos);
+                }
+                if (pos < expr.size() && expr[pos] == ':') {
+                    fail("Invalid range", pos);
+                }
+                token.type = TokenType::Range;
+            }
+        }
+
+        TokenType lexOperator(char c) {
+            ++pos;
+            switch (c) {
+                case '+': return TokenType::Plus;
+                case '-': return TokenType::Minus;
+                case '*': return TokenType::Star;
+                case '/': return TokenType::Slash;
+                case '^': return TokenType::Caret;
+                case '=': return TokenType::Eq;
+                case '(': return TokenType::LParen;
+                case ')': return TokenType::RParen;
+                case ',': return TokenType::Comma;
+                case '<':
+                    if (pos < expr.size() && expr[pos] == '=') return ++pos, TokenType::Le;
+                    if (pos < expr.size() && expr[pos] == '>') return ++pos, TokenType::Ne;
+                    return TokenType::Lt;
+                case '>':
+                    if (pos < expr.size() && expr[pos] == '=') return ++pos, TokenType::Ge;
+                    return TokenType::Gt;
+                default:
+                    fail("Unknown char sequence", --pos);
+            }
+        }
+    };
+
+    // Removes the quotes and doubled quotes of a string token.
+    std::string unescape(std::string_view quoted) {
+        std::string result;
+        result.reserve(quoted.size() - 2);
+        for (size_t i = 1; i + 1 < quoted.size(); ++i) {
+            result += quoted[i];
+            if (quoted[i] == '"') ++i;
+        }
+        return result;
+    }
+
+    // Reports the parsed formula through the CExprBuilder callbacks.
+    class BuilderSink {
+    public:
+        explicit BuilderSink(CExprBuilder &builder) : builder(builder) {}
+
+        void number(double value) { builder.valNumber(value); }
+        void string(std::string value) { builder.valString(std::move(value)); }
+        void reference(std::string_view text) { builder.valReference(std::string(text)); }
+        void range(std::string_view text) { builder.valRange(std::string(text)); }
+        void function(std::string_view name, size_t paramCount) {
+            builder.funcCall(std::string(name), static_cast<int>(paramCount));
+        }
+        void negate() { builder.opNeg(); }
+
+        void binary(TokenType type) {
+            switch (type) {
+                case TokenType::Plus: builder.opAdd(); break;
+                case TokenType::Minus: builder.opSub(); break;
+                case TokenType::Star: builder.opMul(); break;
+                case TokenType::Slash: builder.opDiv(); break;
+                case TokenType::Caret: builder.opPow(); break;
+                case TokenType::Eq: builder.opEq(); break;
+                case TokenType::Ne: builder.opNe(); break;
+                case TokenType::Lt: builder.opLt(); break;
+                case TokenType::Le: builder.opLe(); break;
+                case TokenType::Gt: builder.opGt(); break;
+                default: builder.opGe(); break;
+            }
+        }
+
+    private:
+        CExprBuilder &builder;
+    };
+
+    // Builds the expression stack directly. Operations carry no state, so one instance
+    // of each is shared by all formulas.
+    class ElementSink {
+    public:
+        ExprStack expression;
+
+        void number(double value) { expression.push(std::make_shared<Constant>(value)); }
+        void string(std::string value) { expression.push(std::make_shared<StringVariable>(std::move(value))); }
+        void reference(std::string_view text) { expression.push(std::make_shared<Reference>(std::string(text))); }
+        void range(std::string_view text) { expression.push(std::make_shared<Range>(std::string(text))); }
+        void function(std::string_view name, size_t paramCount) {
+            expression.push(std::make_shared<FunctionCall>(std::string(name), paramCount));
+        }
+
+        void negate() {
+            static const std::shared_ptr<ExprElement> negation = std::make_shared<UnaryOperation>("-");
+            expression.push(negation);
+        }
+
+        void binary(TokenType type) {
+            static const auto operations = [] {
+                std::array<std::shared_ptr<ExprElement>, static_cast<size_t>(TokenType::Ge) + 1> table;
+                for (auto op = static_cast<size_t>(TokenType::Plus); op < table.size(); ++op) {
+                    table[op] = std::make_shared<BinaryOperation>(std::string(operatorSymbol(static_cast<TokenType>(op))));
+                }
+                return table;
+            }();
+            expression.push(operations[static_cast<size_t>(type)]);
+        }
+    };
+
+    template<typename Sink>
+    class Parser {
+    public:
+        Parser(std::string_view expr, Sink &sink) : lexer(expr), sink(sink) {
+            advance();
+        }
+
+        void parseFormula() {
+            Operand result = parseComparison();
+            if (token.type != TokenType::End) {
+                lexer.fail("Unexpected extra token(s)", token.begin);
+            }
+            if (result == Operand::Range) {
+                lexer.fail("Range is invalid expression result", 1);
+            }
+        }
+
+    private:
+        Lexer lexer;
+        Sink &sink;
+        Token token;
+        size_t nesting = 0;
+
+        void advance() { token = lexer.next(); }
+
+        void enter() {
+            if (++nesting > MAX_NESTING) {
+                lexer.fail("Expression is nested too deeply", token.begin);
+            }
+        }
+
+        void binary(TokenType type, Operand left, Operand right, size_t at) {
+            if (left == Operand::Range || right == Operand::Range) {
+                lexer.fail("Range is not a valid operand for operator " + std::string(operatorSymbol(type)), at);
+            }
+            sink.binary(type);
+        }
+
+        // = and <> bind looser than the ordering comparisons.
+        Operand parseComparison() {
+            enter();
+            Operand left = parseRelational();
+            while (token.type == TokenType::Eq || token.type == TokenType::Ne) {
+                Token op = token;
+                advance();
+                binary(op.type, left, parseRelational(), op.begin);
+                left = Operand::Value;
+            }
+            --nesting;
+            return left;
+        }
+
+        Operand parseRelational() {
+            Operand left = parseAdditive();
+            while (token.type >= TokenType::Lt && token.type <= TokenType::Ge) {
+                Token op = token;
+                advance();
+                binary(op.type, left, parseAdditive(), op.begin);
+                left = Operand::Value;
+            }
+            return left;
+        }
+
+        Operand parseAdditive() {
+            Operand left = parseMultiplicative();
+            while (token.type == TokenType::Plus || token.type == TokenType::Minus) {
+                Token op = token;
+                advance();
+                binary(op.type, left, parseMultiplicative(), op.begin);
+                left = Operand::Value;
+            }
+            return left;
+        }
+
+        Operand parseMultiplicative() {
+            Operand left = parseUnary();
+            while (token.type == TokenType::Star || token.type == TokenType::Slash) {
+                Token op = token;
+                advance();
+                binary(op.type, left, parseUnary(), op.begin);
+                left = Operand::Value;
+            }
+            return left;
+        }
+
+        // Unary minus binds looser than ^, so -2^2 is -(2^2).
+        Operand parseUnary() {
+            if (token.type != TokenType::Minus) {
+                return parsePower();
+            }
+            size_t at = token.begin;
+            enter();
+            advance();
+            if (parseUnary() == Operand::Range) {
+                lexer.fail("Range is not a valid operand for operator unary -", at);
+            }
+            sink.negate();
+            --nesting;
+            return Operand::Value;
+        }
+
+        Operand parsePower() {
+            Operand left = parsePrimary();
+            while (token.type == TokenType::Caret) {
+                Token op = token;
+                advance();
+                binary(op.type, left, parsePrimary(), op.begin);
+                left = Operand::Value;
+            }
+            return left;
+        }
+
+        Operand parsePrimary() {
+            Operand result = Operand::Value;
+            switch (token.type) {
+                case TokenType::Number:
+                    sink.number(token.number);
+                    break;
+                case TokenType::String:
+                    sink.string(unescape(token.text));
+                    break;
+                case TokenType::Cell:
+                    sink.reference(token.text);
+                    break;
+                case TokenType::Range:
+                    sink.range(token.text);
+                    result = Operand::Range;
+                    break;
+                case TokenType::Function:
+                    return parseFunction();
+                case TokenType::LParen:
+                    advance();
+                    result = parseComparison();
+                    if (token.type != TokenType::RParen) {
+                        lexer.fail("Missing )", token.begin);
+                    }
+                    break;
+                default:
+                    lexer.fail("Unexpected token " + (token.type == TokenType::End ? std::string("<EOF>") : std::string(token.text)),
+                               token.begin);
+            }
+            advance();
+            return result;
+        }
+
+        Operand parseFunction() {
+            std::string_view name = token.text;
+            advance();
+            advance();
+
+            size_t paramCount = 0;
+            size_t rangeCount = 0;
+            bool lastIsRange = false;
+            if (token.type != TokenType::RParen) {
+                while (true) {
+                    lastIsRange = parseComparison() == Operand::Range;
+                    rangeCount += lastIsRange;
+                    ++paramCount;
+                    if (token.type != TokenType::Comma) break;
+                    advance();
+                }
+            }
+            if (token.type != TokenType::RParen) {
+                lexer.fail("Missing ) in function call", token.begin);
+            }
+
+            size_t at = token.begin;
+            if (name == "sum" || name == "count" || name == "min" || name == "max") {
+                if (paramCount != 1) lexer.fail("Function sum/min/max requires exactly one parameter", at);
+                if (!lastIsRange) lexer.fail("Function sum/min/max requires cell range parameter", at);
+            } else if (name == "countval") {
+                if (paramCount != 2) lexer.fail("Function countval() requires exactly 2 parameters", at);
+                if (!lastIsRange || rangeCount != 1) lexer.fail("Function countval() requires a value and a range", at);
+            } else if (name == "if") {
+                if (paramCount != 3) lexer.fail("Function if() requires exactly 3 parameters", at);
+                if (rangeCount) lexer.fail("Function if() does not accept range parameters", at);
+            } else {
+                lexer.fail("Unknown function " + std::string(name), at);
+            }
+
+            sink.function(name, paramCount);
+            advance();
+            return Operand::Value;
+        }
+    };
+}
+
+void ExpressionParser::parse(std::string_view expr, CExprBuilder &builder) {
+    BuilderSink sink(builder);
+    if (expr.empty() || expr[0] != '=') {
+        sink.string(std::string(expr));
+        return;
+    }
+    Parser<BuilderSink>(expr, sink).parseFormula();
+}
+
+ExprStack ExpressionParser::compile(std::string_view expr) {
+    ElementSink sink;
+    if (expr.empty() || expr[0] != '=') {
+        sink.string(std::string(expr));
+    } else {
+        Parser<ElementSink>(expr, sink).parseFormula();
+    }
+    return std::move(sink.expression);
+}
+
+// Replaces the prebuilt expression parser library behind the CExprBuilder interface.
+void parseExpression(std::string expr, CExprBuilder &builder) {
+    ExpressionParser::parse(expr, builder);
+}
@@ -0,0 +1,43 @@
+#ifndef EXPRESSION_PARSER_H
+#define EXPRESSION_PARSER_H
+
+#include "main.h"
+#include "ExprElement.h"
+
+/**
+ * @class ExpressionParser
+ * @brief In-tree recursive-descent parser for spreadsheet formulas.
+ *
+ * Implements the formula grammar of the original expression parser library. From the
+ * loosest binding: = and <>, then <, <=, > and >=, then + and -, then * and /, then
+ * unary minus, then ^. All binary operators are left-associative. Operands are
+ * numbers, strings, cell references, ranges, parentheses and the functions
+ * sum, count, min, max (one range), countval (a value and a range) and if (three values).
+ * Contents that do not start with '=' are a single string value. Errors are reported
+ * as std::invalid_argument with the position marked under the formula.
+ *
+ * The parser can either drive a CExprBuilder (the parseExpression interface) or build
+ * the expression stack directly, without virtual calls or intermediate strings.
+ */
+class ExpressionParser {
+public:
+    /**
+     * @brief Parses a formula and reports it to the builder in postfix order.
+     *
+     * @param expr The cell contents to parse.
+     * @param builder The builder receiving the values, operations and function calls.
+     */
+    static void parse(std::string_view expr, CExprBuilder &builder);
+
+    /**
+     * @brief Parses a formula into an expression stack.
+     *
+     * The result is identical to what CustomExpressionBuilder builds from parse.
+     *
+     * @param expr The cell contents to parse.
+     * @return ExprStack The expression in evaluation order.
+     */
+    static ExprStack compile(std::string_view expr);
+};
+
+#endif // EXPRESSION_PARSER_H
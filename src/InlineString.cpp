@@ -0,0 +1,51 @@
+#include "InlineString.h"
+
+InlineString::InlineString(std::string_view text) {
+    if (text.size() <= INLINE_CAPACITY) {
+        std::memcpy(this->text, text.data(), text.size());
+        length = static_cast<unsigned char>(text.size());
+    } else {
+        heap.text = new char[text.size()];
+        heap.size = text.size();
+        std::memcpy(heap.text, text.data(), text.size());
+        length = ON_HEAP;
+    }
+}
+
+InlineString::InlineString(InlineString &&other) noexcept : length(other.length) {
+    if (length == ON_HEAP) {
+        heap = other.heap;
+        other.length = 0;
+    } else {
+        std::memcpy(text, other.text, length);
+    }
+}
+
+InlineString &InlineString::operator=(const InlineString &other) {
+    if (this != &other) {
+        *this = InlineString(other);
+    }
+    return *this;
+}
+
+InlineString &InlineString::operator=(InlineString &&other) noexcept {
+    if (this != &other) {
+        if (length == ON_HEAP) {
+            delete[] heap.text;
+        }
+        length = other.length;
+        if (length == ON_HEAP) {
+            heap = other.heap;
+            other.length = 0;
+        } else {
+            std::memcpy(text, other.text, length);
+        }
+    }
+    return *this;
+}
+
+InlineString::~InlineString() {
+    if (length == ON_HEAP) {
+        delete[] heap.text;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef INLINE_STRING_H
+#define INLINE_STRING_H
+
+#include "main.h"
+
+/**
+ * @class InlineString
+ * @brief An immutable string that keeps up to INLINE_CAPACITY characters inside the object.
+ *
+ * Text cells use it instead of std::string, whose small-string buffer holds only 15
+ * characters: a cell slot is sized for a short formula anyway, so text up to 71 characters
+ * fits in the same space without a heap allocation. Longer text is stored on the heap.
+ */
+class InlineString {
+public:
+    static constexpr size_t INLINE_CAPACITY = 71; ///< The longest text stored inline.
+
+    InlineString() : InlineString(std::string_view()) {}
+    InlineString(std::string_view text);
+    InlineString(const std::string &text) : InlineString(std::string_view(text)) {}
+    InlineString(const char *text) : InlineString(std::string_view(text)) {}
+
+    InlineString(const InlineString &other) : InlineString(other.view()) {}
+    InlineString(InlineString &&other) noexcept;
+    InlineString &operator=(const InlineString &other);
+    InlineString &operator=(InlineString &&other) noexcept;
+    ~InlineString();
+
+    /**
+     * @brief Returns the text.
+     */
+    std::string_view view() const {
+        return length == ON_HEAP ? std::string_view(heap.text, heap.size) : std::string_view(text, length);
+    }
+
+    /**
+     * @brief Returns a copy of the text as a std::string.
+     */
+    std::string str() const { return std::string(view()); }
+
+    /**
+     * @brief Returns the heap bytes owned by the string; zero if the text is inline.
+     */
+    size_t heapBytes() const { return length == ON_HEAP ? heap.size : 0; }
+
+    bool operator==(const InlineString &other) const { return view() == other.view(); }
+
+private:
+    static constexpr unsigned char ON_HEAP = 0xFF; ///< The length marker of text stored on the heap.
+
+    union {
+        char text[INLINE_CAPACITY]; ///< The inline text.
+        struct {
+            char *text;
+            size_t size;
+        } heap;                     ///< The heap text, if longer than INLINE_CAPACITY.
+    };
+    unsigned char length; ///< The length of the inline text, or ON_HEAP.
+};
+
+#endif // INLINE_STRING_H
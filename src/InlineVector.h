@@ -0,0 +1,174 @@
+#ifndef INLINE_VECTOR_H
+#define INLINE_VECTOR_H
+
+#include "main.h"
+
+/**
+ * @class InlineVector
+ * @brief A vector that stores up to N elements inside the object and more on the heap.
+ *
+ * Provides the subset of the std::vector interface used as the container of a std::stack.
+ * While the elements fit, creating, copying and destroying the vector allocates nothing;
+ * beyond N elements they move to a heap buffer that grows geometrically, as in std::vector.
+ * The inline buffer and the heap pointer share storage, so the object is N elements plus
+ * two 32-bit counters.
+ *
+ * @tparam T The element type.
+ * @tparam N The number of elements stored inline.
+ */
+template<typename T, size_t N>
+class InlineVector {
+public:
+    using value_type = T;
+    using size_type = size_t;
+    using reference = T &;
+    using const_reference = const T &;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    InlineVector() noexcept {}
+
+    InlineVector(std::initializer_list<T> values) {
+        reserve(values.size());
+        std::uninitialized_copy(values.begin(), values.end(), data());
+        count = static_cast<uint32_t>(values.size());
+    }
+
+    InlineVector(const InlineVector &other) {
+        reserve(other.count);
+        std::uninitialized_copy(other.begin(), other.end(), data());
+        count = other.count;
+    }
+
+    InlineVector(InlineVector &&other) noexcept {
+        take(std::move(other));
+    }
+
+    InlineVector &operator=(const InlineVector &other) {
+        if (this != &other) {
+            InlineVector copy(other);
+            release();
+            take(std::move(copy));
+        }
+        return *this;
+    }
+
+    InlineVector &operator=(InlineVector &&other) noexcept {
+        if (this != &other) {
+            release();
+            take(std::move(other));
+        }
+        return *this;
+    }
+
+    ~InlineVector() {
+        release();
+    }
+
+    T *data() { return isInline() ? reinterpret_cast<T *>(buffer) : heap; }
+    const T *data() const { return isInline() ? reinterpret_cast<const T *>(buffer) : heap; }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + count; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + count; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return limit; }
+
+    /**
+     * @brief Returns true while the elements are stored inside the object.
+     */
+    bool isInline() const { return limit == N; }
+
+    T &operator[](size_t i) { return data()[i]; }
+    const T &operator[](size_t i) const { return data()[i]; }
+    T &back() { return data()[count - 1]; }
+    const T &back() const { return data()[count - 1]; }
+
+    void push_back(const T &value) { emplace_back(value); }
+    void push_back(T &&value) { emplace_back(std::move(value)); }
+
+    template<typename... Args>
+    T &emplace_back(Args &&... args) {
+        if (count == limit) {
+            // Construct first: the arguments may refer to an element that grow() moves.
+            T value(std::forward<Args>(args)...);
+            grow(static_cast<size_t>(limit) * 2);
+            return *std::construct_at(data() + count++, std::move(value));
+        }
+        return *std::construct_at(data() + count++, std::forward<Args>(args)...);
+    }
+
+    void pop_back() {
+        std::destroy_at(data() + --count);
+    }
+
+    void clear() {
+        std::destroy(begin(), end());
+        count = 0;
+    }
+
+    void reserve(size_t wanted) {
+        if (wanted > limit) {
+            grow(wanted);
+        }
+    }
+
+    bool operator==(const InlineVector &other) const {
+        return std::equal(begin(), end(), other.begin(), other.end());
+    }
+
+private:
+    /**
+     * @brief Moves the elements to a heap buffer with room for the given number of them.
+     */
+    void grow(size_t wanted) {
+        T *moved = std::allocator<T>().allocate(wanted);
+        std::uninitialized_move(begin(), end(), moved);
+        std::destroy(begin(), end());
+        if (!isInline()) {
+            std::allocator<T>().deallocate(heap, limit);
+        }
+        heap = moved;
+        limit = static_cast<uint32_t>(wanted);
+    }
+
+    /**
+     * @brief Destroys the elements and frees the heap buffer, leaving the vector inline and empty.
+     */
+    void release() {
+        clear();
+        if (!isInline()) {
+            std::allocator<T>().deallocate(heap, limit);
+            limit = N;
+        }
+    }
+
+    /**
+     * @brief Takes the elements of a vector, which must be empty and inline itself; other ends up empty.
+     */
+    void take(InlineVector &&other) noexcept {
+        if (other.isInline()) {
+            std::uninitialized_move(other.begin(), other.end(), reinterpret_cast<T *>(buffer));
+            count = other.count;
+            other.clear();
+        } else {
+            heap = other.heap;
+            limit = other.limit;
+            count = other.count;
+            other.limit = N;
+            other.count = 0;
+        }
+    }
+
+    union {
+        alignas(T) unsigned char buffer[sizeof(T) * N]; ///< The inline elements.
+        T *heap;                                        ///< The heap buffer, once the elements outgrow the inline one.
+    };
+    uint32_t count = 0;  ///< The number of elements.
+    uint32_t limit = N;  ///< The capacity; equal to N exactly while the elements are inline.
+};
+
+#endif // INLINE_VECTOR_H
@@ -0,0 +1,13 @@
+#include "MemoryUsage.h"
+
+void MemoryUsage::print(std::ostream &os) const {
+    auto printCategory = [&os](const char *name, size_t bytes) {
+        os << std::left << std::setw(18) << name << std::right << std::setw(14) << bytes << " B" << std::endl;
+    };
+    printCategory("cell slots", cellSlots);
+    printCategory("strings", strings);
+    printCategory("expression nodes", expressionNodes);
+    printCategory("caches", caches);
+    printCategory("indexes", indexes);
+    printCategory("total", total());
+}
@@ -0,0 +1,49 @@
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include "main.h"
+
+/**
+ * @struct MemoryUsage
+ * @brief The estimated memory footprint of a spreadsheet, in bytes, by category.
+ *
+ * The estimates follow the layout of the standard library containers in use (hash table
+ * buckets and nodes, heap buffers of long formulas and strings) but leave out allocator
+ * overhead, so the process may hold somewhat more than the total.
+ */
+struct MemoryUsage {
+    size_t cellSlots = 0;       ///< Hash table buckets and nodes of the cell storage, with the inline cell contents.
+    size_t strings = 0;         ///< Heap storage of string cells.
+    size_t expressionNodes = 0; ///< Formula elements (each shared element once) and the stacks holding them.
+    size_t caches = 0;          ///< Cached columnar plans.
+    size_t indexes = 0;         ///< The range dependency index.
+
+    /**
+     * @brief Returns the sum of all categories.
+     */
+    size_t total() const { return cellSlots + strings + expressionNodes + caches + indexes; }
+
+    /**
+     * @brief Returns the heap bytes owned by a string; short strings are stored inline.
+     */
+    static size_t heapBytes(const std::string &text) {
+        return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+    }
+
+    /**
+     * @brief Returns the bytes of the buckets and nodes of a hash map, excluding memory the values own.
+     */
+    template<typename Map>
+    static size_t hashMapBytes(const Map &map) {
+        return map.bucket_count() * sizeof(void *) + map.size() * (sizeof(void *) + sizeof(typename Map::value_type));
+    }
+
+    /**
+     * @brief Writes the categories and the total in a human-readable form.
+     *
+     * @param os The stream to write to.
+     */
+    void print(std::ostream &os) const;
+};
+
+#endif // MEMORY_USAGE_H
@@ -0,0 +1,130 @@
+#ifndef PARALLEL_INGEST_H
+#define PARALLEL_INGEST_H
+
+#include "main.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+/**
+ * @class ParallelIngest
+ * @brief Runs an ordered produce/commit pipeline over independent chunks of input.
+ *
+ * Worker threads produce the results of chunks (e.g. parse formulas) in any order, while
+ * the calling thread commits them strictly in chunk order, so committing needs no locking
+ * and gives the same result as a sequential loop. At most a bounded window of chunks is
+ * kept in flight ahead of the committer, which bounds the memory of large imports.
+ */
+class ParallelIngest {
+public:
+    /**
+     * @brief Returns the number of threads to use for the given setting.
+     *
+     * @param threads The requested number of threads; 0 selects the hardware concurrency.
+     * @return unsigned The number of threads, at least 1.
+     */
+    static unsigned threadCount(unsigned threads) {
+        if (!threads) threads = std::thread::hardware_concurrency();
+        return std::max(threads, 1u);
+    }
+
+    /**
+     * @brief Produces chunks [0, chunkCount) on worker threads and commits them in order.
+     *
+     * If producing or committing a chunk throws, no further chunks are committed, the
+     * workers are stopped and the first exception (in chunk order) is rethrown.
+     *
+     * @param chunkCount The number of chunks.
+     * @param threads The number of threads (see threadCount); the calling thread only commits.
+     * @param produce Callable Result(size_t chunk), invoked concurrently.
+     * @param commit Callable void(Result &&), invoked on the calling thread in chunk order.
+     */
+    template<typename Result, typename Produce, typename Commit>
+    static void run(size_t chunkCount, unsigned threads, Produce produce, Commit commit) {
+        unsigned workerCount = static_cast<unsigned>(std::min<size_t>(threadCount(threads), chunkCount));
+        if (workerCount <= 1) {
+            for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+                commit(produce(chunk));
+            }
+            return;
+        }
+
+        struct Slot {
+            std::optional<Result> result;
+            std::exception_ptr error;
+            bool ready = false;
+        };
+        std::vector<Slot> slots(chunkCount);
+        std::mutex mutex;
+        std::condition_variable produced, committed;
+        size_t nextChunk = 0, committedChunks = 0;
+        bool stop = false;
+        const size_t window = 4 * static_cast<size_t>(workerCount);
+
+        auto work = [&] {
+            while (true) {
+                size_t chunk;
+                {
+                    std::unique_lock lock(mutex);
+                    committed.wait(lock, [&] { return stop || nextChunk < committedChunks + window; });
+                    if (stop || nextChunk >= chunkCount) return;
+                    chunk = nextChunk++;
+                }
+                Slot slot;
+                try {
+                    slot.result.emplace(produce(chunk));
+                } catch (...) {
+                    slot.error = std::current_exception();
+                }
+                slot.ready = true;
+                {
+                    std::lock_guard lock(mutex);
+                    slots[chunk] = std::move(slot);
+                }
+                produced.notify_one();
+            }
+        };
+
+        std::vector<std::jthread> workers;
+        workers.reserve(workerCount);
+        auto stopWorkers = [&] {
+            {
+                std::lock_guard lock(mutex);
+                stop = true;
+            }
+            committed.notify_all();
+            workers.clear();
+        };
+
+        try {
+            for (unsigned i = 0; i < workerCount; ++i) {
+                workers.emplace_back(work);
+            }
+            for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+                Slot slot;
+                {
+                    std::unique_lock lock(mutex);
+                    produced.wait(lock, [&] { return slots[chunk].ready; });
+                    slot = std::move(slots[chunk]);
+                }
+                if (slot.error) {
+                    std::rethrow_exception(slot.error);
+                }
+                commit(std::move(*slot.result));
+                {
+                    std::lock_guard lock(mutex);
+                    ++committedChunks;
+                }
+                committed.notify_all();
+            }
+        } catch (...) {
+            stopWorkers();
+            throw;
+        }
+        stopWorkers();
+    }
+};
+
+#endif // PARALLEL_INGEST_H
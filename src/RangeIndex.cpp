@@ -0,0 +1,229 @@
+#include "RangeIndex.h"
+#include <numeric>
+#include <bit>
+#include "MemoryUsage.h"
+
+RangeIndex::RangeIndex(const RangeIndex &other) {
+    *this = other;
+}
+
+RangeIndex &RangeIndex::operator=(const RangeIndex &other) {
+    if (this != &other) {
+        // The lock is not copied: each index guards its own updates.
+        entries = other.entries;
+        ownerEntries = other.ownerEntries;
+        trees = other.trees;
+        removed = other.removed;
+        active = other.active.load();
+        built = other.built.load();
+    }
+    return *this;
+}
+
+bool RangeIndex::isActive() const {
+    return active;
+}
+
+void RangeIndex::activate() {
+    std::lock_guard lock(mutex);
+    active = true;
+}
+
+void RangeIndex::build(const std::function<void(RangeIndex &)> &fill) {
+    if (built.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard lock(buildMutex);
+    if (built.load(std::memory_order_relaxed)) {
+        return;
+    }
+    activate();
+    fill(*this);
+    built.store(true, std::memory_order_release);
+}
+
+void RangeIndex::reset() {
+    std::lock_guard buildLock(buildMutex);
+    std::lock_guard lock(mutex);
+    entries.clear();
+    ownerEntries.clear();
+    trees.clear();
+    removed = 0;
+    active = false;
+    built = false;
+}
+
+void RangeIndex::assign(size_t owner, const std::vector<Area> &areas) {
+    if (!active.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard lock(mutex);
+    if (!active) {
+        return;
+    }
+    remove(owner);
+    for (const auto &[start, end] : areas) {
+        Box box{start.getColumn(), start.getRow(), end.getColumn(), end.getRow()};
+        if (box.left > box.right || box.top > box.bottom) {
+            continue; // A reversed range covers no cells.
+        }
+        auto entry = static_cast<uint32_t>(entries.size());
+        entries.push_back({box, owner, true});
+        ownerEntries[owner].push_back(entry);
+        insert(entry);
+    }
+    if (removed > 64 && removed > entries.size() - removed) {
+        compact();
+    }
+}
+
+std::vector<size_t> RangeIndex::covering(const CPos &pos) const {
+    std::vector<size_t> owners;
+    for (const auto &tree : trees) {
+        if (tree.levels.empty()) {
+            continue;
+        }
+        for (const auto &root : tree.levels.back()) {
+            visit(tree, tree.levels.size() - 1, root, pos.getColumn(), pos.getRow(), owners);
+        }
+    }
+    std::sort(owners.begin(), owners.end());
+    owners.erase(std::unique(owners.begin(), owners.end()), owners.end());
+    return owners;
+}
+
+size_t RangeIndex::size() const {
+    return entries.size() - removed;
+}
+
+size_t RangeIndex::memoryUsage() const {
+    size_t bytes = entries.capacity() * sizeof(Entry) + MemoryUsage::hashMapBytes(ownerEntries)
+                   + trees.capacity() * sizeof(Tree);
+    for (const auto &[owner, ownerItems] : ownerEntries) {
+        bytes += ownerItems.capacity() * sizeof(uint32_t);
+    }
+    for (const auto &tree : trees) {
+        bytes += tree.items.capacity() * sizeof(uint32_t) + tree.levels.capacity() * sizeof(std::vector<Node>);
+        for (const auto &level : tree.levels) {
+            bytes += level.capacity() * sizeof(Node);
+        }
+    }
+    return bytes;
+}
+
+template<typename T, typename BoxOf>
+std::vector<RangeIndex::Node> RangeIndex::pack(std::vector<T> &items, BoxOf boxOf) {
+    // Sort-tile-recursive: vertical slices by column, then runs of FANOUT by row within each.
+    size_t leaves = (items.size() + FANOUT - 1) / FANOUT;
+    auto slices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(leaves))));
+    size_t sliceItems = slices * FANOUT;
+    auto byColumn = [&boxOf](const T &a, const T &b) {
+        return boxOf(a).left + boxOf(a).right < boxOf(b).left + boxOf(b).right;
+    };
+    auto byRow = [&boxOf](const T &a, const T &b) {
+        return boxOf(a).top + boxOf(a).bottom < boxOf(b).top + boxOf(b).bottom;
+    };
+    std::sort(items.begin(), items.end(), byColumn);
+    for (size_t first = 0; first < items.size(); first += sliceItems) {
+        std::sort(items.begin() + first, items.begin() + std::min(items.size(), first + sliceItems), byRow);
+    }
+
+    std::vector<Node> nodes;
+    nodes.reserve(leaves);
+    for (size_t first = 0; first < items.size(); first += FANOUT) {
+        Node node{boxOf(items[first]), static_cast<uint32_t>(first),
+                  static_cast<uint32_t>(std::min<size_t>(FANOUT, items.size() - first))};
+        for (size_t i = first + 1; i < first + node.count; ++i) {
+            const Box &box = boxOf(items[i]);
+            node.box.left = std::min(node.box.left, box.left);
+            node.box.top = std::min(node.box.top, box.top);
+            node.box.right = std::max(node.box.right, box.right);
+            node.box.bottom = std::max(node.box.bottom, box.bottom);
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+void RangeIndex::build(Tree &tree, std::vector<uint32_t> items) const {
+    tree.items = std::move(items);
+    tree.levels.clear();
+    if (tree.items.empty()) {
+        return;
+    }
+    tree.levels.push_back(pack(tree.items, [this](uint32_t entry) -> const Box & { return entries[entry].box; }));
+    while (tree.levels.back().size() > 1) {
+        auto parents = pack(tree.levels.back(), [](const Node &node) -> const Box & { return node.box; });
+        tree.levels.push_back(std::move(parents));
+    }
+}
+
+void RangeIndex::insert(uint32_t entry) {
+    // Merge full trees into the first empty slot, dropping removed entries on the way.
+    std::vector<uint32_t> carry{entry};
+    size_t slot = 0;
+    for (; slot < trees.size() && !trees[slot].items.empty(); ++slot) {
+        for (uint32_t item : trees[slot].items) {
+            if (entries[item].live) {
+                carry.push_back(item);
+            }
+        }
+        trees[slot] = Tree();
+    }
+    if (slot == trees.size()) {
+        trees.emplace_back();
+    }
+    build(trees[slot], std::move(carry));
+}
+
+void RangeIndex::remove(size_t owner) {
+    auto it = ownerEntries.find(owner);
+    if (it == ownerEntries.end()) {
+        return;
+    }
+    for (uint32_t entry : it->second) {
+        entries[entry].live = false;
+        ++removed;
+    }
+    ownerEntries.erase(it);
+}
+
+void RangeIndex::compact() {
+    std::vector<Entry> live;
+    live.reserve(entries.size() - removed);
+    ownerEntries.clear();
+    for (const auto &entry : entries) {
+        if (entry.live) {
+            ownerEntries[entry.owner].push_back(static_cast<uint32_t>(live.size()));
+            live.push_back(entry);
+        }
+    }
+    entries = std::move(live);
+    removed = 0;
+
+    std::vector<uint32_t> items(entries.size());
+    std::iota(items.begin(), items.end(), 0);
+    trees.clear();
+    if (!items.empty()) {
+        // The slot whose capacity fits all entries, so later insertions carry into it last.
+        trees.resize(std::bit_width(items.size()) + 1);
+        build(trees.back(), std::move(items));
+    }
+}
+
+void RangeIndex::visit(const Tree &tree, size_t level, const Node &node, size_t column, size_t row,
+                       std::vector<size_t> &owners) const {
+    if (!node.box.contains(column, row)) {
+        return;
+    }
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        if (level == 0) {
+            const Entry &entry = entries[tree.items[i]];
+            if (entry.live && entry.box.contains(column, row)) {
+                owners.push_back(entry.owner);
+            }
+        } else {
+            visit(tree, level - 1, tree.levels[level - 1][i], column, row, owners);
+        }
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef RANGE_INDEX_H
+#define RANGE_INDEX_H
+
+#include "main.h"
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "CPos.h"
+
+/**
+ * @class RangeIndex
+ * @brief A spatial index of the range operands of formulas, answering which ranges cover a cell.
+ *
+ * Each range is stored once, as a rectangle tagged with the formula cell (owner) it belongs
+ * to, so a formula over a hundred thousand cells costs one entry rather than one edge per
+ * cell. The rectangles are kept in a logarithmic sequence of static R-trees (packed with the
+ * sort-tile-recursive method): an insertion merges the small trees into the next larger one,
+ * as a binary counter carries, so insertions are O(log^2 n) amortized and a query descends
+ * O(log n) trees, only into the nodes whose bounds contain the cell. Removed ranges are
+ * dropped when their tree is next merged, or by a full rebuild once they outnumber the
+ * live ones.
+ *
+ * The index starts out inactive and ignores updates until activated, so a sheet that never
+ * asks for dependents does not pay for it: an inactive index takes no lock. Updates to an
+ * active index lock it and may come from several writers at once; queries take no lock and
+ * must not run concurrently with updates. build activates and fills the index once, so
+ * concurrent readers can each call it before querying.
+ */
+class RangeIndex {
+public:
+    using Area = std::pair<CPos, CPos>; ///< The top left and bottom right corners of a range.
+
+    RangeIndex() = default;
+    RangeIndex(const RangeIndex &other);
+    RangeIndex &operator=(const RangeIndex &other);
+
+    /**
+     * @brief Returns true if the index tracks updates.
+     */
+    bool isActive() const;
+
+    /**
+     * @brief Starts tracking updates; the caller then adds the ranges present so far.
+     */
+    void activate();
+
+    /**
+     * @brief Activates the index and fills it, unless a previous call already did since the last reset.
+     *
+     * Concurrent callers are serialized: the first one fills the index and the others wait
+     * for it, then return without calling fill.
+     *
+     * @param fill Adds the ranges present so far, through assign.
+     */
+    void build(const std::function<void(RangeIndex &)> &fill);
+
+    /**
+     * @brief Drops all ranges and stops tracking updates.
+     */
+    void reset();
+
+    /**
+     * @brief Replaces the ranges of a formula cell. Ignored while the index is inactive.
+     *
+     * @param owner The unique ID of the formula cell.
+     * @param areas The ranges the formula reads; empty to remove the cell from the index.
+     */
+    void assign(size_t owner, const std::vector<Area> &areas);
+
+    /**
+     * @brief Returns the formula cells that have a range covering the given cell.
+     *
+     * @param pos The cell.
+     * @return std::vector<size_t> The unique IDs of the formula cells, sorted and without duplicates.
+     */
+    std::vector<size_t> covering(const CPos &pos) const;
+
+    /**
+     * @brief Returns the number of indexed ranges.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns the bytes used by the index.
+     */
+    size_t memoryUsage() const;
+
+private:
+    /**
+     * @brief An axis-aligned rectangle of cells, bounds inclusive.
+     */
+    struct Box {
+        size_t left, top, right, bottom;
+
+        bool contains(size_t column, size_t row) const {
+            return left <= column && column <= right && top <= row && row <= bottom;
+        }
+    };
+
+    /**
+     * @brief One indexed range.
+     */
+    struct Entry {
+        Box box;
+        size_t owner; ///< The unique ID of the formula cell.
+        bool live;    ///< False once removed.
+    };
+
+    /**
+     * @brief A node of an R-tree: the bounds of a contiguous run of children in the level below.
+     */
+    struct Node {
+        Box box;
+        uint32_t first, count;
+    };
+
+    /**
+     * @brief A static R-tree. levels[0] indexes into items; levels[i] into levels[i - 1].
+     */
+    struct Tree {
+        std::vector<uint32_t> items;           ///< Entry indices, grouped by leaf.
+        std::vector<std::vector<Node>> levels; ///< The node levels, from the leaves up to the root.
+    };
+
+    static constexpr uint32_t FANOUT = 16; ///< Children per node.
+
+    /**
+     * @brief Orders items into tiles and returns one node per FANOUT consecutive items.
+     */
+    template<typename T, typename BoxOf>
+    static std::vector<Node> pack(std::vector<T> &items, BoxOf boxOf);
+
+    /**
+     * @brief Builds a tree over the given entries.
+     */
+    void build(Tree &tree, std::vector<uint32_t> items) const;
+
+    /**
+     * @brief Adds an entry, merging the trees it carries into.
+     */
+    void insert(uint32_t entry);
+
+    /**
+     * @brief Marks the entries of a formula cell as removed.
+     */
+    void remove(size_t owner);
+
+    /**
+     * @brief Drops the removed entries and rebuilds a single tree from the live ones.
+     */
+    void compact();
+
+    /**
+     * @brief Collects the owners of the live entries below a node that contain the cell.
+     */
+    void visit(const Tree &tree, size_t level, const Node &node, size_t column, size_t row,
+               std::vector<size_t> &owners) const;
+
+    std::vector<Entry> entries;                                     ///< All ranges, including removed ones.
+    std::unordered_map<size_t, std::vector<uint32_t>> ownerEntries; ///< The live entries of every formula cell.
+    std::vector<Tree> trees;                                        ///< trees[i] holds up to 2^i entries, or none.
+    size_t removed = 0;                                             ///< Entries no longer live.
+    std::atomic<bool> active = false;                               ///< True while updates are tracked.
+    std::atomic<bool> built = false;                                ///< True once build has filled the index.
+    std::mutex mutex;                                               ///< Serializes updates.
+    std::mutex buildMutex;                                          ///< Serializes build.
+};
+
+#endif // RANGE_INDEX_H
@@ -0,0 +1,70 @@
+#include "RecalcScheduler.h"
+
+RecalcScheduler::~RecalcScheduler() {
+    {
+        std::lock_guard lock(mutex);
+        tasks.clear();
+        interrupt.request_stop();
+    }
+    if (worker.joinable()) {
+        worker.request_stop();
+        worker.join();
+    }
+}
+
+void RecalcScheduler::submit(Task task) {
+    {
+        std::lock_guard lock(mutex);
+        tasks.push_back(std::move(task));
+        if (!started.load(std::memory_order_relaxed)) {
+            worker = std::jthread([this](std::stop_token stop) { run(stop); });
+            started.store(true, std::memory_order_release);
+        }
+    }
+    changed.notify_all();
+}
+
+RecalcScheduler::Pause RecalcScheduler::pause() {
+    if (!started.load(std::memory_order_acquire)) {
+        return Pause(nullptr);
+    }
+    std::unique_lock lock(mutex);
+    ++pauses;
+    if (running) {
+        interrupt.request_stop();
+    }
+    changed.wait(lock, [this] { return !running; });
+    return Pause(this);
+}
+
+RecalcScheduler::Pause::~Pause() {
+    if (scheduler) {
+        {
+            std::lock_guard lock(scheduler->mutex);
+            --scheduler->pauses;
+        }
+        scheduler->changed.notify_all();
+    }
+}
+
+void RecalcScheduler::run(std::stop_token stop) {
+    std::unique_lock lock(mutex);
+    while (changed.wait(lock, stop, [this] { return !pauses && !tasks.empty(); })) {
+        Task task = std::move(tasks.front());
+        tasks.pop_front();
+        interrupt = std::stop_source();
+        running = true;
+        std::stop_token interrupted = interrupt.get_token();
+        lock.unlock();
+
+        bool finished = task(interrupted);
+
+        lock.lock();
+        running = false;
+        if (!finished && !stop.stop_requested()) {
+            // Interrupted by an edit: run it again first, on the edited sheet.
+            tasks.push_front(std::move(task));
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef RECALC_SCHEDULER_H
+#define RECALC_SCHEDULER_H
+
+#include "main.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <future>
+#include <atomic>
+#include "CPos.h"
+
+/**
+ * @class RecalculationCancelled
+ * @brief Reported by the future of a recalculation that was cancelled.
+ */
+class RecalculationCancelled : public std::runtime_error {
+public:
+    RecalculationCancelled() : std::runtime_error("Recalculation cancelled") {}
+};
+
+/**
+ * @class RecalculationHandle
+ * @brief A recalculation running in the background, with the means to cancel it.
+ */
+class RecalculationHandle {
+public:
+    using Result = std::vector<std::pair<CPos, CValue>>; ///< The values of all formula cells, in row-major order.
+
+    RecalculationHandle(std::future<Result> values, std::stop_source stop)
+            : values(std::move(values)), stop(std::move(stop)) {}
+
+    /**
+     * @brief Requests cancellation. The evaluation stops at the next formula it enters and
+     * the result reports RecalculationCancelled, unless it was already complete.
+     */
+    void cancel() { stop.request_stop(); }
+
+    /**
+     * @brief Waits for the recalculation and returns its result.
+     *
+     * @throws RecalculationCancelled If the recalculation was cancelled.
+     */
+    Result get() { return values.get(); }
+
+    /**
+     * @brief Gives access to the underlying future, e.g. to wait with a timeout.
+     */
+    std::future<Result> &future() { return values; }
+
+private:
+    std::future<Result> values;
+    std::stop_source stop;
+};
+
+/**
+ * @class RecalcScheduler
+ * @brief Runs the asynchronous evaluations of a spreadsheet on a background thread.
+ *
+ * Tasks run one at a time in submission order. Before the sheet is modified, the writer
+ * pauses the scheduler: the running task is interrupted through its stop token and the
+ * writer waits until it has returned. A task that reports it was interrupted is run again,
+ * first, once the scheduler resumes, so its result reflects the edited sheet; an edit
+ * supersedes in-flight work instead of racing with it.
+ *
+ * The background thread is started by the first submitted task. Copying a scheduler
+ * yields an idle one: the work of a sheet is not copied along with its cells. Tasks still
+ * queued when the scheduler is destroyed are discarded.
+ */
+class RecalcScheduler {
+public:
+    /**
+     * @brief A unit of work. It returns false if it was interrupted and must run again.
+     */
+    using Task = std::function<bool(std::stop_token interrupted)>;
+
+    RecalcScheduler() = default;
+    RecalcScheduler(const RecalcScheduler &) {}
+    RecalcScheduler &operator=(const RecalcScheduler &) { return *this; }
+    ~RecalcScheduler();
+
+    /**
+     * @brief Queues a task, starting the background thread if needed.
+     */
+    void submit(Task task);
+
+    /**
+     * @class Pause
+     * @brief Keeps the scheduler from running tasks while it is alive.
+     */
+    class Pause {
+    public:
+        explicit Pause(RecalcScheduler *scheduler) : scheduler(scheduler) {}
+        ~Pause();
+
+        Pause(const Pause &) = delete;
+        Pause &operator=(const Pause &) = delete;
+
+    private:
+        RecalcScheduler *scheduler;
+    };
+
+    /**
+     * @brief Interrupts the running task and waits until no task is running.
+     *
+     * Free if no task was ever submitted.
+     *
+     * @return Pause The scheduler resumes when the returned object is destroyed.
+     */
+    [[nodiscard]] Pause pause();
+
+private:
+    /**
+     * @brief The loop of the background thread.
+     */
+    void run(std::stop_token stop);
+
+    std::mutex mutex;
+    std::condition_variable_any changed; ///< Signals new tasks, resumed pauses and finished tasks.
+    std::deque<Task> tasks;              ///< Tasks waiting to run.
+    std::stop_source interrupt;          ///< Interrupts the running task.
+    bool running = false;                ///< True while a task runs.
+    size_t pauses = 0;                   ///< The number of live Pause objects.
+    std::atomic<bool> started = false;   ///< True once the background thread runs.
+    std::jthread worker;                 ///< The background thread; declared last, so it stops first.
+};
+
+#endif // RECALC_SCHEDULER_H
@@ -0,0 +1,55 @@
+#include "RecalcTask.h"
+
+RecalcTask::RecalcTask(RecalcTask &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {}
+
+RecalcTask &RecalcTask::operator=(RecalcTask &&other) noexcept {
+    if (this != &other) {
+        if (handle) {
+            handle.destroy();
+        }
+        handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+RecalcTask::~RecalcTask() {
+    if (handle) {
+        handle.destroy();
+    }
+}
+
+bool RecalcTask::resume() {
+    if (!done()) {
+        handle.resume();
+    }
+    return done();
+}
+
+bool RecalcTask::done() const {
+    return !handle || handle.done();
+}
+
+const RecalcTask::Result &RecalcTask::values() const {
+    if (!handle || !handle.done()) {
+        throw std::logic_error("Recalculation not complete");
+    }
+    if (handle.promise().error) {
+        std::rethrow_exception(handle.promise().error);
+    }
+    return handle.promise().values;
+}
+
+void RecalcLoop::add(RecalcTask &task) {
+    tasks.push_back(&task);
+}
+
+bool RecalcLoop::runOnce() {
+    // Finished tasks leave the rotation; the others keep their order.
+    std::erase_if(tasks, [](RecalcTask *task) { return task->resume(); });
+    return !tasks.empty();
+}
+
+void RecalcLoop::run() {
+    while (runOnce()) {}
+}
@@ -0,0 +1,97 @@
+#ifndef RECALC_TASK_H
+#define RECALC_TASK_H
+
+#include "main.h"
+#include <coroutine>
+#include "CPos.h"
+
+/**
+ * @class RecalcTask
+ * @brief A recalculation that runs in steps, suspending between them.
+ *
+ * Returned by CSpreadsheet::recalculate. The task does nothing until it is resumed; each
+ * resume evaluates formulas until a quantum of work is done and then suspends, so the
+ * caller decides when to continue: between frames of a UI, or interleaved with other
+ * sheets on one thread (see RecalcLoop). Destroying an unfinished task abandons it.
+ */
+class RecalcTask {
+public:
+    using Result = std::vector<std::pair<CPos, CValue>>; ///< The values of all formula cells, in row-major order.
+
+    /**
+     * @brief The coroutine promise: starts suspended and keeps the result.
+     */
+    struct promise_type {
+        Result values;             ///< The result, once returned.
+        std::exception_ptr error;  ///< The exception that ended the coroutine, if any.
+
+        RecalcTask get_return_object() { return RecalcTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(Result result) { values = std::move(result); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    RecalcTask(RecalcTask &&other) noexcept;
+    RecalcTask &operator=(RecalcTask &&other) noexcept;
+    RecalcTask(const RecalcTask &) = delete;
+    RecalcTask &operator=(const RecalcTask &) = delete;
+    ~RecalcTask();
+
+    /**
+     * @brief Runs the next step of the recalculation.
+     *
+     * @return bool True if the recalculation is complete.
+     */
+    bool resume();
+
+    /**
+     * @brief Returns true if the recalculation is complete.
+     */
+    bool done() const;
+
+    /**
+     * @brief Returns the values of the completed recalculation.
+     *
+     * @throws std::logic_error If the recalculation is not complete.
+     * @return const Result& The values of all formula cells.
+     */
+    const Result &values() const;
+
+private:
+    explicit RecalcTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle; ///< The coroutine; null once moved from.
+};
+
+/**
+ * @class RecalcLoop
+ * @brief Drives several recalculations on the calling thread, one step of each in turn.
+ *
+ * The tasks are not owned and must outlive the loop's use of them. Tasks of the same
+ * sheet may be interleaved; the sheets must not be modified while a step runs.
+ */
+class RecalcLoop {
+public:
+    /**
+     * @brief Adds a task to the rotation.
+     */
+    void add(RecalcTask &task);
+
+    /**
+     * @brief Runs one step of every unfinished task.
+     *
+     * @return bool True if some task is still unfinished.
+     */
+    bool runOnce();
+
+    /**
+     * @brief Runs steps in turn until every task is complete.
+     */
+    void run();
+
+private:
+    std::vector<RecalcTask *> tasks; ///< The unfinished tasks, in rotation order.
+};
+
+#endif // RECALC_TASK_H
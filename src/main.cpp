@@ -1,8 +1,14 @@
 #include "main.h"
+#include <thread>
+#include <random>
 #include "CSpreadsheet.h"
 #include "CPos.h"
+#include "CellReference.h"
 #include "ExprElement.h"
 #include "CustomExpressionBuilder.h"
+#include "ExpressionParser.h"
+#include "ByteScan.h"
+#include "CsvFormat.h"
 
 #ifndef __PROGTEST__
 
@@ -189,6 +195,710 @@ int main() {
     assert (valueMatch(x0.getValue(CPos("H12")), CValue(25.0)));
     assert (valueMatch(x0.getValue(CPos("H13")), CValue(-22.0)));
     assert (valueMatch(x0.getValue(CPos("H14")), CValue(-22.0)));
+    assert (x0.setCell(CPos("J1"), "=(1+0.05)^12"));
+    assert (x0.setCell(CPos("J2"), "=2^10*$A$1"));
+    assert (x0.setCell(CPos("J3"), "=--A6*1"));
+    assert (x0.setCell(CPos("J4"), "=-(-$A$1)^1-0"));
+    assert (x0.setCell(CPos("J5"), "=1/0+A1"));
+    assert (valueMatch(x0.getValue(CPos("J1")), CValue(std::pow(1.05, 12))));
+    assert (valueMatch(x0.getValue(CPos("J2")), CValue(12288.0)));
+    assert (valueMatch(x0.getValue(CPos("J3")), CValue()));
+    assert (valueMatch(x0.getValue(CPos("J4")), CValue(12.0)));
+    assert (valueMatch(x0.getValue(CPos("J5")), CValue()));
+    oss.clear();
+    oss.str("");
+    assert (x0.save(oss));
+    assert (oss.str().find("Constant 0.050000, BinaryOperation +, Constant 12.000000, BinaryOperation ^") != std::string::npos);
+    data = oss.str();
+    iss.clear();
+    iss.str(data);
+    assert (x1.load(iss));
+    assert (valueMatch(x1.getValue(CPos("J2")), CValue(12288.0)));
+    assert (valueMatch(x1.getValue(CPos("J4")), CValue(12.0)));
+    for (int i = 0; i < 8; i++)
+        assert (x0.setCell(CPos(11, 1 + i), std::to_string(i)));
+    assert (x0.setCell(CPos(11, 4), "text"));
+    assert (x0.setCell(CPos("M1"), "=K1*$A$1+2^(-K1)-1"));
+    for (size_t i = 1; i < 8; i++)
+        x0.copyRect(CPos(13, i + 1), CPos(13, i), 1, 1);
+    assert (x0.setCell(CPos("M9"), "=K9/K1"));
+    std::vector<CValue> column = x0.getColumnValues(CPos("M0"), 11);
+    assert (column.size() == 11);
+    for (size_t i = 0; i < column.size(); i++)
+        assert (valueMatch(column[i], x0.getValue(CPos(13, i))));
+    assert (valueMatch(column[3], CValue(23.25)));
+    assert (valueMatch(column[4], CValue()));
+    assert (x0.setCell(CPos("K4"), "3"));
+    assert (x0.setCell(CPos("M5"), "=K5"));
+    column = x0.getColumnValues(CPos("M0"), 11);
+    assert (valueMatch(column[3], CValue(23.25)));
+    assert (valueMatch(column[4], CValue(3 * 12 + 0.125 - 1)));
+    assert (valueMatch(column[5], CValue(4.0)));
+#ifdef EXCEL_ENABLE_STATS
+    CSpreadsheet x2;
+    assert (x2.setCell(CPos("A1"), "1"));
+    assert (x2.setCell(CPos("A2"), "=A1+1"));
+    assert (x2.setCell(CPos("A3"), "=A2+A1"));
+    assert (x2.setCell(CPos("B1"), "=sum(A1:A3)"));
+    x2.resetStats();
+    assert (valueMatch(x2.getValue(CPos("A3")), CValue(3.0)));
+    assert (valueMatch(x2.getValue(CPos("B1")), CValue(6.0)));
+    assert (x2.stats().getValue.count == 2);
+    assert (x2.stats().referenceEvaluations == 7);
+    assert (x2.stats().rangeCellsScanned == 3);
+    assert (x2.stats().functions.at("sum").calls == 1);
+    assert (x2.stats().depthHistogram[1] == 1 && x2.stats().depthHistogram[2] == 1);
+    assert (x2.stats().parse.count == 0);
+    x2.getColumnValues(CPos("A1"), 3);
+    x2.getColumnValues(CPos("A1"), 3);
+    assert (x2.stats().columnPlanHits == 1 && x2.stats().columnPlanMisses == 1);
+#endif /* EXCEL_ENABLE_STATS */
+    CSpreadsheet x3;
+    assert (x3.setCell(CPos("A1"), "1"));
+    assert (x3.setCell(CPos("A2"), "=A1+1"));
+    assert (x3.setCell(CPos("A3"), "=A2*A2"));
+    assert (x3.setCell(CPos("B1"), "=sum(A1:A3)"));
+    x3.getValue(CPos("A3"));
+    assert (x3.profiler().cells().empty());
+    x3.profiler().enable(true);
+    assert (valueMatch(x3.getValue(CPos("A3")), CValue(4.0)));
+    assert (valueMatch(x3.getValue(CPos("B1")), CValue(7.0)));
+    x3.profiler().disable();
+    x3.getValue(CPos("A3"));
+    const auto &profiles = x3.profiler().cells();
+    assert (profiles.size() == 3);
+    assert (profiles.at(CPos("A2").getUniqueId()).evaluations == 5);
+    assert (profiles.at(CPos("A3").getUniqueId()).evaluations == 2);
+    assert (profiles.at(CPos("A3").getUniqueId()).cellsVisited == 4);
+    assert (profiles.at(CPos("B1").getUniqueId()).cellsVisited == 3);
+    assert (profiles.at(CPos("B1").getUniqueId()).inclusiveNs >= profiles.at(CPos("B1").getUniqueId()).exclusiveNs);
+    oss.clear();
+    oss.str("");
+    x3.profiler().report(oss, 2);
+    assert (oss.str().find("A2") != std::string::npos || oss.str().find("A3") != std::string::npos);
+    oss.clear();
+    oss.str("");
+    assert (x3.profiler().writeChromeTrace(oss));
+    assert (oss.str().find("\"name\":\"B1\"") != std::string::npos);
+
+    assert (sizeof(CPos) == 8);
+    assert (CPos("C2").getMortonKey() == 0b1110);
+    assert (CPos::fromMortonKey(CPos("ZZ12345").getMortonKey()).getUniqueId() == CPos("ZZ12345").getUniqueId());
+    assert (CPos("B3").getMortonKey() < CPos("A5").getMortonKey());
+    CSpreadsheet x4, x5;
+    assert (x4.setCell(CPos("A5"), "=B3+1"));
+    assert (x4.setCell(CPos("B3"), "=$A$1*2"));
+    assert (x4.setCell(CPos("A1"), "20"));
+    x4.setSaveOrder(CellOrder::Morton);
+    oss.clear();
+    oss.str("");
+    assert (x4.save(oss));
+    assert (oss.str().find(std::to_string(CPos("A1").getUniqueId()) + ",") < oss.str().find(std::to_string(CPos("B3").getUniqueId()) + ","));
+    assert (oss.str().find(std::to_string(CPos("B3").getUniqueId()) + ",") < oss.str().find(std::to_string(CPos("A5").getUniqueId()) + ","));
+    iss.clear();
+    iss.str(oss.str());
+    assert (x5.load(iss));
+    assert (valueMatch(x5.getValue(CPos("A5")), CValue(41.0)));
+    x4.copyRect(CPos("C2"), CPos("B3"));
+    assert (valueMatch(x4.getValue(CPos("C2")), CValue(40.0)));
+    x4.copyRect(CPos("B4"), CPos("A5"));
+    assert (valueMatch(x4.getValue(CPos("B4")), CValue(41.0)));
+
+    CellReference first, last;
+    assert (parseCellRange("$b$2:AA10", first, last));
+    assert (first.column == 2 && first.row == 2 && first.absoluteColumn && first.absoluteRow);
+    assert (last.column == 27 && last.row == 10 && !last.absoluteColumn);
+    assert (!parseCellReference("A", first) && !parseCellReference("12", first) && !parseCellReference("A1x", first));
+    assert (!parseCellReference("A99999999999", first) && !parseCellRange("A1:", first, last));
+    assert (x4.setCell(CPos("D1"), "=countval(40, $B$1:C$3) + max(A1:B3)"));
+    assert (valueMatch(x4.getValue(CPos("D1")), CValue(42.0)));
+    oss.clear();
+    oss.str("");
+    assert (x4.save(oss) && oss.str().find("Range $B$1:C$3, Function countval 2") != std::string::npos);
+
+    assert (x4.setCell(CPos("D3"), "=(-2^2 + 1=-3) + (1<3 + 2*3^2/ 3) + 2^3^2"));
+    assert (valueMatch(x4.getValue(CPos("D3")), CValue(66.0)));
+    assert (x4.setCell(CPos("D4"), "=1.82"));
+    assert (valueMatch(x4.getValue(CPos("D4")), CValue(1.82)));
+    for (const char *invalid : {"=sum(1)", "=A1:B2", "=2^-1", "=1+", "=countval(A1:A2,1)", "=\"open", "=A1B", "=(1"}) {
+        bool thrown = false;
+        try {
+            x4.setCell(CPos("D5"), invalid);
+        } catch (const std::invalid_argument &) {
+            thrown = true;
+        }
+        assert (thrown);
+    }
+    CustomExpressionBuilder viaBuilder;
+    parseExpression("=if(A1<>\"a\"\"b\", -$B$2, countval(3, a1:$c$2)) >= 1e3", viaBuilder);
+    auto compiled = ExpressionParser::compile("=if(A1<>\"a\"\"b\", -$B$2, countval(3, a1:$c$2)) >= 1e3");
+    assert (compiled.size() == viaBuilder.getExpression().size());
+    for (auto built = viaBuilder.getExpression(); !built.empty(); built.pop(), compiled.pop()) {
+        assert (built.top()->save() == compiled.top()->save());
+    }
+
+    std::vector<std::pair<CPos, std::string>> bulkCells;
+    for (size_t row = 1; row <= 3000; ++row) {
+        bulkCells.emplace_back(CPos(1, row), std::to_string(row));
+        bulkCells.emplace_back(CPos(2, row), "=A" + std::to_string(row) + "*2+$C$1");
+    }
+    bulkCells.emplace_back(CPos("C1"), "0.5");
+    bulkCells.emplace_back(CPos("A7"), "seven");
+    CSpreadsheet x6, x7;
+    x6.setIngestThreads(4);
+    assert (x6.setCells(bulkCells));
+    assert (valueMatch(x6.getValue(CPos("B3000")), CValue(6000.5)));
+    assert (valueMatch(x6.getValue(CPos("A7")), CValue("seven")));
+    oss.clear();
+    oss.str("");
+    assert (x6.save(oss) && oss.str().size() > 64 * 1024);
+    iss.clear();
+    iss.str(oss.str());
+    x7.setIngestThreads(3);
+    assert (x7.load(iss));
+    assert (valueMatch(x7.getValue(CPos("B2999")), CValue(5998.5)));
+    assert (valueMatch(x7.getValue(CPos("B7")), CValue()));
+    bulkCells.erase(bulkCells.begin() + 2500, bulkCells.end());
+    bulkCells.emplace_back(CPos("D1"), "=1+");
+    bulkCells.emplace_back(CPos("D2"), "=2");
+    try {
+        x7.setCells(bulkCells);
+        assert ("setCells accepted an invalid formula" == nullptr);
+    } catch (const std::invalid_argument &) {
+    }
+    assert (valueMatch(x7.getValue(CPos("A7")), CValue(7.0)));
+    assert (valueMatch(x7.getValue(CPos("D1")), CValue()) && valueMatch(x7.getValue(CPos("D2")), CValue()));
+
+    CSpreadsheet x8;
+    std::string bulkSave = oss.str();
+    x8.setLazyLoading(true);
+    iss.clear();
+    iss.str(bulkSave);
+    assert (x8.load(iss));
+    assert (valueMatch(x8.getValue(CPos("B10")), CValue(20.5)));
+    assert (valueMatch(x8.getValue(CPos("B10")), CValue(20.5)));
+#ifdef EXCEL_ENABLE_STATS
+    assert (x8.stats().lazyCompilations == 1);
+#endif /* EXCEL_ENABLE_STATS */
+    x6.setSaveOrder(CellOrder::RowMajor);
+    x8.setSaveOrder(CellOrder::RowMajor);
+    oss.clear();
+    oss.str("");
+    assert (x6.save(oss));
+    bulkSave = oss.str();
+    oss.str("");
+    assert (x8.save(oss) && oss.str() == bulkSave);
+    x8.copyRect(CPos("E1"), CPos("B1"), 1, 2);
+#ifdef EXCEL_ENABLE_STATS
+    // The copies stay in their saved form too.
+    assert (x8.stats().lazyCompilations == 1);
+#endif /* EXCEL_ENABLE_STATS */
+    assert (x8.setCell(CPos("D2"), "4"));
+    assert (valueMatch(x8.getValue(CPos("E2")), CValue(8.5)));
+    assert (x8.getColumnValues(CPos("B1"), 3000).at(2999).index() == 1);
+
+    CSpreadsheet x9;
+    assert (x9.setCell(CPos("A0"), "1"));
+    for (int row = 1; row < 20; ++row) {
+        assert (x9.setCell(CPos(1, row), "=A" + std::to_string(row - 1) + "+1"));
+    }
+    assert (x9.setCell(CPos("B0"), "=sum(A0:A19)"));
+    assert (x9.setCell(CPos("C0"), "=C1+1"));
+    assert (x9.setCell(CPos("C1"), "=C0"));
+    std::atomic<size_t> mismatches = 0;
+    {
+        std::vector<std::jthread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&x9, &mismatches, t] {
+                for (int i = 0; i < 20; ++i) {
+                    mismatches += !valueMatch(x9.getValue(CPos(1, (i * 7 + t) % 20)), CValue((i * 7 + t) % 20 + 1.0));
+                    mismatches += !valueMatch(x9.getValue(CPos("B0")), CValue(210.0));
+                    mismatches += !valueMatch(x9.getValue(CPos("C1")), CValue());
+                }
+            });
+        }
+    }
+    assert (mismatches == 0);
+#ifdef EXCEL_ENABLE_STATS
+    assert (x9.stats().getValue.count == 240);
+#endif /* EXCEL_ENABLE_STATS */
+
+    CSpreadsheet x10;
+    assert (x10.getColumnValues(CPos(1, 1), 100).at(99).index() == 0);
+    {
+        std::vector<std::jthread> writers;
+        for (size_t t = 0; t < 4; ++t) {
+            writers.emplace_back([&x10, t] {
+                size_t column = 1 + t * CellStore::BAND_WIDTH;
+                for (size_t row = 1; row <= 100; ++row) {
+                    x10.setCell(CPos(column, row), std::to_string(row * (t + 1)));
+                    std::string formula = "=";
+                    formula += CPos(column, row).toString();
+                    formula += "*2";
+                    x10.setCell(CPos(column + 1, row), formula);
+                }
+            });
+        }
+    }
+    for (size_t t = 0; t < 4; ++t) {
+        auto column = x10.getColumnValues(CPos(2 + t * CellStore::BAND_WIDTH, 1), 100);
+        assert (valueMatch(column.at(99), CValue(200.0 * (t + 1))));
+    }
+    assert (valueMatch(x10.getColumnValues(CPos(1, 1), 100).at(99), CValue(100.0)));
+
+    auto chainEnd = x9.getValueAsync(CPos("A19"));
+    auto recalculation = x9.recalculateAsync();
+    assert (valueMatch(chainEnd.get(), CValue(20.0)));
+    auto recalculated = recalculation.get();
+    assert (recalculated.size() == 22 && recalculated.front().first.toString() == "A1");
+    assert (valueMatch(recalculated.back().second, CValue()));
+    assert (x6.setCell(CPos("C2"), "=sum(B1:B3000)"));
+    auto total = x6.getValueAsync(CPos("C2"));
+    auto cancelled = x6.recalculateAsync();
+    cancelled.cancel();
+    try {
+        cancelled.get();
+        assert ("recalculation was not cancelled" == nullptr);
+    } catch (const RecalculationCancelled &) {
+    }
+    assert (x6.setCell(CPos("C1"), "1"));
+    CValue totalValue = total.get();
+    assert (valueMatch(totalValue, CValue(3000.0 * 3001.0 - 14.0 + 1499.5))
+            || valueMatch(totalValue, CValue(3000.0 * 3001.0 - 14.0 + 2999.0)));
+    assert (valueMatch(x6.getValueAsync(CPos("C2")).get(), CValue(3000.0 * 3001.0 - 14.0 + 2999.0)));
+
+    RecalcTask chainSteps = x9.recalculate(4);
+    RecalcTask columnSteps = x10.recalculate(64);
+    RecalcLoop loop;
+    loop.add(chainSteps);
+    loop.add(columnSteps);
+    assert (loop.runOnce() && !chainSteps.done());
+    assert (x9.setCell(CPos("A0"), "2"));
+    loop.run();
+    assert (chainSteps.values().size() == 22 && columnSteps.values().size() == 400);
+    for (const auto &steps: {&chainSteps, &columnSteps}) {
+        for (const auto &[pos, value]: steps->values()) {
+            assert (valueMatch(value, (steps == &chainSteps ? x9 : x10).getValue(pos)));
+        }
+    }
+    assert (valueMatch(x9.getValue(CPos("A19")), CValue(21.0)));
+
+    // A chain far deeper than the quantum is climbed a quantum per step.
+    CSpreadsheet deepChain;
+    assert (deepChain.setCell(CPos("A2000"), "1"));
+    for (size_t row = 0; row < 2000; ++row) {
+        assert (deepChain.setCell(CPos("A" + std::to_string(row)), "=A" + std::to_string(row + 1) + "+1"));
+    }
+    for (size_t column = 2; column <= 41; ++column) {
+        assert (deepChain.setCell(CPos(column, 0), "=" + CPos(column < 41 ? column + 1 : 2, 0).toString()));
+    }
+    RecalcTask deepSteps = deepChain.recalculate(16);
+    size_t deepResumes = 1;
+    while (!deepSteps.resume()) {
+        ++deepResumes;
+    }
+    assert (deepResumes > 2000 / 16 && deepSteps.values().size() == 2040);
+    assert (valueMatch(deepSteps.values().front().second, CValue(2001.0)));
+    for (const auto &[pos, value]: deepSteps.values()) {
+        assert (valueMatch(value, deepChain.getValue(pos)));
+    }
+#ifdef EXCEL_ENABLE_STATS
+    deepChain.resetStats();
+    RecalcTask shallowSteps = deepChain.recalculate(16);
+    while (!shallowSteps.resume()) {}
+    assert (deepChain.stats().depthHistogram.back() == 0);
+#endif /* EXCEL_ENABLE_STATS */
+
+    CSpreadsheet x11;
+    assert (x11.setCell(CPos("A1"), "1"));
+    assert (x11.setCell(CPos("B2"), "=A1+$A$1"));
+    assert (x11.setCell(CPos(700, 900), "=B2*2"));
+    assert (x11.setCell(CPos(1500, 500), "stale"));
+    x11.copyRect(CPos(1001, 1), CPos(1, 1), 1000, 1000);
+    assert (valueMatch(x11.getValue(CPos(1002, 2)), CValue(2.0)));
+    assert (valueMatch(x11.getValue(CPos(1700, 900)), CValue(4.0)));
+    assert (valueMatch(x11.getValue(CPos(1500, 500)), CValue()));
+    x11.copyRect(CPos("B1"), CPos("A1"), 2, 2);
+    assert (valueMatch(x11.getValue(CPos("C2")), CValue(2.0)) && valueMatch(x11.getValue(CPos("B2")), CValue()));
+
+    CSpreadsheet x12;
+    auto dependents = [&x12](const char *cell) {
+        std::string names;
+        for (const auto &pos: x12.rangeDependents(CPos(cell))) {
+            names += pos.toString() + " ";
+        }
+        return names;
+    };
+    assert (x12.setCell(CPos("A1"), "=sum(B1:B100000)"));
+    assert (x12.setCell(CPos("A2"), "=max(B400:C600) + count(D1:D9)"));
+    assert (x12.setCell(CPos("A3"), "=B500"));
+    assert (dependents("B500") == "A1 A2 ");
+    assert (x12.setCell(CPos("A2"), "=min(C1:C10)"));
+    assert (dependents("B500") == "A1 ");
+    x12.copyRect(CPos("E1"), CPos("A1"), 1, 2);
+    assert (dependents("C5") == "A2 E2 ");
+    // Readers asking at the same time share one build of the index.
+    assert (x12.setCells({{CPos("F1"), "=sum(C1:C9)"}}));
+    std::vector<std::thread> readers;
+    std::vector<size_t> found(4);
+    for (size_t reader = 0; reader < found.size(); ++reader) {
+        readers.emplace_back([&x12, &found, reader] { found[reader] = x12.rangeDependents(CPos("C5")).size(); });
+    }
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    assert (std::all_of(found.begin(), found.end(), [](size_t count) { return count == 3; }));
+    RangeIndex ranges;
+    ranges.activate();
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> coordinate(1, 300);
+    std::vector<RangeIndex::Area> areas(600, {CPos(1, 1), CPos(1, 1)});
+    for (size_t owner = 0; owner < 3000; ++owner) {
+        size_t a = coordinate(random), b = coordinate(random), c = coordinate(random), d = coordinate(random);
+        areas[owner % 600] = {CPos(std::min(a, b), std::min(c, d)), CPos(std::max(a, b), std::max(c, d))};
+        ranges.assign(owner % 600, {areas[owner % 600]});
+    }
+    for (size_t probe = 0; probe < 50; ++probe) {
+        CPos pos(coordinate(random), coordinate(random));
+        std::vector<size_t> expected;
+        for (size_t owner = 0; owner < areas.size(); ++owner) {
+            if (areas[owner].first.getColumn() <= pos.getColumn() && pos.getColumn() <= areas[owner].second.getColumn()
+                && areas[owner].first.getRow() <= pos.getRow() && pos.getRow() <= areas[owner].second.getRow()) {
+                expected.push_back(owner);
+            }
+        }
+        assert (ranges.covering(pos) == expected);
+    }
+
+    CSpreadsheet x13;
+    for (size_t row = 1; row <= 2000; ++row) {
+        assert (x13.setCell(CPos(1, row), std::to_string(row)));
+        assert (x13.setCell(CPos(2, row), "=A" + std::to_string(row) + "*2+1"));
+        assert (x13.setCell(CPos(3, row), std::string(80, 'x')));
+        assert (x13.setCell(CPos(4, row), "a label longer than fifteen characters"));
+    }
+    MemoryUsage filled = x13.memoryUsage();
+    assert (filled.strings == 2000 * 80 && filled.expressionNodes > 0 && filled.total() > filled.cellSlots);
+    for (size_t row = 1; row <= 2000; ++row) {
+        assert (x13.setCell(CPos(3, row), ""));
+        if (row > 10) {
+            assert (x13.setCell(CPos(1, row), ""));
+        }
+    }
+    x13.compact();
+    MemoryUsage compacted = x13.memoryUsage();
+    assert (compacted.strings == 0 && compacted.cellSlots < filled.cellSlots);
+    assert (compacted.expressionNodes < filled.expressionNodes);
+    assert (valueMatch(x13.getValue(CPos("B10")), CValue(21.0)) && valueMatch(x13.getValue(CPos("B11")), CValue()));
+    assert (valueMatch(x13.getValue(CPos("D7")), CValue("a label longer than fifteen characters")));
+    std::string bytes(1000, '\0');
+    for (auto &byte : bytes) {
+        byte = static_cast<char>(random() % 256);
+    }
+    for (size_t offset : {0, 1, 31}) {
+        for (size_t size = 0; size + offset <= bytes.size(); size += 37) {
+            std::string_view part(bytes.data() + offset, size);
+            uint64_t expected = 0;
+            for (char c : part) {
+                expected += static_cast<unsigned char>(c);
+            }
+            for (bool simd : {true, false}) {
+                ByteScan::useSimd(simd);
+                assert (ByteScan::sum(part) == expected);
+                for (size_t from : {size_t(0), size / 2}) {
+                    assert (ByteScan::find(part, part.empty() ? 'x' : part.back(), from) == part.find(part.empty() ? 'x' : part.back(), from));
+                    assert (ByteScan::find(part, '\n', from) == part.find('\n', from));
+                }
+            }
+        }
+    }
+    ByteScan::useSimd(true);
+    std::string cellLines = std::to_string(CPos("A1").getUniqueId()) + ", 5.000000\n"
+                            + std::to_string(CPos("A2").getUniqueId()) + ", \"no newline\"";
+    std::ostringstream unterminated;
+    unterminated << "CHECKSUM " << ByteScan::sum(cellLines + "\n") << "\n" << cellLines;
+    CSpreadsheet x14;
+    iss.clear();
+    iss.str(unterminated.str());
+    assert (x14.load(iss));
+    assert (valueMatch(x14.getValue(CPos("A1")), CValue(5.0)) && valueMatch(x14.getValue(CPos("A2")), CValue("no newline")));
+    assert (ByteScan::crc32c("123456789") == 0xE3069283u);
+    ByteScan::useSimd(false);
+    assert (ByteScan::crc32c("123456789") == 0xE3069283u && ByteScan::crc32c(bytes) == ByteScan::crc32c(bytes.substr(500), ByteScan::crc32c(bytes.substr(0, 500))));
+    ByteScan::useSimd(true);
+    assert (ByteScan::crc32c(bytes) == ByteScan::crc32c(bytes.substr(500), ByteScan::crc32c(bytes.substr(0, 500))));
+
+    CSpreadsheet x15;
+    for (int row = 0; row < 200; ++row) {
+        assert (x15.setCell(CPos(1, row), std::to_string(row)));
+        assert (x15.setCell(CPos(2, row), "=A" + std::to_string(row) + "+1"));
+    }
+    x15.setSaveOrder(CellOrder::RowMajor);
+    x15.setSaveFormat(SaveFormat::Blocks, 512);
+    oss.clear();
+    oss.str("");
+    assert (x15.save(oss));
+    std::string blockFile = oss.str();
+    iss.clear();
+    iss.str(blockFile);
+    std::string header;
+    std::vector<BlockFormat::Block> blocks;
+    assert (getline(iss, header) && BlockFormat::readIndex(header, iss, blocks) && blocks.size() > 4);
+    size_t blockCells = 0, bothColumns = 0;
+    for (const auto &block : blocks) {
+        blockCells += block.cells;
+        bothColumns += block.left != block.right; // Sorted by column, only the block at the switch holds both.
+    }
+    assert (blockCells == 400 && bothColumns <= 1 && blocks.front().right < 2 && blocks.back().right == 2);
+    CSpreadsheet x16;
+    iss.clear();
+    iss.str(blockFile);
+    assert (x16.load(iss));
+    assert (valueMatch(x16.getValue(CPos("B100")), CValue(101.0)));
+    // Swapping two bytes keeps the byte sum, but not the CRC.
+    std::string swapped = blockFile;
+    size_t swapAt = swapped.size() - 8;
+    while (swapped[swapAt] == swapped[swapAt + 1]) --swapAt;
+    std::swap(swapped[swapAt], swapped[swapAt + 1]);
+    assert (swapped != blockFile);
+    iss.clear();
+    iss.str(swapped);
+    assert (!x16.load(iss));
+    iss.clear();
+    iss.str(blockFile.substr(0, blockFile.size() - 1));
+    assert (!x16.load(iss));
+
+    CSpreadsheet x17;
+    for (int row = 1; row <= 3000; ++row) {
+        assert (x17.setCell(CPos(1, row), std::to_string(row % 7 == 0 ? 1.0 / row : row * 3.0)));
+        assert (x17.setCell(CPos(2, 2 * row), row % 3 ? "yes" : "no \"quoted\""));
+        assert (x17.setCell(CPos(3, row), "=A" + std::to_string(row) + "*2"));
+    }
+    assert (x17.setCell(CPos(4, 5), "0.1") && x17.setCell(CPos(4, 6), "") && x17.setCell(CPos(70000, 4000000000u), "-2.5e300"));
+    std::ostringstream textFile, columnarFile;
+    assert (x17.save(textFile));
+    x17.setSaveFormat(SaveFormat::Columnar);
+    assert (x17.save(columnarFile));
+    assert (columnarFile.str().size() * 4 < textFile.str().size());
+    for (bool lazy : {false, true}) {
+        CSpreadsheet x18;
+        x18.setLazyLoading(lazy);
+        iss.clear();
+        iss.str(columnarFile.str());
+        assert (x18.load(iss));
+        for (const CPos &pos : {CPos("A1"), CPos("A7"), CPos("A3000"), CPos("B2"), CPos("B12"), CPos("B3"), CPos("C3000"),
+                                CPos("D5"), CPos("D6"), CPos(70000, 4000000000u)}) {
+            assert (valueMatch(x18.getValue(pos), x17.getValue(pos)));
+        }
+#ifdef EXCEL_ENABLE_STATS
+        // Even the formulas filled down column C wait for their first use.
+        assert (x18.stats().lazyCompilations == (lazy ? 1 : 0));
+#endif /* EXCEL_ENABLE_STATS */
+        // The moved copies not compiled yet are saved in their own rows.
+        std::ostringstream retext;
+        x18.setSaveFormat(SaveFormat::Checksum);
+        assert (x18.save(retext));
+        CSpreadsheet reloaded;
+        iss.clear();
+        iss.str(retext.str());
+        assert (reloaded.load(iss));
+        for (const CPos &pos : {CPos("C1"), CPos("C2"), CPos("C1234"), CPos("C2999")}) {
+            assert (valueMatch(reloaded.getValue(pos), x17.getValue(pos)));
+        }
+        std::ostringstream resaved;
+        x18.setSaveFormat(SaveFormat::Columnar);
+        assert (x18.save(resaved) && resaved.str() == columnarFile.str());
+    }
+    std::string damaged = columnarFile.str();
+    damaged[damaged.size() / 2] ^= 1;
+    iss.clear();
+    iss.str(damaged);
+    assert (!x16.load(iss));
+
+    CSpreadsheet x19;
+    for (int row = 1; row <= 1000; ++row) {
+        std::string r = std::to_string(row);
+        assert (x19.setCell(CPos(1, row), r));
+        assert (x19.setCell(CPos(2, row), "=A" + r + "*2"));
+        assert (x19.setCell(CPos(4, row), "unrelated " + r));
+    }
+    assert (x19.setCell(CPos("C5"), "=sum(B1:B10)+$A$999"));
+    x19.setSaveOrder(CellOrder::RowMajor);
+    for (SaveFormat format : {SaveFormat::Checksum, SaveFormat::Blocks, SaveFormat::Columnar}) {
+        x19.setSaveFormat(format, 1024);
+        std::ostringstream saved;
+        assert (x19.save(saved));
+        std::string file = saved.str();
+        if (format != SaveFormat::Checksum) {
+            // Damage column D: unread, it is not verified either.
+            file[file.rfind("unrelated 500") + 12] ^= 1;
+        }
+        CSpreadsheet x20;
+        iss.clear();
+        iss.str(file);
+        assert (x20.loadRegion(iss, CPos("C1"), 1, 10));
+        assert (valueMatch(x20.getValue(CPos("C5")), CValue(110.0 + 999)));
+        assert (valueMatch(x20.getValue(CPos("B10")), CValue(20.0)) && valueMatch(x20.getValue(CPos("A999")), CValue(999.0)));
+        assert (valueMatch(x20.getValue(CPos("A11")), CValue()) && valueMatch(x20.getValue(CPos("D1")), CValue()));
+        CSpreadsheet x21;
+        iss.clear();
+        iss.str(file);
+        assert (x21.loadColumns(iss, {2}));
+        assert (valueMatch(x21.getValue(CPos("B1000")), CValue(2000.0)) && valueMatch(x21.getValue(CPos("C5")), CValue()));
+        // The whole (undamaged) sheet, with sizes that overflow any area computation.
+        CSpreadsheet whole;
+        iss.clear();
+        iss.str(saved.str());
+        assert (whole.loadRegion(iss, CPos(0, 0), SIZE_MAX, SIZE_MAX));
+        assert (valueMatch(whole.getValue(CPos("C5")), CValue(110.0 + 999)) && valueMatch(whole.getValue(CPos("A1000")), CValue(1000.0)));
+        if (format != SaveFormat::Checksum) {
+            iss.clear();
+            iss.str(file);
+            assert (!x21.loadColumns(iss, {4}));
+        }
+    }
+
+    assert (CsvFormat::completeRecords("a,\"b\nc\"\nd,\"e\n", ',') == 8 && CsvFormat::completeRecords("\"a\"\"\n", ',') == 0);
+    assert (CsvFormat::completeRecords("5 inch\",x\ny\n", ',') == 12 && CsvFormat::completeRecords("a;\"b\n", ';') == 0);
+    CSpreadsheet x22;
+    iss.clear();
+    iss.str("name,price,note\r\n"
+            "apple,1.5,\"red, sweet\"\r\n"
+            "\"pear \"\"green\"\"\",2e3,\"two\nlines\"\n"
+            ",=C3+C4,\"=B3\"\n"
+            "\n"
+            "12,-0.25,7\n"
+            " 3 ,,");
+    assert (x22.importCSV(iss, CPos("B2")));
+    assert (valueMatch(x22.getValue(CPos("C2")), CValue("price")) && valueMatch(x22.getValue(CPos("C3")), CValue(1.5)));
+    assert (valueMatch(x22.getValue(CPos("D3")), CValue("red, sweet")) && valueMatch(x22.getValue(CPos("B4")), CValue("pear \"green\"")));
+    assert (valueMatch(x22.getValue(CPos("D4")), CValue("two\nlines")) && valueMatch(x22.getValue(CPos("B5")), CValue()));
+    assert (valueMatch(x22.getValue(CPos("C5")), CValue(2001.5)) && valueMatch(x22.getValue(CPos("D5")), CValue("=B3")));
+    assert (valueMatch(x22.getValue(CPos("B7")), CValue(12.0)) && valueMatch(x22.getValue(CPos("D7")), CValue(7.0)));
+    assert (valueMatch(x22.getValue(CPos("C7")), CValue(-0.25)) && valueMatch(x22.getValue(CPos("B8")), CValue(" 3 ")));
+    oss.str("");
+    assert (x22.exportCSV(oss, CPos("B2"), 3, 3, ';'));
+    assert (oss.str() == "name;price;note\napple;1.5;red, sweet\n\"pear \"\"green\"\"\";2000;\"two\nlines\"\n");
+    oss.str("");
+    assert (x22.exportCSV(oss, CPos("B5"), 3, 1));
+    assert (oss.str() == ",2001.5,\"=B3\"\n");
+    iss.clear();
+    iss.str("1,2\n\"3,4\n");
+    assert (!x22.importCSV(iss, CPos("A1")));
+    iss.clear();
+    iss.str("1,\"2\"x\n");
+    assert (!x22.importCSV(iss, CPos("A1")));
+    // An unclosed quote is given up on once the record outgrows the limit, not at the end of the input.
+    iss.clear();
+    iss.str("7\n\"" + std::string(CsvFormat::MAX_RECORD_BYTES + 2 * CsvFormat::CHUNK_BYTES, 'x'));
+    assert (!x22.importCSV(iss, CPos("E1")) && iss.tellg() < static_cast<std::streamoff>(iss.str().size()));
+    assert (valueMatch(x22.getValue(CPos("E1")), CValue(7.0)));
+    // A quote inside an unquoted field is text, however long the input.
+    std::string inches = "5 inch\",x\n";
+    while (inches.size() <= CsvFormat::MAX_RECORD_BYTES + CsvFormat::CHUNK_BYTES) {
+        inches += "1,2\n";
+    }
+    iss.clear();
+    iss.str(inches);
+    assert (x22.importCSV(iss, CPos("G1")));
+    assert (valueMatch(x22.getValue(CPos("G1")), CValue("5 inch\"")) && valueMatch(x22.getValue(CPos("H2")), CValue(2.0)));
+
+    // Several chunks, parsed in parallel and inserted in order; the export reads back exactly.
+    CSpreadsheet x23;
+    x23.setIngestThreads(4);
+    std::string csv;
+    for (int row = 0; row < 50000; ++row) {
+        csv += std::to_string(row) + "," + std::to_string(row * 0.1) + ",\"item\n" + std::to_string(row % 7) + "\"\n";
+    }
+    iss.clear();
+    iss.str(csv);
+    assert (x23.importCSV(iss, CPos("A1")));
+    assert (valueMatch(x23.getValue(CPos(1, 49999)), CValue(49998.0)) && valueMatch(x23.getValue(CPos(3, 50000)), CValue("item\n5")));
+    assert (valueMatch(x23.getValue(CPos(1, 50001)), CValue()));
+    oss.str("");
+    assert (x23.exportCSV(oss, CPos("A1"), 3, 50000));
+    CSpreadsheet x24;
+    iss.clear();
+    iss.str(oss.str());
+    assert (x24.importCSV(iss, CPos("A1")));
+    for (int row = 1; row <= 50000; row += 997) {
+        for (int column = 1; column <= 3; ++column) {
+            assert (valueMatch(x24.getValue(CPos(column, row)), x23.getValue(CPos(column, row))));
+        }
+    }
+
+    // Numbers are told from text without exceptions, reading what std::stod reads.
+    CSpreadsheet x25;
+    for (const auto &[contents, expected] : std::vector<std::pair<std::string, CValue>>{
+            {" 12", 12.0}, {"+5", 5.0}, {"-0x1A", -26.0}, {"1e3", 1000.0}, {".5", 0.5}, {"12abc", "12abc"},
+            {"1e999", "1e999"}, {"- 1", "- 1"}, {"+-1", "+-1"}, {"0x", "0x"}, {"0x-1", "0x-1"}, {"7 ", "7 "}}) {
+        assert (x25.setCell(CPos("A1"), contents) && valueMatch(x25.getValue(CPos("A1")), expected));
+    }
+
+    // Failing formulas report their error code instead of throwing.
+    CSpreadsheet x26;
+    assert (x26.setCell(CPos("A1"), "=Z1+1"));
+    assert (x26.setCell(CPos("A2"), "=1/(A3-A3)"));
+    assert (x26.setCell(CPos("A3"), "5"));
+    assert (x26.setCell(CPos("A4"), "=A5"));
+    assert (x26.setCell(CPos("A5"), "=A4"));
+    assert (x26.setCell(CPos("A6"), "=sum(Z1:Z9)"));
+    assert (x26.setCell(CPos("A7"), "=-\"text\""));
+    assert (x26.setCell(CPos("A8"), "=if(A2, 1, 2)"));
+    assert (x26.setCell(CPos("A9"), "=count(A1:A8)"));
+    for (int row = 1; row <= 8; ++row) {
+        if (row != 3) {
+            assert (valueMatch(x26.getValue(CPos(1, row)), CValue()));
+        }
+    }
+#ifdef EXCEL_ENABLE_STATS
+    // Cells whose formula reads a failed one count the failure too: A8 fails on A2, and
+    // A4 and A5 each find the cycle in the other.
+    const auto &errors = x26.stats().errors;
+    assert (errors[size_t(CellError::Ref)] == 1 && errors[size_t(CellError::Div0)] == 2);
+    assert (errors[size_t(CellError::Cycle)] == 2 && errors[size_t(CellError::Num)] == 1);
+    assert (errors[size_t(CellError::Value)] == 2 && errors[size_t(CellError::None)] == 0);
+#endif /* EXCEL_ENABLE_STATS */
+    // A failed formula counts as undefined in the ranges that read it.
+    assert (valueMatch(x26.getValue(CPos("A9")), CValue(1.0)));
+    const CellError expectedErrors[] = {CellError::Ref, CellError::Div0, CellError::None, CellError::Cycle,
+                                        CellError::Cycle, CellError::Num, CellError::Value, CellError::Value,
+                                        CellError::None, CellError::None};
+    for (int row = 1; row <= 10; ++row) {
+        assert (x26.getError(CPos(1, row)) == expectedErrors[row - 1]);
+    }
+    assert (std::string(cellErrorName(x26.getError(CPos("A2")))) == "#DIV/0!");
+    // Joining text to a failed formula fails as well, without throwing through the ranges that read it.
+    assert (x26.setCell(CPos("B1"), "=1/0") && x26.setCell(CPos("B2"), "=\"x\"+B1"));
+    assert (x26.setCell(CPos("B3"), "=count(B1:B2)") && x26.setCell(CPos("B4"), "=count(B1:B2)+1"));
+    assert (valueMatch(x26.getValue(CPos("B3")), CValue(0.0)) && valueMatch(x26.getValue(CPos("B4")), CValue(1.0)));
+    assert (x26.getError(CPos("B2")) == CellError::Value);
+
+    // A bulk insertion stopped by a parse error leaves the range index in step with the cells.
+    CSpreadsheet x27;
+    assert (x27.rangeDependents(CPos("A5")).empty());
+    bool threw = false;
+    try {
+        x27.setCells({{CPos("B1"), "=sum(A1:A10)"}, {CPos("B2"), "=1+"}});
+    } catch (const std::exception &) {
+        threw = true;
+    }
+    std::vector<CPos> staleCheck = x27.rangeDependents(CPos("A5"));
+    assert (threw && staleCheck.size() == 1 && staleCheck[0].getUniqueId() == CPos("B1").getUniqueId());
+
+    // Quotes in the text of a formula survive a save and a load.
+    CSpreadsheet x28;
+    assert (x28.setCell(CPos("A1"), "=\"say \"\"hi\"\"\""));
+    oss.clear();
+    oss.str("");
+    assert (x28.save(oss));
+    for (bool lazy : {false, true}) {
+        CSpreadsheet quotes;
+        quotes.setLazyLoading(lazy);
+        iss.clear();
+        iss.str(oss.str());
+        assert (quotes.load(iss) && valueMatch(quotes.getValue(CPos("A1")), CValue("say \"hi\"")));
+    }
     return EXIT_SUCCESS;
 }
 